@@ -2,298 +2,182 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <ctype.h>
-#include <limits.h>
 
-#define MAX_INSTRUCTIONS 256
-#define MAX_WORDS 3
-#define MAX_WORD_LENGTH 20
+#include "GIBCPU.h"
 
-#define AND     0
-#define OR      16
-#define XOR     32
-#define ADD     48
-#define SUB     64
-#define NOTB    80
-#define SHIFTB  96
-#define LSHIFTB 112
-#define LOAD    128
-#define WRT     144
-#define JMPZ    160
-#define JMP     176
-#define LOADL   192
-#define WRTL    208
-#define HALT    240
+#define BINARY_LINE_LENGTH 9
+#define OPTIMIZE_BUDGET 1000000000ULL  // posEdges each version may run while measuring the saving
 
-#define r0      0
-#define r1      1
-#define r2      2
-#define r3      3
-
-void removeFirstChar(char *str) {
-    if (str && *str) { // Check for NULL pointer and empty string
-        memmove(str, str + 1, strlen(str));
-    }
-}
-
-int stringToInt(const char *str) {
-    int num = 0;
-    const int n = 10;  // Base 10 for decimal numbers
-
-    // Check for null pointer
-    if (str == NULL) {
-        return 0; // Return zero if the input is NULL
-    }
-
-    // Skip whitespace
-    while (*str == ' ') {
-        str++;
+// Legacy RAM.txt output, one "01010101" line per byte
+void writeBinaryFile(const char *filename, const uint8_t *values, size_t length) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error opening file");
+        return;
     }
 
-    // Convert each character to the corresponding integer value
-    while (*str >= '0' && *str <= '9') {
-        if (num > INT_MAX / n || (num == INT_MAX / n && (*str - '0') > INT_MAX % n)) {
-            // Handle overflow
-            return INT_MAX;
+    char line[BINARY_LINE_LENGTH + 1];
+    line[BINARY_LINE_LENGTH - 1] = '\n';
+    line[BINARY_LINE_LENGTH] = '\0';
+    for (size_t i = 0; i < length; ++i) {
+        for (int j = 7; j >= 0; --j) {
+            // Write each bit of the byte
+            line[7 - j] = (values[i] & (1 << j)) ? '1' : '0';
         }
-        num = num * n + (*str - '0');
-        str++;
+        fputs(line, file);
     }
 
-    return num;
+    fclose(file);
 }
 
-int varToInt(char *str){
-    char var[10];
-    strcpy(var,str);
-    removeFirstChar(var);
-    return stringToInt(var); 
+// Name of a file written next to the image: same name with its extension replaced
+void siblingFile(const char *image, const char *extension, char *out, size_t size) {
+    snprintf(out, size, "%s", image);
+    char *dot = strrchr(out, '.');
+    char *slash = strrchr(out, '/');
+    if (dot && (!slash || dot > slash)) {
+        *dot = '\0';
+    }
+    strncat(out, extension, size - strlen(out) - 1);
 }
 
-int readAssemblyInstructions(const char *filename, char instructions[MAX_INSTRUCTIONS][MAX_WORDS][MAX_WORD_LENGTH]) {
-    FILE *file = fopen(filename, "r");
+// Whole source file into a NUL-terminated buffer
+char *readSourceFile(const char *filename, size_t *length) {
+    FILE *file = fopen(filename, "rb");
     if (file == NULL) {
         perror("Error opening file");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
-
-    char line[3 * MAX_WORD_LENGTH + 2]; // +2 for potential spaces and a newline
-    int instr_count = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        if (instr_count >= MAX_INSTRUCTIONS) {
-            fprintf(stderr, "Error: Instruction limit exceeded\n");
-            break;
-        }
-
-        // Remove newline character if present
-        line[strcspn(line, "\n")] = 0;
-
-        // Tokenize the instruction line
-        char *token = strtok(line, " ");
-        int word_count = 0;
-        
-        while (token != NULL && word_count < MAX_WORDS) {
-            strncpy(instructions[instr_count][word_count], token, MAX_WORD_LENGTH);
-            instructions[instr_count][word_count][MAX_WORD_LENGTH - 1] = '\0'; // Ensure null-termination
-            token = strtok(NULL, " ");
-            word_count++;
+    char *source = NULL;
+    size_t size = 0;
+    size_t allocated = 0;
+    size_t n;
+    do {
+        if (size + 4096 + 1 > allocated) {
+            allocated = allocated ? allocated * 2 : 8192;
+            char *grown = realloc(source, allocated);
+            if (grown == NULL) {
+                free(source);
+                fclose(file);
+                return NULL;
+            }
+            source = grown;
         }
+        n = fread(source + size, 1, 4096, file);
+        size += n;
+    } while (n > 0);
+    fclose(file);
+    source[size] = '\0';
+    *length = size;
+    return source;
+}
 
-        // Log the instruction read
-        printf("Instruction %d: %s %s %s\n", instr_count, 
-               instructions[instr_count][0],
-               word_count > 1 ? instructions[instr_count][1] : "",
-               word_count > 2 ? instructions[instr_count][2] : "");
-
-        instr_count++;
+// Clock cycles of a run to HALT, 0 if it did not halt within the budget
+uint64_t measureCycles(const GibCPUAssembly *assembly, uint64_t *loops) {
+    GibCPU *cpu = gibcpuCreate();
+    if (cpu == NULL) {
+        return 0;
     }
-
-    fclose(file);
-    return instr_count;
+    gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+    gibcpuLoadAssembly(cpu, assembly);
+    uint64_t cycles = gibcpuRun(cpu, OPTIMIZE_BUDGET) ? gibcpuCycles(cpu) : 0;
+    *loops = gibcpuLoops(cpu);
+    gibcpuDestroy(cpu);
+    return cycles;
 }
 
-void writeBinaryFile(const char *filename, const uint8_t *values, size_t length) {
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        perror("Error opening file");
+// What "--optimize" removed, and the clock cycles it saves over a whole run
+void reportOptimization(const char *sourceFile, const char *source, size_t length, const GibCPUAssembly *optimized) {
+    if (optimized->note[0]) {
+        printf("Not optimized, %s\n", optimized->note);
         return;
     }
-
-    for (size_t i = 0; i < length; ++i) {
-        for (int j = 7; j >= 0; --j) {
-            // Write each bit of the byte
-            fprintf(file, "%c", (values[i] & (1 << j)) ? '1' : '0');
-        }
-        fprintf(file, "\n");
+    for (int i = 0; i < optimized->removed; i++) {
+        printf("%s:%d: removed\n", sourceFile, optimized->removedLine[i]);
     }
+    printf("Removed %d instructions, %llu clock cycles each time through all of them\n", optimized->removed,
+           (unsigned long long)optimized->cyclesSaved);
 
-    fclose(file);
+    GibCPUAssembly *original = malloc(sizeof(GibCPUAssembly));
+    if (original == NULL || gibcpuAssemble(source, length, original)) {
+        free(original);
+        return;
+    }
+    uint64_t originalLoops, optimizedLoops;
+    uint64_t before = measureCycles(original, &originalLoops);
+    uint64_t after = measureCycles(optimized, &optimizedLoops);
+    if (before && after) {
+        printf("Run to HALT: %llu -> %llu clock cycles (%.1f%% fewer), %llu -> %llu print passes\n",
+               (unsigned long long)before, (unsigned long long)after, 100.0 * (before - (double)after) / before,
+               (unsigned long long)originalLoops, (unsigned long long)optimizedLoops);
+    }
+    free(original);
 }
 
-int main() {
-    char instructions[MAX_INSTRUCTIONS][MAX_WORDS][MAX_WORD_LENGTH] = {0};
-    uint8_t ram[MAX_INSTRUCTIONS] = {0};
-    uint8_t variableLocations[MAX_INSTRUCTIONS] = {0};
-    uint8_t locationLocations[MAX_INSTRUCTIONS] = {0};
-    uint8_t num_memops[MAX_INSTRUCTIONS] = {0};
-    int ram_location = 0;
-    
-    int instr_count = readAssemblyInstructions("assembly.txt", instructions);
-
-    for(int i = 0; i < instr_count; i++){
-        if(isalpha(instructions[i][0][0])){                                 // for all commands
-            // add register values to command first
-
-            // For two-variable operations, add register A
-            if(!strcmp(instructions[i][0], "and")   ||                      
-            !strcmp(instructions[i][0], "or")       || 
-            !strcmp(instructions[i][0], "xor")      || 
-            !strcmp(instructions[i][0], "add")      ||
-            !strcmp(instructions[i][0], "sub")      ||
-            !strcmp(instructions[i][0], "loadl")    ||
-            !strcmp(instructions[i][0], "wrtl") )    
-            {
-                ram[ram_location] += (instructions[i][1][1] - '0') << 2;    // add register A
-            }
+int main(int argc, char *argv[]) {
+    // "Assembler [--text] [--optimize] [--emit-c] [SOURCE [IMAGE]]", assembly.txt and RAM.gib by default
+    int text = 0;
+    int optimize = 0;
+    int emitC = 0;
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++) {
+        text |= !strcmp(argv[arg], "--text");
+        optimize |= !strcmp(argv[arg], "--optimize");
+        emitC |= !strcmp(argv[arg], "--emit-c");
+    }
+    const char *sourceFile = argc > arg ? argv[arg] : "assembly.txt";
+    const char *imageFile = argc > arg + 1 ? argv[arg + 1] : "RAM.gib";
+    char textFile[256];
+    char mapFile[256];
+    char cFile[256];
+    siblingFile(imageFile, ".txt", textFile, sizeof(textFile));
+    siblingFile(imageFile, ".map", mapFile, sizeof(mapFile));
+    siblingFile(imageFile, ".c", cFile, sizeof(cFile));
+
+    size_t length;
+    char *source = readSourceFile(sourceFile, &length);
+    if (source == NULL) {
+        return 1;
+    }
+    GibCPUAssembly *assembly = malloc(sizeof(GibCPUAssembly));
+    int failed = assembly == NULL;
+    if (!failed) {
+        failed = optimize ? gibcpuAssembleOptimized(source, length, assembly) : gibcpuAssemble(source, length, assembly);
+    }
+    if (failed) {
+        if (assembly) {
+            fprintf(stderr, "%s:%d: %s\n", sourceFile, assembly->errorLine, assembly->error);
+        }
+        free(assembly);
+        free(source);
+        return 1;
+    }
 
-            // For all operations that use at least one register, add register B
-            if(!strcmp(instructions[i][0], "load")  ||                      // mem operations pull register B from slot 1
-            !strcmp(instructions[i][0], "wrt")      || 
-            !strcmp(instructions[i][0], "jmpz")     || 
-            !strcmp(instructions[i][0], "notb")     || 
-            !strcmp(instructions[i][0], "shiftb")   || 
-            !strcmp(instructions[i][0], "lshiftb"))
-            {
-                ram[ram_location] += (instructions[i][1][1]) - '0'; 
-            }
-            else if(strcmp(instructions[i][0], "halt") && strcmp(instructions[i][0], "jmp")){    // HALT and JUMP have no register calls. This last case may be redundant
-                ram[ram_location] += (instructions[i][2][1]) - '0';
-            }
+    // print RAM
+    for (size_t i = 0; i < assembly->length; i++) {
+        printf("%u\n", assembly->image[i]);
+    }
 
-            // add correct command opcode
-            if(!strcmp(instructions[i][0], "load")  ||                      // Can't do case statement on strings apparently
-            !strcmp(instructions[i][0], "wrt")      || 
-            !strcmp(instructions[i][0], "jmpz")     || 
-            !strcmp(instructions[i][0], "jmp"))
-            {
-                printf("mem operation\n");
-                if(!strcmp(instructions[i][0], "load")){
-                    ram[ram_location] += LOAD;
-                }
-                else if(!strcmp(instructions[i][0], "wrt")){
-                    ram[ram_location] += WRT;
-                }
-                else if(!strcmp(instructions[i][0], "jmpz")){
-                    ram[ram_location] += JMPZ;
-                }
-                else if(!strcmp(instructions[i][0], "jmp")){
-                    ram[ram_location] += JMP;
-                }
-                else{
-                    printf("weehee woohoo!\n");
-                }
-                ram_location += 2;                                          // each memory operation is followed by a variable which is filled in later
-                num_memops[i+1]++;                                          // track number of memops for variable offset later
-            }
-            else{
-                printf("arithmetic operation\n");
-                if(!strcmp(instructions[i][0], "and")){
-                    ram[ram_location] += AND;
-                }
-                else if(!strcmp(instructions[i][0], "or")){
-                    ram[ram_location] += OR;
-                }
-                else if(!strcmp(instructions[i][0], "xor")){
-                    ram[ram_location] += XOR;
-                }
-                else if(!strcmp(instructions[i][0], "add")){
-                    ram[ram_location] += ADD;
-                }
-                else if(!strcmp(instructions[i][0], "sub")){
-                    ram[ram_location] += SUB;
-                }
-                else if(!strcmp(instructions[i][0], "notb")){
-                    ram[ram_location] += NOTB;
-                }
-                else if(!strcmp(instructions[i][0], "shiftb")){
-                    ram[ram_location] += SHIFTB;
-                }
-                else if(!strcmp(instructions[i][0], "lshiftb")){
-                    ram[ram_location] += LSHIFTB;
-                }
-                else if(!strcmp(instructions[i][0], "halt")){
-                    ram[ram_location] += HALT;
-                }
-                else if(!strcmp(instructions[i][0], "loadl")){              //not ALUops, but only 1 byte
-                    ram[ram_location] += LOADL;
-                }
-                else if(!strcmp(instructions[i][0], "wrtl")){
-                    ram[ram_location] += WRTL;
-                }
-                else{
-                    printf("wahoo weehee!\n");
-                }
-                ram_location++;
-            }
-        }
-        else{                                                               // for all data variables / jump locations
-            int varNum = 0;
-            if(instructions[i][0][0] == '$'){   // variable
-                printf("variable\n");
-                ram[ram_location] = stringToInt(instructions[i][1]);        // enter binary data for variable at variable location
-                varNum = varToInt(instructions[i][0]);
-                variableLocations[varNum] = ram_location;                   // log variable location
-            }
-            else{                               // location
-                printf("location\n");
-                ram[ram_location] = stringToInt(instructions[i][1]);
-                varNum = varToInt(instructions[i][0]);
-                locationLocations[varNum] = ram_location;
-            }
-            ram_location++;
-        }
-        if(i != 0) num_memops[i] += num_memops[i-1];                        // running tally of memops along instruction set
+    // "--optimize" runs the peephole and dead-store pass and reports what it saved
+    if (optimize) {
+        reportOptimization(sourceFile, source, length, assembly);
     }
 
-    // backtrack through the RAM and fill in the nextVals for all memory operations
-    int backtrack = 0;
-    int varNum = 0;
-    uint8_t locationAlreadySet[MAX_INSTRUCTIONS] = {0};
-    for(int i = 0; i < instr_count; i++){
-        if(instructions[i][2][0] == '$'){                                   // for commands with variables in word 2,
-            backtrack++;                                                    // move to variable location position
-            varNum = varToInt(instructions[i][2]);                          // parse variable name
-            ram[backtrack] = variableLocations[varNum];                     // place variable location in position
-        }                                                                   // (no need for binary offset, these are true program values set by user)
-        if(instructions[i][2][0] == '#'){                                   // for commands with locations in word 2 (jmpz)
-            backtrack++;
-            varNum = varToInt(instructions[i][2]);
-            ram[backtrack] = locationLocations[varNum];
-            //offset jump address by number of memops up to that point to make jump position accurate to the binary file size
-            if(!locationAlreadySet[varNum]){
-                ram[locationLocations[varNum]] += num_memops[ram[locationLocations[varNum]]];  
-                locationAlreadySet[varNum] = 1;
-            }
-        }
-        if(instructions[i][1][0] == '#'){                                   // for commands with locations in word 1 (jmp)
-            backtrack++;
-            varNum = varToInt(instructions[i][1]);
-            ram[backtrack] = locationLocations[varNum];
-            if(!locationAlreadySet[varNum]){
-                ram[locationLocations[varNum]] += num_memops[ram[locationLocations[varNum]]];  
-                locationAlreadySet[varNum] = 1;
-            } 
-        }
-        backtrack++;
+    // "--text" also writes the legacy RAM.txt
+    failed = gibcpuWriteImageFile(imageFile, assembly->image, assembly->length, &assembly->info);
+    if (!failed && text) {
+        writeBinaryFile(textFile, assembly->image, assembly->length);
     }
-    
-    // print RAM
-    for(int i = 0; i < ram_location; i++){
-        printf("%u\n", ram[i]);
+    if (!failed) {
+        failed = gibcpuWriteSymbolMap(mapFile, source, length, assembly);
     }
 
-    writeBinaryFile("RAM.txt", ram, ram_location);
+    // "--emit-c" also translates the program to C, for a standalone build with the host compiler
+    if (!failed && emitC) {
+        failed = gibcpuWriteC(cFile, assembly);
+    }
 
-    return 0;
+    free(assembly);
+    free(source);
+    return failed;
 }
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "GIBCPU.h"
+
+// Throughput benchmark: runs every image given on the command line on every engine and prints one CSV line
+// per (workload, engine). The "make bench" corpus is the shipped Game of Life, two loop programs from
+// GIBCPU_instructionset.xlsx (bench/loop_direct.asm and bench/full_operation.asm), an ALU-bound kernel
+// (bench/alu.asm), a LOADL/WRTL-bound kernel (bench/memory.asm), a bank-switching kernel
+// (bench/banked.asm), the TAS spinlock demo run on a single core (bench/spinlock.asm) and a shift-and-add
+// multiply kernel (bench/multiply.asm). bench/multiply_coproc.asm and bench/game_of_life_coproc.asm do the
+// work of the multiply kernel and the Game of Life on the coprocessor.
+//
+// Every run restores the snapshot taken just after loading, so code caches start cold each time. A
+// repetition is as many back-to-back runs as it takes to last at least --min-time on that engine, found
+// during warmup. Times come from CLOCK_MONOTONIC and the median repetition is reported.
+
+#define DEFAULT_REPS 5
+#define DEFAULT_WARMUP 1
+#define DEFAULT_MIN_TIME 0.05           // seconds per repetition
+#define DEFAULT_TOLERANCE 10.0          // percent slower than the baseline that counts as a regression
+#define RUN_BUDGET 4000000000ULL        // posEdges, stops a workload that never halts
+#define MAX_WORKLOADS 64
+#define CSV_HEADER "workload,engine,runs,reps,cycles_per_run,instructions_per_run,median_s,best_s," \
+                   "guest_cycles_per_s,instructions_per_s,ns_per_instruction"
+
+typedef struct {
+    char workload[128];
+    char engine[16];
+    double instructionsPerSecond;
+} BaselineEntry;
+
+static const char *engineNames[] = {"cycle", "fast", "threaded", "jit", "collapsed"};
+#define COLLAPSED_ROW (GIBCPU_ENGINE_JIT + 1)     // the cycle-level model on the collapsed microcode
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Workload name: the image file name without directory or extension
+static void workloadName(const char *file, char *out, size_t size){
+    const char *slash = strrchr(file, '/');
+    snprintf(out, size, "%s", slash ? slash + 1 : file);
+    char *dot = strrchr(out, '.');
+    if(dot){
+        *dot = '\0';
+    }
+}
+
+// Seconds taken by runs back-to-back runs from the loaded state
+static double timeRuns(GibCPU *cpu, const GibCPUSnapshot *loaded, long runs){
+    double start = now();
+    for(long i = 0; i < runs; i++){
+        gibcpuRestore(cpu, loaded);
+        gibcpuRun(cpu, RUN_BUDGET);
+    }
+    return now() - start;
+}
+
+// Instructions in one run, counted by the profiler on the cycle-level model
+static uint64_t countInstructions(GibCPU *cpu, const GibCPUSnapshot *loaded){
+    GibCPUProfile *profile = calloc(1, sizeof(GibCPUProfile));
+    if(!profile){
+        return 0;
+    }
+    gibcpuRestore(cpu, loaded);
+    gibcpuSetProfile(cpu, profile);
+    gibcpuRun(cpu, RUN_BUDGET);
+    gibcpuSetProfile(cpu, NULL);
+    uint64_t instructions = 0;
+    for(int i = 0; i < 16; i++){
+        instructions += profile->opcodeCount[i];
+    }
+    free(profile);
+    return instructions;
+}
+
+/* SUPERINSTRUCTION GENERATOR */
+
+#define SUPER_MAX 12                    // superinstructions written to the header
+#define SUPER_MIN_SHARE 0.02            // dispatches saved per instruction run, summed over the workloads
+#define SUPER_MIN_INSTRUCTIONS 256      // shorter workloads are straight-line code that never comes round again
+
+static const char *opcodeMacros[16] = {
+    "AND", "OR", "XOR", "ADD", "SUB", "NOTB", "SHIFTB", "LSHIFTB",
+    "LOAD", "WRT", "JMPZ", "JMP", "LOADL", "WRTL", "TAS", "HALT"
+};
+
+typedef struct {
+    double score;
+    uint8_t ops[3];
+    int length;
+} SuperCandidate;
+
+// The threaded engine fuses any opcodes but TAS (it may wait for the bus) and HALT, with a jump only last
+static int fusable(const uint8_t *ops, int length){
+    for(int i = 0; i < length; i++){
+        int jump = ops[i] == 10 || ops[i] == 11;
+        if(ops[i] == 14 || ops[i] == 15 || (jump && i + 1 < length)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int compareCandidates(const void *a, const void *b){
+    double x = ((const SuperCandidate *)a)->score;
+    double y = ((const SuperCandidate *)b)->score;
+    return (x < y) - (x > y);
+}
+
+// Profile every image on the cycle-level model and write the back-to-back opcode sequences that would save the
+// most dispatches as the X-macro lists GIBCPU_Superinstructions.h defines. Each workload counts the same
+// whatever its length: a sequence scores the dispatches it saves as a share of the instructions run.
+static int writeSuperinstructions(const char *filename, const char **images, int imageCount){
+    static SuperCandidate candidates[16 * 16 + 16 * 16 * 16];
+    int profiled[MAX_WORKLOADS] = {0};
+    GibCPUProfile *profile = malloc(sizeof(GibCPUProfile));
+    GibCPU *cpu = gibcpuCreate();
+    if(!profile || !cpu){
+        printf("Out of memory\n");
+        free(profile);
+        gibcpuDestroy(cpu);
+        return 1;
+    }
+    for(int i = 0; i < 16 * 16; i++){
+        candidates[i].ops[0] = i >> 4;
+        candidates[i].ops[1] = i & 15;
+        candidates[i].length = 2;
+    }
+    for(int i = 0; i < 16 * 16 * 16; i++){
+        SuperCandidate *c = &candidates[16 * 16 + i];
+        c->ops[0] = i >> 8;
+        c->ops[1] = (i >> 4) & 15;
+        c->ops[2] = i & 15;
+        c->length = 3;
+    }
+
+    for(int w = 0; w < imageCount; w++){
+        if(!gibcpuLoadImageFile(cpu, images[w], NULL)){
+            continue;
+        }
+        memset(profile, 0, sizeof(GibCPUProfile));
+        gibcpuSetProfile(cpu, profile);
+        gibcpuRun(cpu, RUN_BUDGET);
+        gibcpuSetProfile(cpu, NULL);
+        uint64_t instructions = 0;
+        for(int i = 0; i < 16; i++){
+            instructions += profile->opcodeCount[i];
+        }
+        if(instructions < SUPER_MIN_INSTRUCTIONS){
+            continue;
+        }
+        profiled[w] = 1;
+        for(int i = 0; i < 16 * 16; i++){
+            candidates[i].score += (double)profile->opcodePairs[i >> 4][i & 15] / instructions;
+        }
+        for(int i = 0; i < 16 * 16 * 16; i++){
+            candidates[16 * 16 + i].score += 2.0 * profile->opcodeTriples[i >> 8][(i >> 4) & 15][i & 15] / instructions;
+        }
+    }
+    free(profile);
+    gibcpuDestroy(cpu);
+
+    int count = sizeof(candidates) / sizeof(candidates[0]);
+    qsort(candidates, count, sizeof(SuperCandidate), compareCandidates);
+    int chosen = 0;
+    for(int i = 0; i < count && chosen < SUPER_MAX && candidates[i].score >= SUPER_MIN_SHARE; i++){
+        if(fusable(candidates[i].ops, candidates[i].length)){
+            candidates[chosen++] = candidates[i];
+        }
+    }
+
+    FILE *out = fopen(filename, "w");
+    if(!out){
+        perror("Error opening superinstruction header");
+        return 1;
+    }
+    fprintf(out, "#ifndef GIBCPU_SUPERINSTRUCTIONS_H\n#define GIBCPU_SUPERINSTRUCTIONS_H\n\n");
+    fprintf(out, "// Superinstructions of the threaded engine, generated by \"make superinstructions\" from a profile of the\n");
+    fprintf(out, "// bench corpus: each one runs back-to-back instructions with these opcodes in one dispatch. Listed by\n");
+    fprintf(out, "// dispatches saved per instruction of a workload, summed over the workloads:\n//");
+    for(int w = 0; w < imageCount; w++){
+        char name[128];
+        workloadName(images[w], name, sizeof(name));
+        fprintf(out, profiled[w] ? " %s" : "", name);
+    }
+    fprintf(out, "\n");
+    for(int length = 3; length >= 2; length--){
+        fprintf(out, "\n#define GIBCPU_SUPER_%s(X)", length == 3 ? "TRIPLES" : "PAIRS");
+        for(int i = 0; i < chosen; i++){
+            const uint8_t *ops = candidates[i].ops;
+            char entry[64];
+            if(candidates[i].length != length){
+                continue;
+            }
+            if(length == 3){
+                snprintf(entry, sizeof(entry), "X(%s, %s, %s)", opcodeMacros[ops[0]], opcodeMacros[ops[1]], opcodeMacros[ops[2]]);
+            }
+            else{
+                snprintf(entry, sizeof(entry), "X(%s, %s)", opcodeMacros[ops[0]], opcodeMacros[ops[1]]);
+            }
+            fprintf(out, " \\\n    %-24s /* %.3f */", entry, candidates[i].score);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "\n#endif\n");
+    int failed = fclose(out) != 0;
+    printf("%d superinstructions written to %s\n", chosen, filename);
+    return failed;
+}
+
+/* PIPELINE COMPARISON */
+
+#define PIPELINE_CSV_HEADER "workload,fetch_bytes,forwarding,instructions,fsm_cycles,pipeline_cycles,fsm_cpi," \
+                            "pipeline_cpi,speedup,fill,fetch,port,data,execute,jump,self_modify"
+
+// Time every image on the pipelined core model with one- and two-byte fetch, with and without forwarding,
+// and print one CSV line per (workload, variant) with the stall breakdown in posEdges
+static int comparePipelines(const char **images, int imageCount, const char *outFile){
+    GibCPU *cpu = gibcpuCreate();
+    if(!cpu){
+        printf("Out of memory\n");
+        return 1;
+    }
+    FILE *out = NULL;
+    if(outFile){
+        out = fopen(outFile, "w");
+        if(!out){
+            perror("Error opening output");
+            gibcpuDestroy(cpu);
+            return 1;
+        }
+        fprintf(out, "%s\n", PIPELINE_CSV_HEADER);
+    }
+    printf("%s\n", PIPELINE_CSV_HEADER);
+
+    for(int w = 0; w < imageCount; w++){
+        if(!gibcpuLoadImageFile(cpu, images[w], NULL)){
+            continue;
+        }
+        GibCPUSnapshot loaded;
+        gibcpuSnapshot(cpu, &loaded);
+        char name[128];
+        workloadName(images[w], name, sizeof(name));
+        for(int variant = 0; variant < 4; variant++){
+            GibCPUPipelineConfig config = {1 + variant / 2, variant % 2};
+            GibCPUPipelineStats stats;
+            gibcpuRestore(cpu, &loaded);
+            gibcpuRunPipelined(cpu, RUN_BUDGET, &config, &stats);
+            double instructions = stats.instructions ? (double)stats.instructions : 1.0;
+            char line[512];
+            int n = snprintf(line, sizeof(line), "%s,%d,%d,%llu,%llu,%llu,%.3f,%.3f,%.3f", name, config.fetchBytes,
+                             config.forwarding, (unsigned long long)stats.instructions,
+                             (unsigned long long)stats.fsmPosEdges, (unsigned long long)stats.posEdges,
+                             stats.fsmPosEdges / instructions, stats.posEdges / instructions,
+                             stats.posEdges ? (double)stats.fsmPosEdges / stats.posEdges : 0.0);
+            for(int i = 0; i < GIBCPU_STALL_CAUSES && n < (int)sizeof(line); i++){
+                n += snprintf(line + n, sizeof(line) - n, ",%llu", (unsigned long long)stats.stalls[i]);
+            }
+            printf("%s\n", line);
+            if(out){
+                fprintf(out, "%s\n", line);
+            }
+        }
+    }
+    gibcpuDestroy(cpu);
+    return out && fclose(out) != 0;
+}
+
+static int readBaseline(const char *filename, BaselineEntry *entries, int max){
+    FILE *file = fopen(filename, "r");
+    if(!file){
+        perror("Error opening baseline");
+        return -1;
+    }
+    char line[512];
+    int count = 0;
+    while(count < max && fgets(line, sizeof(line), file)){
+        BaselineEntry *e = &entries[count];
+        if(sscanf(line, "%127[^,],%15[^,],%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%lf",
+                  e->workload, e->engine, &e->instructionsPerSecond) == 3){
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+int main(int argc, char *argv[]){
+    int reps = DEFAULT_REPS;
+    int warmup = DEFAULT_WARMUP;
+    double minTime = DEFAULT_MIN_TIME;
+    double tolerance = DEFAULT_TOLERANCE;
+    const char *baselineFile = NULL;
+    const char *outFile = NULL;
+    const char *superFile = NULL;
+    int pipeline = 0;
+    const char *images[MAX_WORKLOADS];
+    int imageCount = 0;
+
+    // "Benchmark [--reps N] [--warmup N] [--min-time SECONDS] [--out FILE] [--compare BASELINE.csv
+    // [--tolerance PERCENT]] IMAGE..." writes CSV to stdout (and FILE). With a baseline from an earlier
+    // version, every workload/engine pair that got slower by more than the tolerance is reported and the
+    // exit status is 1. "Benchmark --superinstructions HEADER IMAGE..." profiles the images instead and writes
+    // the threaded engine's superinstruction set to HEADER. "Benchmark --pipeline [--out FILE] IMAGE..." prints
+    // CPI on the pipelined core model against memCtrl() instead of timing the engines.
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--reps")){
+            reps = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--warmup")){
+            warmup = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--min-time")){
+            minTime = atof(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--compare")){
+            baselineFile = argv[++i];
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--tolerance")){
+            tolerance = atof(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--out")){
+            outFile = argv[++i];
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--superinstructions")){
+            superFile = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--pipeline")){
+            pipeline = 1;
+        }
+        else if(imageCount < MAX_WORKLOADS){
+            images[imageCount++] = argv[i];
+        }
+    }
+    if(imageCount == 0 || reps < 1){
+        printf("Usage: Benchmark [--reps N] [--warmup N] [--min-time SECONDS] [--out FILE] "
+               "[--compare BASELINE.csv [--tolerance PERCENT]] IMAGE...\n"
+               "       Benchmark --superinstructions HEADER IMAGE...\n"
+               "       Benchmark --pipeline [--out FILE] IMAGE...\n");
+        return 1;
+    }
+    if(superFile){
+        return writeSuperinstructions(superFile, images, imageCount);
+    }
+    if(pipeline){
+        return comparePipelines(images, imageCount, outFile);
+    }
+
+    BaselineEntry baseline[MAX_WORKLOADS * 4];
+    int baselineCount = 0;
+    if(baselineFile){
+        baselineCount = readBaseline(baselineFile, baseline, MAX_WORKLOADS * 4);
+        if(baselineCount < 0){
+            return 1;
+        }
+    }
+    FILE *out = NULL;
+    if(outFile){
+        out = fopen(outFile, "w");
+        if(!out){
+            perror("Error opening output");
+            return 1;
+        }
+        fprintf(out, "%s\n", CSV_HEADER);
+    }
+
+    GibCPU *cpu = gibcpuCreate();
+    double *times = calloc(reps, sizeof(double));
+    if(!cpu || !times){
+        printf("Out of memory\n");
+        return 1;
+    }
+    printf("%s\n", CSV_HEADER);
+    int regressions = 0;
+
+    for(int w = 0; w < imageCount; w++){
+        if(!gibcpuLoadImageFile(cpu, images[w], NULL)){
+            continue;
+        }
+        GibCPUSnapshot loaded;
+        gibcpuSnapshot(cpu, &loaded);
+        char name[128];
+        workloadName(images[w], name, sizeof(name));
+        uint64_t instructions = countInstructions(cpu, &loaded);
+
+        for(int e = GIBCPU_ENGINE_CYCLE; e <= COLLAPSED_ROW; e++){
+            if(!gibcpuSetEngine(cpu, e == COLLAPSED_ROW ? GIBCPU_ENGINE_CYCLE : e)){
+                continue;
+            }
+            gibcpuSetMicrocode(cpu, e == COLLAPSED_ROW ? GIBCPU_MICROCODE_COLLAPSED : GIBCPU_MICROCODE_HANDSHAKE);
+            // after warmup, double the run count until one repetition lasts minTime
+            long runs = 1;
+            for(int i = 0; i < warmup; i++){
+                timeRuns(cpu, &loaded, runs);
+            }
+            while(timeRuns(cpu, &loaded, runs) < minTime){
+                runs *= 2;
+            }
+            for(int r = 0; r < reps; r++){
+                times[r] = timeRuns(cpu, &loaded, runs);
+            }
+            uint64_t cycles = gibcpuCycles(cpu);
+            qsort(times, reps, sizeof(double), compareDoubles);
+            double median = reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+            double cyclesPerSecond = (double)cycles * runs / median;
+            double instructionsPerSecond = (double)instructions * runs / median;
+
+            char line[512];
+            snprintf(line, sizeof(line), "%s,%s,%ld,%d,%llu,%llu,%.6f,%.6f,%.0f,%.0f,%.3f", name, engineNames[e],
+                     runs, reps, (unsigned long long)cycles, (unsigned long long)instructions, median, times[0],
+                     cyclesPerSecond, instructionsPerSecond, instructions ? 1e9 / instructionsPerSecond : 0.0);
+            printf("%s\n", line);
+            if(out){
+                fprintf(out, "%s\n", line);
+            }
+
+            for(int b = 0; b < baselineCount; b++){
+                if(!strcmp(baseline[b].workload, name) && !strcmp(baseline[b].engine, engineNames[e])){
+                    double change = 100.0 * (instructionsPerSecond / baseline[b].instructionsPerSecond - 1.0);
+                    if(change < -tolerance){
+                        fprintf(stderr, "REGRESSION %s on %s: %.1f%% instructions/s against the baseline\n",
+                                name, engineNames[e], change);
+                        regressions++;
+                    }
+                }
+            }
+        }
+    }
+
+    if(out){
+        fclose(out);
+    }
+    free(times);
+    gibcpuDestroy(cpu);
+    return regressions ? 1 : 0;
+}
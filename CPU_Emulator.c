@@ -3,477 +3,692 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-#define MAX_VALUES 256
-#define BINARY_STRING_LENGTH 8
-
-#define AND     0
-#define OR      16
-#define XOR     32
-#define ADD     48
-#define SUB     64
-#define NOTB    80
-#define SHIFTB  96
-#define LSHIFTB 112
-#define LOAD    128
-#define WRT     144
-#define JMPZ    160
-#define JMP     176
-#define LOADL   192
-#define WRTL    208
-#define HALT    240
-
-int loopCounter = 0;
-int posEdgeCounter = 0;
-
-uint8_t currentStateFirst = 161;    // binary address of #currentStateFirst
+#include "GIBCPU.h"
+
+uint16_t currentStateFirst = 161;   // binary address of #currentStateFirst
 uint8_t nextStateFirst = 203;       // binary address of #nextStateFirst
 uint8_t progCounterPrintAddr = 6;   // once progCounter hits this, the currentState grid will be printed
-
-uint8_t ram[MAX_VALUES] = {0};
-
-uint8_t reg0 = 0;
-uint8_t reg1 = 0;
-uint8_t reg2 = 0;
-uint8_t reg3 = 0;
-
-uint8_t regA = 0;
-uint8_t regB = 0;
-
-uint8_t ALUout = 0;
-
-uint8_t count = 0;
-uint8_t programHalt = 0;
-
-uint8_t ramDataOut = 0;
-
-uint8_t command = 0;
-uint8_t memCtrlRAM = 0;
-uint8_t setRAM = 0;
-uint8_t RAMSet = 0;
-uint8_t memCtrlCount = 0;
-uint8_t setCount = 0;
-uint8_t countSet = 0;
-uint8_t incrementCount = 0;
-uint8_t countIncremented = 0;
-uint8_t memCtrlReg = 0;
-uint8_t setReg = 0;
-uint8_t regSet = 0;
-uint8_t state = 0;
-uint8_t Mdata = 0;
-uint8_t bookmark = 0;
-
-/* FILE IO FUNCTIONS */
-
-//  Function to print the "CurrentState" grid to the terminal
-void printGrid(uint8_t startIndex) {
-    // Ensure the start index and the next 36 addresses are within the array bounds
-    if (startIndex + 35 >= MAX_VALUES) {
-        printf("Start index is out of bounds.\n");
-        return;
+uint8_t displayWidth = 6;           // currentState grid geometry
+uint8_t displayHeight = 6;
+
+#define DEFAULT_IMAGE_BUDGET 100000000ULL  // posEdges per image for --batch and --jobs and per --search reference run
+
+/* BATCH FRONT ENDS */
+
+// Runs each RAM image file in its own lane of the SIMD batch engine and prints one result line per image
+int runBatch(char *files[], int fileCount, uint64_t budget){
+    int n = fileCount ? fileCount : 1;
+    uint8_t (*images)[GIBCPU_MEMORY_SIZE] = calloc(n, GIBCPU_MEMORY_SIZE);
+    GibCPUImageInfo *infos = calloc(n, sizeof(GibCPUImageInfo));
+    uint64_t *cycles = calloc(n, sizeof(uint64_t));
+    uint64_t *loops = calloc(n, sizeof(uint64_t));
+    int *halted = calloc(n, sizeof(int));
+    int loaded = images && infos && cycles && loops && halted;
+    if(!loaded){
+        printf("Out of memory\n");
     }
-
-    printf("-----------------------------\n");
-    for (int i = 0; i < 36; i++) {
-        if (ram[startIndex + i] == 1) {
-            printf("\u2593");       // Dark shaded block
-        } else {
-            printf("\u2591");       // Light shaded block
+    for(int i = 0; loaded && i < fileCount; i++){
+        if(!gibcpuReadImageFile(files[i], images[i], GIBCPU_MEMORY_SIZE, &infos[i])){
+            printf("Could not load %s\n", files[i]);
+            loaded = 0;
         }
-        
-        if ((i + 1) % 6 == 0) {     // New line after every 6 characters
-            printf("\n");
+        else if(infos[i].flags & GIBCPU_IMAGE_HAS_BANKS){
+            printf("Could not run %s in a batch (images with banks are not supported)\n", files[i]);
+            loaded = 0;
         }
     }
+    int result = loaded ? gibcpuRunBatch(images, infos, fileCount, budget, cycles, loops, halted) : 1;
+    for(int i = 0; i < fileCount && !result; i++){
+        printf("%s: %s, iterated %llu times over %llu clock cycles\n", files[i], halted[i] ? "halted" : "stopped",
+               (unsigned long long)loops[i], (unsigned long long)cycles[i]);
+    }
+    free(images);
+    free(infos);
+    free(cycles);
+    free(loops);
+    free(halted);
+    return result;
 }
 
-// Function to convert a binary string to a uint8_t value
-uint8_t binaryStringToUint8(const char *binaryString) {
-    uint8_t value = 0;
-    for (int i = 0; i < BINARY_STRING_LENGTH; i++) {
-        value <<= 1;
-        if (binaryString[i] == '1') {
-            value |= 1;
+// Prints 256 bytes of RAM as 16 rows of hex
+void printRam(const uint8_t *ram){
+    for(int row = 0; row < 16; row++){
+        for(int col = 0; col < 16; col++){
+            printf("%02x%c", ram[row * 16 + col], col == 15 ? '\n' : ' ');
         }
     }
-    return value;
 }
 
-// Function to load up to 256 8-bit binary values from "RAM.txt" into an array
-size_t loadBinaryValues(const char *filename, uint8_t *array, size_t max_values) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
-        return 0;
+/* MULTI-CORE FRONT END */
+
+// Runs one image on every core of a multi-core system and prints each core's summary and the shared RAM
+int runCores(int argc, char *argv[], int cores){
+    GibCPUSystemConfig config = {cores, GIBCPU_DEFAULT_EPOCH, GIBCPU_DEFAULT_BUS_COST, 0, GIBCPU_ENGINE_FAST};
+    config.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *imageFile = access("RAM.gib", R_OK) == 0 ? "RAM.gib" : "RAM.txt";
+    uint64_t budget = GIBCPU_NO_BUDGET;
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--cores")){
+            i++;
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--image")){
+            imageFile = argv[++i];
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--epoch")){
+            config.epoch = strtoul(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--bus-cost")){
+            config.busCost = strtoul(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--threads")){
+            config.threads = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--budget")){
+            budget = strtoull(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "--engine=cycle")){
+            config.engine = GIBCPU_ENGINE_CYCLE;
+        }
+        else if(!strcmp(argv[i], "--engine=fast")){
+            config.engine = GIBCPU_ENGINE_FAST;
+        }
+        else if(!strcmp(argv[i], "--engine=threaded")){
+            config.engine = GIBCPU_ENGINE_THREADED;
+        }
+        else if(!strcmp(argv[i], "--engine=jit")){
+            config.engine = GIBCPU_ENGINE_JIT;
+        }
+        else{
+            printf("Unknown option %s (expected --image, --engine=cycle|fast|threaded|jit, --epoch, --bus-cost, --threads or --budget)\n", argv[i]);
+            return 1;
+        }
     }
 
-    char line[BINARY_STRING_LENGTH + 2]; // 8 bits + newline + null terminator
-    size_t count = 0;
-    while (count < max_values && fgets(line, sizeof(line), file)) {
-        // Remove newline character if present
-        line[strcspn(line, "\r\n")] = 0;
-
-        // Check if the line contains exactly 8 binary digits
-        if (strlen(line) == BINARY_STRING_LENGTH) {
-            array[count++] = binaryStringToUint8(line);
-        }
+    GibCPUSystem *system = gibcpuSystemCreate(&config);
+    if(!system){
+        printf("Could not start %d cores (1 to %d)\n", cores, GIBCPU_MAX_CORES);
+        return 1;
+    }
+    if(!gibcpuSystemLoadImageFile(system, imageFile, NULL)){
+        printf("Could not load %s on the cores (images with banks are not supported)\n", imageFile);
+        gibcpuSystemDestroy(system);
+        return 1;
     }
 
-    fclose(file);
-    return count; // Return the number of values loaded into the array
-}
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int halted = gibcpuSystemRun(system, budget);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-/* CPU MODULE FUNCTIONS */
-
-// "Arithmetic Logic Unit", Module that performs Arithmetic Operations on RegA and RegB
-void ALU(){
-    switch((command & 0b11110000)){
-        case AND:
-            ALUout = regB & regA;
-            break;
-        case OR:
-            ALUout = regB | regA;
-            break;
-        case XOR:
-            ALUout = regB ^ regA;
-            break;
-        case ADD:
-            ALUout = regB + regA;
-            break;
-        case SUB:
-            ALUout = regB - regA;
-            break;
-        case NOTB:
-            ALUout = ~regB;
-            break;
-        case SHIFTB:
-            ALUout = regB >> 1;
-            break;
-        case LSHIFTB:
-            ALUout = regB << 1;
-            break;
-        default:
-            ALUout = 0;
-            break;
+    for(int k = 0; k < cores; k++){
+        GibCPU *core = gibcpuSystemCore(system, k);
+        printf("Core %d: %s, iterated %llu times over %llu clock cycles, %llu waiting for the bus\n", k,
+               gibcpuHalted(core) ? "halted" : "stopped", (unsigned long long)gibcpuLoops(core),
+               (unsigned long long)gibcpuCycles(core), (unsigned long long)gibcpuSystemBusWait(system, k));
     }
+    uint8_t shared[GIBCPU_MEMORY_SIZE];
+    for(int addr = 0; addr < GIBCPU_MEMORY_SIZE; addr++){
+        shared[addr] = gibcpuSystemRead(system, addr);
+    }
+    printf("\nShared RAM:\n");
+    printRam(shared);
+    printf("\n%s after %llu clock cycles in %f seconds.\n", halted ? "ALL CORES HALTED" : "SYSTEM STOPPED",
+           (unsigned long long)gibcpuSystemCycles(system),
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    gibcpuSystemDestroy(system);
+    return 0;
 }
 
-// reg = destination reg (0 = A, 1 = B), num = source reg (reg0,reg1,reg2,reg3)
-void twoRegPathCase(uint8_t reg, uint8_t num){     
-    switch(reg){
-        case 0:
-            switch(num){
-                case 0:
-                    regA = reg0;
-                    break;
-                case 1:
-                    regA = reg1;
-                    break;
-                case 2:
-                    regA = reg2;
-                    break;
-                case 3:
-                    regA = reg3;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 1:
-            switch(num){
-                case 0:
-                    regB = reg0;
-                    break;
-                case 1:
-                    regB = reg1;
-                    break;
-                case 2:
-                    regB = reg2;
-                    break;
-                case 3:
-                    regB = reg3;
-                    break;
-                default:
-                    break;
-            }
-        default:
-            break;
+/* TRACE REPLAY FRONT END */
+
+// Rebuilds the machine from a trace recorded with "--trace" and prints it, optionally saving it as a snapshot
+int runReplay(int argc, char *argv[], const char *traceFile){
+    uint64_t cycle = GIBCPU_NO_BUDGET;
+    const char *saveFile = NULL;
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--replay")){
+            i++;
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--at")){
+            cycle = strtoull(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--save-snapshot")){
+            saveFile = argv[++i];
+        }
+        else{
+            printf("Unknown option %s (expected --at or --save-snapshot)\n", argv[i]);
+            return 1;
+        }
     }
-}
 
-// Module that loads RegA and RegB with correct registers based on the Command
-void regPathSet(){
-    uint8_t instruction = ((command & 0b11110000) >> 4);
-    if(instruction < 5 || instruction == 12 || instruction == 13){  //if two-variable op
-        twoRegPathCase(0, (command & 0b1100) >> 2);                 //set reg a
-        twoRegPathCase(1, (command & 0b11));                        //set reg b
+    GibCPU *cpu = gibcpuCreate();
+    if(!cpu){
+        printf("Out of memory\n");
+        return 1;
+    }
+    if(gibcpuReplayTrace(cpu, traceFile, cycle)){
+        gibcpuDestroy(cpu);
+        return 1;
     }
-    else if(instruction >= 5 && instruction < 11){                  //if one-variable op
-        twoRegPathCase(1, (command & 0b11));                        //set reg b
+    printf("Clock cycle %llu, %s, iterated %llu times\n", (unsigned long long)gibcpuCycles(cpu),
+           gibcpuHalted(cpu) ? "halted" : "running", (unsigned long long)gibcpuLoops(cpu));
+    printf("progCounter %u, registers %u %u %u %u\n", gibcpuProgramCounter(cpu), gibcpuRegister(cpu, 0),
+           gibcpuRegister(cpu, 1), gibcpuRegister(cpu, 2), gibcpuRegister(cpu, 3));
+    uint8_t ram[GIBCPU_MEMORY_SIZE];
+    gibcpuReadMemory(cpu, 0, ram, sizeof(ram));
+    printf("\nRAM:\n");
+    printRam(ram);
+    if(saveFile && !gibcpuSaveSnapshot(cpu, saveFile)){
+        printf("\nSnapshot written to %s\n", saveFile);
     }
+    gibcpuDestroy(cpu);
+    return 0;
 }
 
-// Module that loads the registers with a given module source based on the Command
-void regBank(){
-    if(setReg && !regSet){
-        if((command & 0b10000000) >> 7){        // if not an ALU op, pull from memCtrlReg
-            switch (command & 0b11){
-                case 0:
-                    reg0 = memCtrlReg;          // reg0 is now writable
-                    break;
-                case 1:
-                    reg1 = memCtrlReg;
-                    break;
-                case 2:
-                    reg2 = memCtrlReg;
-                    break;
-                case 3:
-                    reg3 = memCtrlReg;
-                    break;
-                default:
-                    break;
-            }
+/* PROGRAM SEARCH FRONT END */
+
+// Prints each new best program of a search as it is found
+void printSearchBest(const GibCPUSearchResult *best, void *user){
+    printf("%9.2fs %12llu candidates: %u wrong bits, %u bytes, %llu clock cycles\n", best->seconds,
+           (unsigned long long)best->evaluated, best->wrongBits, best->size, (unsigned long long)best->cycles);
+    fflush(stdout);
+}
+
+// Reads "START:LENGTH" into a RAM range, returns 0 if it does not fit in RAM
+int parseRange(const char *text, unsigned *start, unsigned *length){
+    return sscanf(text, "%u:%u", start, length) == 2 && *length > 0 && *start + *length <= GIBCPU_MEMORY_SIZE;
+}
+
+// Searches for a program that does what the reference image does: the reference runs on random inputs to get
+// the expected outputs, then candidates for its code range are scored against them
+int runSearch(int argc, char *argv[], const char *referenceFile){
+    static GibCPUSearchConfig config;
+    static GibCPUSearchCase cases[GIBCPU_SEARCH_MAX_CASES];
+    GibCPUImageInfo info;
+    if(!gibcpuReadImageFile(referenceFile, config.image, GIBCPU_MEMORY_SIZE, &info)){
+        printf("Could not read %s\n", referenceFile);
+        return 1;
+    }
+    unsigned codeStart = info.entry, codeLength = GIBCPU_MEMORY_SIZE - info.entry;
+    unsigned inputStart = 0, inputLength = 0, outputStart = 0, outputLength = 0;
+    int caseCount = 16, blank = 0;
+    const char *outFile = "search.gib";
+    config.mode = GIBCPU_SEARCH_MUTATE;
+    config.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    config.seed = 1;
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--search")){
+            i++;
         }
-        else{                                   // if ALU op, pull from ALU
-            switch (command & 0b11){
-                case 0:
-                    reg0 = ALUout;              // reg0 is now writable
-                    break;
-                case 1:
-                    reg1 = ALUout;
-                    break;
-                case 2:
-                    reg2 = ALUout;
-                    break;
-                case 3:
-                    reg3 = ALUout;
-                    break;
-                default:
-                    break;
-            }
+        else if(i + 1 < argc && !strcmp(argv[i], "--code") && parseRange(argv[i + 1], &codeStart, &codeLength)){
+            i++;
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--input") && parseRange(argv[i + 1], &inputStart, &inputLength)){
+            i++;
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--output") && parseRange(argv[i + 1], &outputStart, &outputLength)){
+            i++;
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--cases")){
+            caseCount = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--cycles")){
+            config.cycleCap = strtoull(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--candidates")){
+            config.candidates = strtoull(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--seconds")){
+            config.seconds = atof(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--threads")){
+            config.threads = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--seed")){
+            config.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--out")){
+            outFile = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--enumerate")){
+            config.mode = GIBCPU_SEARCH_ENUMERATE;
+        }
+        else if(!strcmp(argv[i], "--blank")){
+            blank = 1;
+        }
+        else if(!strcmp(argv[i], "--first")){
+            config.stopAtSolution = 1;
+        }
+        else{
+            printf("Unknown option %s (expected --code, --input or --output START:LENGTH, --cases, --cycles, --candidates, --seconds, --threads, --seed, --out, --enumerate, --blank or --first)\n", argv[i]);
+            return 1;
         }
-        regSet = 1;
     }
-    if(!setReg && regSet){
-        regSet = 0;
+    if(!outputLength){
+        printf("Nothing to score, give the result bytes with --output START:LENGTH\n");
+        return 1;
+    }
+    if(caseCount < 1 || caseCount > GIBCPU_SEARCH_MAX_CASES){
+        printf("--cases takes 1 to %d\n", GIBCPU_SEARCH_MAX_CASES);
+        return 1;
+    }
+    if(config.mode == GIBCPU_SEARCH_MUTATE && !config.candidates && config.seconds <= 0){
+        config.seconds = 10;
     }
-}
 
-// Module that reads/writes specific memory locations in the RAM
-void ramModule(){
-    if(setRAM && !RAMSet){
-        ram[count] = memCtrlRAM;
-        RAMSet = 1;
+    // case 0 keeps the reference's own inputs, the rest are random
+    GibCPU *cpu = gibcpuCreate();
+    if(!cpu){
+        printf("Out of memory\n");
+        return 1;
     }
-    if(!setRAM && RAMSet){
-        RAMSet = 0;
+    gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+    srand(config.seed);
+    uint64_t referenceCycles = 0;
+    for(int c = 0; c < caseCount; c++){
+        GibCPUSearchCase *searchCase = &cases[c];
+        for(unsigned addr = inputStart; addr < inputStart + inputLength; addr++){
+            searchCase->input[addr] = c ? rand() & 0xFF : config.image[addr];
+            searchCase->inputMask[addr] = 0xFF;
+        }
+        if(!gibcpuLoadImageFile(cpu, referenceFile, NULL)){
+            printf("Could not load %s\n", referenceFile);
+            gibcpuDestroy(cpu);
+            return 1;
+        }
+        gibcpuWriteMemory(cpu, inputStart, searchCase->input + inputStart, inputLength);
+        gibcpuReset(cpu);
+        gibcpuRun(cpu, DEFAULT_IMAGE_BUDGET);
+        if(!gibcpuHalted(cpu)){
+            printf("The reference does not halt within %llu clock cycles on case %d\n",
+                   (unsigned long long)DEFAULT_IMAGE_BUDGET, c);
+            gibcpuDestroy(cpu);
+            return 1;
+        }
+        gibcpuReadMemory(cpu, 0, searchCase->expected, GIBCPU_MEMORY_SIZE);
+        memset(searchCase->expectedMask + outputStart, 0xFF, outputLength);
+        if(gibcpuCycles(cpu) > referenceCycles){
+            referenceCycles = gibcpuCycles(cpu);
+        }
     }
-    ramDataOut = ram[count];
-}
+    gibcpuDestroy(cpu);
 
-// Module that increments or sets the Program Counter
-void progCounter(){
-    if(setCount && !countSet){
-        count = memCtrlCount;
-        countSet = 1;
+    if(blank){
+        memset(config.image + codeStart, 0, codeLength);
     }
-    if(!setCount && countSet){
-        countSet = 0;
+    config.entry = info.entry;
+    config.codeStart = codeStart;
+    config.codeLength = codeLength;
+    config.cases = cases;
+    config.caseCount = caseCount;
+    if(!config.cycleCap){
+        config.cycleCap = referenceCycles * 4 + 1000;
     }
-    if(incrementCount && !countIncremented){
-        count++;
-        countIncremented = 1;
-        // DEBUG
-        if(count == progCounterPrintAddr){
-            printGrid(currentStateFirst);
-            loopCounter++;
-        }
+    config.improved = printSearchBest;
+
+    printf("Searching %u bytes from %u over %d cases, %llu clock cycles each at most\n", codeLength, codeStart,
+           caseCount, (unsigned long long)config.cycleCap);
+    GibCPUSearchResult best;
+    if(gibcpuSearch(&config, &best)){
+        printf("Could not start the search\n");
+        return 1;
     }
-    if(!incrementCount && countIncremented){
-        countIncremented = 0;
+    printf("\nBest: %u wrong bits, %u bytes, %llu clock cycles over all cases\n", best.wrongBits, best.size,
+           (unsigned long long)best.cycles);
+    printf("Evaluated %llu candidates (%llu cases run, %llu timed out) in %f seconds on %d threads, %.0f candidates/s.\n",
+           (unsigned long long)best.evaluated, (unsigned long long)best.casesRun, (unsigned long long)best.timeouts,
+           best.seconds, config.threads, best.seconds > 0 ? best.evaluated / best.seconds : 0.0);
+    info.flags &= ~GIBCPU_IMAGE_HAS_BANKS;
+    if(!gibcpuWriteImageFile(outFile, best.image, GIBCPU_MEMORY_SIZE, &info)){
+        printf("Written to %s\n", outFile);
     }
+    return 0;
 }
 
-// Module that controls all other modules.
-void memCtrl(){
-    switch(state){
-        case 0:                     // get next ram data
-            command = ramDataOut;
-            if(command & 0b10000000){
-                state = 2;
-            }
-            else{
-                state = 1;
+// Prints and frees the profile collected with "--profile"
+void printProfile(GibCPUProfile *profile, const char *mapFile){
+    if(profile){
+        gibcpuPrintProfile(profile, access(mapFile, R_OK) == 0 ? mapFile : NULL, stdout);
+        free(profile);
+    }
+}
+
+int main(int argc, char *argv[]){
+
+    // "--batch [--budget CYCLES] FILE..." runs many RAM images side by side on the SIMD batch engine, each stopping
+    // at HALT or after its budget
+    if(argc > 1 && !strcmp(argv[1], "--batch")){
+        uint64_t budget = DEFAULT_IMAGE_BUDGET;
+        int first = 2;
+        if(argc > 3 && !strcmp(argv[2], "--budget")){
+            budget = strtoull(argv[3], NULL, 10);
+            first = 4;
+        }
+        for(int i = first; i < argc; i++){
+            if(!strncmp(argv[i], "--", 2)){
+                printf("Unknown option %s (expected --budget before the image files)\n", argv[i]);
+                return 1;
             }
-            break;
-        case 1:                     // ALU op
-            setReg = 1;
-            state = 19;
-            break;
-        case 2:
-            bookmark = count;
-            if(((command & 0b11110000) == LOADL) || ((command & 0b11110000) == WRTL)){   //if LOADL or WRTL
-                state = 3;
+        }
+        clock_t t = clock();
+        int result = runBatch(argv + first, argc - first, budget);
+        printf("\nBatch of %d images finished in %f seconds.\n", argc - first, ((double)(clock() - t))/CLOCKS_PER_SEC);
+        return result;
+    }
+
+    // "--jobs DIR|MANIFEST [--threads N] [--budget CYCLES] [--out FILE]" spreads many RAM images over all cores
+    if(argc > 2 && !strcmp(argv[1], "--jobs")){
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        uint64_t budget = DEFAULT_IMAGE_BUDGET;
+        const char *outFile = "results.txt";
+        for(int i = 3; i < argc; i += 2){
+            if(i + 1 < argc && !strcmp(argv[i], "--threads")){
+                threads = atoi(argv[i + 1]);
             }
-            else{
-                state = 4;
+            else if(i + 1 < argc && !strcmp(argv[i], "--budget")){
+                budget = strtoull(argv[i + 1], NULL, 10);
             }
-            break;
-        case 3:
-            memCtrlCount = regA;
-            state = 6;
-            break;
-        case 4:
-            incrementCount = 1;
-            state = 5;
-            break;
-        case 5:
-            if(countIncremented){
-                incrementCount = 0;
-                memCtrlCount = ramDataOut;
-                state = 6;
+            else if(i + 1 < argc && !strcmp(argv[i], "--out")){
+                outFile = argv[i + 1];
             }
-            break;
-        case 6:
-            setCount = 1;
-            state = 7;
-            break;
-        case 7:
-            if(countSet){
-                setCount = 0;
-                Mdata = ramDataOut;
-                switch(command & 0b11110000){
-                    case LOAD:
-                    case LOADL:
-                        state = 8;
-                        break;
-                    case WRT:
-                    case WRTL:
-                        state = 9;
-                        break;
-                    case JMPZ:
-                        if(regB == 0){
-                            state = 15;
-                        }
-                        else{
-                            state = 11;
-                        }
-                        break;
-                    case JMP:
-                        state = 15;
-                        break;
-                    case HALT:
-                        state = 18;
-                        break;
-                    default:
-                        break;
-                }
+            else{
+                printf("Unknown option %s (expected --threads N, --budget CYCLES or --out FILE)\n", argv[i]);
+                return 1;
             }
-            break;
-        case 8:                     // LOAD or LOADL
-            memCtrlReg = Mdata;
-            setReg = 1;
-            state = 20;
-            break;
-        case 9:                     // WRT or WRTL
-            memCtrlRAM = regB;
-            setRAM = 1;
-            state = 10;
-            break;
-        case 10:
-            if(RAMSet){
-                setRAM = 0;
-                state = 11;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = gibcpuRunJobs(argv[2], outFile, threads, budget);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("Finished in %f seconds on %d threads.\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, threads);
+        return result;
+    }
+
+    // "--cores N [--image FILE] [--engine=E] [--epoch CYCLES] [--bus-cost CYCLES] [--threads N] [--budget CYCLES]"
+    // runs the image on N cores sharing RAM over one bus
+    for(int i = 1; i + 1 < argc; i++){
+        if(!strcmp(argv[i], "--cores")){
+            return runCores(argc, argv, atoi(argv[i + 1]));
+        }
+    }
+
+    // "--replay FILE [--at CYCLE] [--save-snapshot FILE]" prints the machine as a trace recorded it at CYCLE,
+    // the end by default
+    for(int i = 1; i + 1 < argc; i++){
+        if(!strcmp(argv[i], "--replay")){
+            return runReplay(argc, argv, argv[i + 1]);
+        }
+    }
+
+    // "--search REFERENCE --output START:LENGTH [--code START:LENGTH] [--input START:LENGTH] [--cases N]
+    // [--cycles CAP] [--candidates N] [--seconds S] [--threads N] [--seed S] [--enumerate] [--blank] [--first]
+    // [--out FILE]" looks for another program for the reference's code range with the same outputs
+    for(int i = 1; i + 1 < argc; i++){
+        if(!strcmp(argv[i], "--search")){
+            return runSearch(argc, argv, argv[i + 1]);
+        }
+    }
+
+    GibCPU *cpu = gibcpuCreate();
+    if(!cpu){
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // load RAM with the binary image, or the legacy RAM.txt when there is none. "--image FILE" loads another one.
+    const char *imageFile = access("RAM.gib", R_OK) == 0 ? "RAM.gib" : "RAM.txt";
+    for(int i = 1; i + 1 < argc; i++){
+        if(!strcmp(argv[i], "--image")){
+            imageFile = argv[i + 1];
+        }
+    }
+    GibCPUImageInfo info;
+    if(!gibcpuLoadImageFile(cpu, imageFile, &info)){
+        gibcpuDestroy(cpu);
+        return 1;
+    }
+    if(info.flags & GIBCPU_IMAGE_HAS_PRINT_ADDR){
+        progCounterPrintAddr = info.printAddr;
+    }
+    if(info.flags & GIBCPU_IMAGE_HAS_DISPLAY){
+        currentStateFirst = info.displayStart;
+        displayWidth = info.displayWidth ? info.displayWidth : displayWidth;
+        displayHeight = info.displayHeight ? info.displayHeight : displayHeight;
+    }
+    gibcpuSetDisplay(cpu, progCounterPrintAddr, NULL, NULL);
+
+    // the grid is drawn on a renderer thread: "--headless" turns it off, "--fps N" limits the frame rate,
+    // "--display ADDR" and "--grid WIDTHxHEIGHT" pick the region, ADDR past 255 being in the banks. On a
+    // terminal only changed cells are redrawn.
+    int headless = 0;
+    int fps = 0;
+
+    // "--profile" runs the cycle-level model with the profiler attached and prints a report at the end,
+    // naming source lines from the Assembler's symbol map (the image name ending in ".map", or "--map FILE")
+    GibCPUProfile *profile = NULL;
+    char imageMap[256];
+    snprintf(imageMap, sizeof(imageMap), "%s", imageFile);
+    char *dot = strrchr(imageMap, '.');
+    if(dot && !strchr(dot, '/')){
+        *dot = '\0';
+    }
+    strncat(imageMap, ".map", sizeof(imageMap) - strlen(imageMap) - 1);
+    const char *mapFile = imageMap;
+
+    // "--engine=fast" runs whole instructions per dispatch, "--engine=threaded" also predecodes ram[],
+    // "--engine=jit" translates basic blocks to x86-64, the default steps the modules each posEdge.
+    // "--load-snapshot FILE" resumes a saved machine, "--budget CYCLES" stops early and
+    // "--save-snapshot FILE" writes the machine out at the end. "--memo" fast-forwards once the program loops.
+    // "--trace FILE" records every instruction for "--replay", "--compress-trace" packs the file.
+    // "--pipeline" also times the run on the pipelined core model and prints CPI and stalls next to memCtrl(),
+    // fetching "--fetch-bytes N" bytes per posEdge, with "--no-forwarding" for a core without forwarding.
+    // "--microcode=collapsed" runs memCtrl() without the request/acknowledge posEdges, on the cycle-level model.
+    // "--pace HZ" runs at HZ posEdges per second of wall clock in "--pace-period US" batches, "--no-spin" only
+    // sleeping between them, and reports the rate achieved and the lateness percentiles.
+    uint64_t budget = GIBCPU_NO_BUDGET;
+    const char *saveFile = NULL;
+    const char *traceFile = NULL;
+    int compressTrace = 0;
+    int pipeline = 0;
+    const char *pipelineOption = NULL;     // the last pipeline option given, which --pace rules out
+    GibCPUPipelineConfig pipelineConfig = {1, 1};
+    GibCPUPipelineStats pipelineStats;
+    GibCPUPaceConfig paceConfig = {0, 0, 1};
+    GibCPUPaceStats paceStats;
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--load-snapshot")){
+            if(gibcpuLoadSnapshot(cpu, argv[++i])){
+                gibcpuDestroy(cpu);
+                return 1;
             }
-            break;
-        case 11:                    // return to bookmark
-            memCtrlCount = bookmark;
-            setCount = 1;
-            state = 12;
-            break;
-        case 12:
-            if(countSet){
-                setCount = 0;
-                incrementCount = 1;
-                if(!((command & 0b11110000) == LOADL) && !((command & 0b11110000) == WRTL)){    // if a command that has a second byte
-                    state = 13;     // increment the program counter again
-                }
-                else{
-                    state = 17;
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--image")){
+            i++;
+            continue;
+        }
+        if(!strcmp(argv[i], "--headless")){
+            headless = 1;
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--fps")){
+            fps = atoi(argv[++i]);
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--display")){
+            currentStateFirst = atoi(argv[++i]);
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--grid")){
+            unsigned width = 0, height = 0;
+            sscanf(argv[++i], "%ux%u", &width, &height);
+            displayWidth = width;
+            displayHeight = height;
+            continue;
+        }
+        if(!strcmp(argv[i], "--profile")){
+            if(!profile){
+                profile = calloc(1, sizeof(GibCPUProfile));
+                if(!profile){
+                    printf("Out of memory\n");
+                    gibcpuDestroy(cpu);
+                    return 1;
                 }
+                gibcpuSetProfile(cpu, profile);
             }
-            break;
-        case 13:
-            if(countIncremented){
-                incrementCount = 0;
-                state = 14;
-            }
-            break;
-        case 14:
-            incrementCount = 1;
-            state = 17;
-            break;
-        case 15:                     // JMP or Passing JMPZ
-            memCtrlCount = Mdata;
-            setCount = 1;
-            state = 16;
-            break;
-        case 16:
-            if(countSet){
-                setCount = 0;
-                state = 0;
-            }
-            break;
-        case 17:
-            if(countIncremented){
-                incrementCount = 0;
-                state = 0;
-            }
-            break;
-        case 18:
-            programHalt = 1;
-            break;
-        case 19:
-            if(regSet){
-                setReg = 0;
-                incrementCount = 1;
-                state = 17;
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--map")){
+            mapFile = argv[++i];
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--save-snapshot")){
+            saveFile = argv[++i];
+            continue;
+        }
+        if(!strcmp(argv[i], "--memo")){
+            if(gibcpuEnableMemo(cpu, progCounterPrintAddr, 4096)){
+                printf("Out of memory\n");
+                gibcpuDestroy(cpu);
+                return 1;
             }
-            break;
-        case 20:
-            if(regSet){
-                setReg = 0;
-                state = 11;
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--budget")){
+            budget = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--trace")){
+            traceFile = argv[++i];
+            continue;
+        }
+        if(!strcmp(argv[i], "--compress-trace")){
+            compressTrace = 1;
+            continue;
+        }
+        if(!strcmp(argv[i], "--pipeline")){
+            pipeline = 1;
+            pipelineOption = argv[i];
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--fetch-bytes")){
+            pipelineOption = argv[i];
+            pipelineConfig.fetchBytes = atoi(argv[++i]);
+            continue;
+        }
+        if(!strcmp(argv[i], "--no-forwarding")){
+            pipelineOption = argv[i];
+            pipelineConfig.forwarding = 0;
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--pace")){
+            paceConfig.hz = atof(argv[++i]);
+            continue;
+        }
+        if(i + 1 < argc && !strcmp(argv[i], "--pace-period")){
+            paceConfig.period = atof(argv[++i]) / 1e6;
+            continue;
+        }
+        if(!strcmp(argv[i], "--no-spin")){
+            paceConfig.spin = 0;
+            continue;
+        }
+
+        if(!strcmp(argv[i], "--engine=cycle")){
+            gibcpuSetEngine(cpu, GIBCPU_ENGINE_CYCLE);
+        }
+        else if(!strcmp(argv[i], "--engine=fast")){
+            gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+        }
+        else if(!strcmp(argv[i], "--engine=threaded")){
+            gibcpuSetEngine(cpu, GIBCPU_ENGINE_THREADED);
+        }
+        else if(!strcmp(argv[i], "--engine=jit")){
+            if(!gibcpuSetEngine(cpu, GIBCPU_ENGINE_JIT)){
+                printf("JIT unavailable on this host, running the cycle-level model\n");
             }
-            break;
-        default:
-            break;
+        }
+        else if(!strcmp(argv[i], "--microcode=handshake")){
+            gibcpuSetMicrocode(cpu, GIBCPU_MICROCODE_HANDSHAKE);
+        }
+        else if(!strcmp(argv[i], "--microcode=collapsed")){
+            gibcpuSetMicrocode(cpu, GIBCPU_MICROCODE_COLLAPSED);
+        }
+        else{
+            printf("Unknown option %s (expected --engine=cycle|fast|threaded|jit, --microcode=handshake|collapsed, --image, --headless, --fps, --display, --grid, --profile, --map, --budget, --memo, --trace, --compress-trace, --pipeline, --fetch-bytes, --no-forwarding, --pace, --pace-period, --no-spin, --load-snapshot or --save-snapshot)\n", argv[i]);
+            free(profile);
+            gibcpuDestroy(cpu);
+            return 1;
+        }
     }
-}
 
-int main(){
+    // a paced run goes through the selected engine, never the pipelined core model
+    if(paceConfig.hz > 0 && pipelineOption){
+        printf("%s cannot be combined with --pace\n", pipelineOption);
+        free(profile);
+        gibcpuDestroy(cpu);
+        return 1;
+    }
 
-    // load RAM with the binary file
-    size_t loadedValues = loadBinaryValues("RAM.txt", ram, MAX_VALUES);
+    GibCPUDisplay *display = NULL;
+    if(!headless){
+        GibCPUDisplayConfig config = {currentStateFirst, displayWidth, displayHeight, fps, isatty(STDOUT_FILENO), stdout};
+        display = gibcpuDisplayCreate(&config);
+        if(!display){
+            printf("Display region %u, %ux%u does not fit in memory\n", currentStateFirst, displayWidth, displayHeight);
+            free(profile);
+            gibcpuDestroy(cpu);
+            return 1;
+        }
+        gibcpuSetDisplay(cpu, progCounterPrintAddr, gibcpuDisplayHook, display);
+    }
+
+    if(traceFile && gibcpuStartTrace(cpu, traceFile, compressTrace)){
+        gibcpuDisplayDestroy(display);
+        free(profile);
+        gibcpuDestroy(cpu);
+        return 1;
+    }
 
     clock_t t;
     t = clock();
 
-    while(!programHalt){
-        posEdgeCounter++;
-        regBank();          // ALUOut OR memCtrlReg -> reg0-3
-        regPathSet();       // reg0-3 -> regA-B
-        ALU();              // regA-B -> ALUOut
-        progCounter();      // count++ OR memCtrlCount -> count
-        ramModule();        // memCtrlRAM -> ram[count] AND ram[count] -> ramDataOut
-        memCtrl();          // CPU Control State Machine
+    int halted;
+    if(paceConfig.hz > 0){
+        halted = gibcpuRunPaced(cpu, budget, &paceConfig, &paceStats);
+    }
+    else{
+        halted = pipeline ? gibcpuRunPipelined(cpu, budget, &pipelineConfig, &pipelineStats) : gibcpuRun(cpu, budget);
     }
 
     t = clock() - t;
     double time_taken = ((double)t)/CLOCKS_PER_SEC;
 
-    printf("\nPROGRAM HALTED\n");
-    printf("\nProgram iterated %d times over %d clock cycles in %f seconds.\n",loopCounter,posEdgeCounter,time_taken);
+    if(traceFile && gibcpuStopTrace(cpu)){
+        printf("\nCould not write all of the trace to %s\n", traceFile);
+    }
+
+    gibcpuDisplayDestroy(display);      // draw any frames still queued before the summary
 
+    if(saveFile && !gibcpuSaveSnapshot(cpu, saveFile)){
+        printf("\nSnapshot written to %s at clock cycle %llu\n", saveFile, (unsigned long long)gibcpuCycles(cpu));
+    }
+    if(gibcpuMemoSkipped(cpu)){
+        printf("\nFast-forwarded %llu clock cycles\n", (unsigned long long)gibcpuMemoSkipped(cpu));
+    }
+    printf("\nPROGRAM %s\n", halted ? "HALTED" : "STOPPED");
+    printf("\nProgram iterated %llu times over %llu clock cycles in %f seconds.\n",
+           (unsigned long long)gibcpuLoops(cpu), (unsigned long long)gibcpuCycles(cpu), time_taken);
+    printProfile(profile, mapFile);
+    if(pipeline){
+        gibcpuPrintPipeline(&pipelineStats, stdout);
+    }
+    if(paceConfig.hz > 0){
+        gibcpuPrintPace(&paceStats, stdout);
+    }
+
+    gibcpuDestroy(cpu);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "GIBCPU.h"
+
+// Differential test of the engines: every image runs on the cycle-level model as the reference, then once per
+// check below, and each run has to end with the same RAM, registers, program counter, clock cycles and print
+// passes. The images are the ones named on the command line ("make test" passes the bench corpus) and random
+// RAM contents with a random print address. Random images that do not halt within RANDOM_BUDGET are skipped,
+// since engines stop on different posEdges when the budget runs out.
+//
+// "chunked" checks run in random slices of 1 to MAX_CHUNK posEdges, so every engine stops on budgets and picks
+// up again where it left off. Checks with several engines switch to the next one after every slice, so each
+// engine starts on the code caches and RAM another one left behind. The collapsed microcode takes fewer clock cycles by design, so its cycle count is
+// the one thing not compared.
+//
+// With "--native CC", the corpus and the first --native-random halting random images are also translated with
+// gibcpuWriteC(), built with CC and run. The translated program prints its RAM, clock cycles and print passes
+// but no registers, so those are all that is compared. Images with banks are not translated.
+//
+// The "rewind" check runs each image on the fast engine taking checkpoints, more than the ring keeps, rewinds to
+// a random cycle and then to an earlier one, and compares both with the cycle-level model stepped there from
+// the loaded state.
+//
+// The "batch" check runs the corpus and all random images through gibcpuRunBatch() at the end, which only reports
+// whether each lane halted, its clock cycles and print passes. Images that stop on the budget are compared with
+// the fast engine, which stops on the same instruction boundary. Images with banks are not batched.
+
+#define DEFAULT_RANDOM 5000
+#define DEFAULT_SEED 1
+#define RANDOM_BUDGET 200000            // posEdges, random images that halt mostly do so within a few hundred
+#define CORPUS_BUDGET 4000000000ULL     // posEdges, stops a corpus workload that never halts
+#define MAX_CHUNK 300
+#define MAX_REPORTS 5                   // mismatches printed per check, the rest are only counted
+#define DEFAULT_NATIVE_RANDOM 200       // random images built natively with --native, each one a compiler run
+#define REWIND_CHECKPOINTS 8            // checkpoints the rewind check keeps, of about twice as many taken
+
+typedef struct {
+    uint8_t ram[GIBCPU_MEMORY_SIZE];
+    uint8_t reg[4];
+    uint8_t pc;
+    int halted;
+    uint64_t cycles;
+    uint64_t loops;
+} Outcome;
+
+typedef struct {
+    const char *name;
+    GibCPUEngine engines[4];    // taken in turn, one per slice
+    int engineCount;
+    GibCPUMicrocode microcode;
+    int chunked;
+    int compared;
+    int mismatches;
+} Check;
+
+// Images waiting for the batch check, with what the reference or fast engine made of them
+typedef struct {
+    uint8_t (*images)[GIBCPU_MEMORY_SIZE];
+    GibCPUImageInfo *infos;
+    Outcome *want;
+    char (*names)[64];
+    int count;
+} BatchQueue;
+
+static Check checks[] = {
+    {"fast", {GIBCPU_ENGINE_FAST}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0},
+    {"threaded", {GIBCPU_ENGINE_THREADED}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0},
+    {"jit", {GIBCPU_ENGINE_JIT}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0},
+    {"cycle chunked", {GIBCPU_ENGINE_CYCLE}, 1, GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"fast chunked", {GIBCPU_ENGINE_FAST}, 1, GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"threaded chunked", {GIBCPU_ENGINE_THREADED}, 1, GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"jit chunked", {GIBCPU_ENGINE_JIT}, 1, GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"threaded/jit", {GIBCPU_ENGINE_THREADED, GIBCPU_ENGINE_JIT}, 2, GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"every engine", {GIBCPU_ENGINE_CYCLE, GIBCPU_ENGINE_FAST, GIBCPU_ENGINE_THREADED, GIBCPU_ENGINE_JIT}, 4,
+     GIBCPU_MICROCODE_HANDSHAKE, 1, 0, 0},
+    {"collapsed", {GIBCPU_ENGINE_CYCLE}, 1, GIBCPU_MICROCODE_COLLAPSED, 0, 0, 0},
+};
+#define CHECK_COUNT (int)(sizeof(checks) / sizeof(checks[0]))
+
+static Check nativeCheck = {"native", {GIBCPU_ENGINE_FAST}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0};
+static Check rewindCheck = {"rewind", {GIBCPU_ENGINE_FAST}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0};
+static Check batchCheck = {"batch", {GIBCPU_ENGINE_FAST}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0};
+static const char *nativeCompiler;      // --native
+static char nativeDir[] = "/tmp/gibcpu-differential-XXXXXX";
+
+static uint64_t nextRandom(uint64_t *state){      // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static void capture(const GibCPU *cpu, Outcome *out){
+    gibcpuReadMemory(cpu, 0, out->ram, GIBCPU_MEMORY_SIZE);
+    for(int i = 0; i < 4; i++){
+        out->reg[i] = gibcpuRegister(cpu, i);
+    }
+    out->pc = gibcpuProgramCounter(cpu);
+    out->halted = gibcpuHalted(cpu);
+    out->cycles = gibcpuCycles(cpu);
+    out->loops = gibcpuLoops(cpu);
+}
+
+// Runs from the loaded state the way check says, to HALT or budget. Returns 0 if an engine is unavailable.
+static int runCheck(GibCPU *cpu, const GibCPUSnapshot *loaded, const Check *check, uint64_t budget, uint64_t *rng,
+                    Outcome *out){
+    gibcpuRestore(cpu, loaded);
+    if(!gibcpuSetEngine(cpu, check->engines[0])){
+        return 0;
+    }
+    gibcpuSetMicrocode(cpu, check->microcode);
+    if(check->chunked){
+        for(int slice = 0; !gibcpuHalted(cpu) && gibcpuCycles(cpu) < budget; slice++){
+            if(!gibcpuSetEngine(cpu, check->engines[slice % check->engineCount])){
+                return 0;
+            }
+            uint64_t chunk = 1 + nextRandom(rng) % MAX_CHUNK;
+            gibcpuRun(cpu, chunk < budget - gibcpuCycles(cpu) ? chunk : budget - gibcpuCycles(cpu));
+        }
+    }
+    else{
+        gibcpuRun(cpu, budget);
+    }
+    capture(cpu, out);
+    return 1;
+}
+
+// Prints what differs between the reference and a check's outcome. Returns 1 if anything does.
+static int compare(const char *image, const Check *check, const Outcome *want, const Outcome *got){
+    int cycles = check->microcode == GIBCPU_MICROCODE_HANDSHAKE;
+    int registers = check != &nativeCheck && check != &batchCheck;
+    int ram = check != &batchCheck;
+    int differs = (ram && memcmp(want->ram, got->ram, GIBCPU_MEMORY_SIZE)) ||
+                  (registers && (memcmp(want->reg, got->reg, 4) || want->pc != got->pc)) || want->halted != got->halted || want->loops != got->loops ||
+                  (cycles && want->cycles != got->cycles);
+    if(!differs || check->mismatches >= MAX_REPORTS){
+        return differs;
+    }
+    printf("MISMATCH %s on %s:", image, check->name);
+    for(int i = 0; i < GIBCPU_MEMORY_SIZE && ram; i++){
+        if(want->ram[i] != got->ram[i]){
+            printf(" ram[%d] %02x not %02x,", i, got->ram[i], want->ram[i]);
+            break;
+        }
+    }
+    for(int i = 0; i < 4 && registers; i++){
+        if(want->reg[i] != got->reg[i]){
+            printf(" reg%d %02x not %02x,", i, got->reg[i], want->reg[i]);
+        }
+    }
+    printf(" pc %02x/%02x, %s/%s, %llu/%llu cycles, %llu/%llu loops\n", got->pc, want->pc,
+           got->halted ? "halted" : "stopped", want->halted ? "halted" : "stopped", (unsigned long long)got->cycles,
+           (unsigned long long)want->cycles, (unsigned long long)got->loops, (unsigned long long)want->loops);
+    return 1;
+}
+
+// Translates the program to C, builds it with the --native compiler and runs it to HALT or budget. Returns 0 if
+// it could not be translated, built or run, which counts as a mismatch.
+static int runNative(const GibCPUAssembly *assembly, uint64_t budget, Outcome *out){
+    char source[64], binary[64], command[512];
+    snprintf(source, sizeof(source), "%s/native.c", nativeDir);
+    snprintf(binary, sizeof(binary), "%s/native", nativeDir);
+    snprintf(command, sizeof(command), "%s -O0 -o %s %s", nativeCompiler, binary, source);
+    if(gibcpuWriteC(source, assembly) || system(command)){
+        return 0;
+    }
+    snprintf(command, sizeof(command), "%s --ram --budget %llu", binary, (unsigned long long)budget);
+    FILE *run = popen(command, "r");
+    if(!run){
+        return 0;
+    }
+    memset(out, 0, sizeof(Outcome));
+    char line[256];
+    int row = 0;
+    unsigned long long loops, cycles;
+    while(fgets(line, sizeof(line), run)){
+        if(!strncmp(line, "PROGRAM ", 8)){
+            out->halted = !strncmp(line + 8, "HALTED", 6);
+        }
+        else if(sscanf(line, "Program iterated %llu times over %llu clock cycles", &loops, &cycles) == 2){
+            out->loops = loops;
+            out->cycles = cycles;
+        }
+        else if(row < 16 && strlen(line) >= 48 && line[2] == ' '){
+            for(int i = 0; i < 16; i++){
+                out->ram[row * 16 + i] = (uint8_t)strtoul(line + 3 * i, NULL, 16);
+            }
+            row++;
+        }
+    }
+    int status = pclose(run);
+    unlink(source);
+    unlink(binary);
+    return status == 0 && row == 16;
+}
+
+static void freeBatch(BatchQueue *queue){
+    free(queue->images);
+    free(queue->infos);
+    free(queue->want);
+    free(queue->names);
+}
+
+// Rewinds a run of about end posEdges to two random cycles, the second no later than the first, and compares
+// each with gibcpuStep() from the loaded state
+static void testRewind(GibCPU *cpu, const char *image, const GibCPUSnapshot *loaded, uint64_t budget, uint64_t end,
+                       uint64_t *rng){
+    Outcome want[2], got[2];
+    uint64_t targets[2];
+    gibcpuRestore(cpu, loaded);
+    gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+    gibcpuSetMicrocode(cpu, GIBCPU_MICROCODE_HANDSHAKE);
+    if(gibcpuEnableCheckpoints(cpu, end / REWIND_CHECKPOINTS / 2 + 1, REWIND_CHECKPOINTS)){
+        printf("MISMATCH %s on rewind: could not enable checkpoints\n", image);
+        rewindCheck.mismatches++;
+        return;
+    }
+    gibcpuRun(cpu, budget);
+    uint64_t latest = gibcpuCycles(cpu);
+    for(int i = 0; i < 2; i++){
+        // replays take checkpoints of their own, so the oldest one kept moves on
+        uint64_t oldest = gibcpuCheckpointCycle(cpu, 0);
+        targets[i] = oldest + nextRandom(rng) % (latest - oldest + 1);
+        if(gibcpuRewind(cpu, targets[i])){
+            printf("MISMATCH %s on rewind: could not rewind to cycle %llu\n", image, (unsigned long long)targets[i]);
+            rewindCheck.mismatches++;
+            gibcpuEnableCheckpoints(cpu, 0, 0);
+            return;
+        }
+        capture(cpu, &got[i]);
+        latest = targets[i];
+    }
+    gibcpuEnableCheckpoints(cpu, 0, 0);
+    gibcpuRestore(cpu, loaded);
+    for(int i = 1; i >= 0; i--){
+        gibcpuStep(cpu, targets[i] - gibcpuCycles(cpu));
+        capture(cpu, &want[i]);
+    }
+    for(int i = 0; i < 2; i++){
+        rewindCheck.compared++;
+        rewindCheck.mismatches += compare(image, &rewindCheck, &want[i], &got[i]);
+    }
+}
+
+// Runs every queued image in one batch to HALT or budget and compares it with its queued outcome
+static void runBatchCheck(const BatchQueue *queue, uint64_t budget){
+    uint64_t *cycles = calloc(queue->count + 1, sizeof(uint64_t));
+    uint64_t *loops = calloc(queue->count + 1, sizeof(uint64_t));
+    int *halted = calloc(queue->count + 1, sizeof(int));
+    if(!cycles || !loops || !halted ||
+       gibcpuRunBatch(queue->images, queue->infos, queue->count, budget, cycles, loops, halted)){
+        printf("MISMATCH on batch: could not run %d images\n", queue->count);
+        batchCheck.mismatches++;
+    }
+    else{
+        Outcome got;
+        memset(&got, 0, sizeof(Outcome));
+        for(int i = 0; i < queue->count; i++){
+            got.pc = queue->want[i].pc;
+            got.halted = halted[i];
+            got.cycles = cycles[i];
+            got.loops = loops[i];
+            batchCheck.compared++;
+            batchCheck.mismatches += compare(queue->names[i], &batchCheck, &queue->want[i], &got);
+        }
+    }
+    free(cycles);
+    free(loops);
+    free(halted);
+}
+
+// Queues an image for the batch check, unless it has banks
+static void queueBatch(BatchQueue *queue, const char *image, const GibCPUAssembly *assembly, const Outcome *want){
+    if(assembly->info.flags & GIBCPU_IMAGE_HAS_BANKS){
+        return;
+    }
+    int i = queue->count++;
+    memset(queue->images[i], 0, GIBCPU_MEMORY_SIZE);
+    memcpy(queue->images[i], assembly->image, assembly->length < GIBCPU_MEMORY_SIZE ? assembly->length
+                                                                                      : GIBCPU_MEMORY_SIZE);
+    queue->infos[i] = assembly->info;
+    queue->want[i] = *want;
+    snprintf(queue->names[i], sizeof(queue->names[i]), "%s", image);
+}
+
+// Runs the loaded image on the reference and every check, natively when native is set, and queues it for the
+// batch check. Returns 0 if it was skipped for not halting.
+static int testImage(GibCPU *cpu, const char *image, uint64_t budget, int mustHalt, uint64_t *rng,
+                     const GibCPUAssembly *assembly, int native, BatchQueue *queue){
+    GibCPUSnapshot loaded;
+    gibcpuSnapshot(cpu, &loaded);
+    Outcome want, got;
+    Check reference = {"cycle", {GIBCPU_ENGINE_CYCLE}, 1, GIBCPU_MICROCODE_HANDSHAKE, 0, 0, 0};
+    runCheck(cpu, &loaded, &reference, budget, rng, &want);
+    if(!want.halted){
+        // the batch stops on instruction boundaries like the fast engine, the reference on any posEdge
+        runCheck(cpu, &loaded, &checks[0], budget, rng, &got);
+        queueBatch(queue, image, assembly, &got);
+        if(mustHalt){
+            return 0;
+        }
+    }
+    else{
+        queueBatch(queue, image, assembly, &want);
+    }
+    testRewind(cpu, image, &loaded, budget, want.cycles, rng);
+    for(int c = 0; c < CHECK_COUNT; c++){
+        if(runCheck(cpu, &loaded, &checks[c], budget, rng, &got)){
+            checks[c].compared++;
+            checks[c].mismatches += compare(image, &checks[c], &want, &got);
+        }
+    }
+    if(native && !(assembly->info.flags & GIBCPU_IMAGE_HAS_BANKS)){
+        nativeCheck.compared++;
+        if(!runNative(assembly, budget, &got)){
+            printf("MISMATCH %s on native: could not be translated, built or run\n", image);
+            nativeCheck.mismatches++;
+        }
+        else{
+            nativeCheck.mismatches += compare(image, &nativeCheck, &want, &got);
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]){
+    int randomCount = DEFAULT_RANDOM;
+    int nativeRandom = DEFAULT_NATIVE_RANDOM;
+    uint64_t seed = DEFAULT_SEED;
+    const char *images[256];
+    int imageCount = 0;
+
+    // "Differential [--random N] [--seed S] [--native CC [--native-random N]] IMAGE..." prints one line per check
+    // and exits with 1 on any mismatch
+    for(int i = 1; i < argc; i++){
+        if(i + 1 < argc && !strcmp(argv[i], "--random")){
+            randomCount = atoi(argv[++i]);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--seed")){
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--native")){
+            nativeCompiler = argv[++i];
+        }
+        else if(i + 1 < argc && !strcmp(argv[i], "--native-random")){
+            nativeRandom = atoi(argv[++i]);
+        }
+        else if(argv[i][0] == '-'){
+            printf("Unknown option %s (expected --random, --seed, --native or --native-random)\n", argv[i]);
+            return 1;
+        }
+        else if(imageCount < 256){
+            images[imageCount++] = argv[i];
+        }
+    }
+
+    GibCPU *cpu = gibcpuCreate();
+    GibCPUAssembly *assembly = calloc(1, sizeof(GibCPUAssembly));
+    BatchQueue corpusBatch = {0}, randomBatch = {0};
+    int allocated = 1;
+    BatchQueue *queues[2] = {&corpusBatch, &randomBatch};
+    int sizes[2] = {imageCount + 1, randomCount + 1};
+    for(int q = 0; q < 2; q++){
+        queues[q]->images = calloc(sizes[q], GIBCPU_MEMORY_SIZE);
+        queues[q]->infos = calloc(sizes[q], sizeof(GibCPUImageInfo));
+        queues[q]->want = calloc(sizes[q], sizeof(Outcome));
+        queues[q]->names = calloc(sizes[q], sizeof(queues[q]->names[0]));
+        allocated &= queues[q]->images && queues[q]->infos && queues[q]->want && queues[q]->names;
+    }
+    if(!cpu || !assembly || !allocated){
+        printf("Out of memory\n");
+        gibcpuDestroy(cpu);
+        free(assembly);
+        freeBatch(&corpusBatch);
+        freeBatch(&randomBatch);
+        return 1;
+    }
+    if(nativeCompiler && !mkdtemp(nativeDir)){
+        perror("Error creating a directory for native builds");
+        nativeCompiler = NULL;
+        nativeCheck.mismatches++;
+    }
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for(int i = 0; i < imageCount; i++){
+        gibcpuSetDisplay(cpu, GIBCPU_DEFAULT_PRINT_ADDR, NULL, NULL);     // for images without a .print
+        if(!gibcpuLoadImageFile(cpu, images[i], NULL)){
+            gibcpuDestroy(cpu);
+            free(assembly);
+            freeBatch(&corpusBatch);
+            freeBatch(&randomBatch);
+            return 1;
+        }
+        memset(assembly, 0, sizeof(GibCPUAssembly));
+        assembly->length = gibcpuReadImageFile(images[i], assembly->image, sizeof(assembly->image), &assembly->info);
+        testImage(cpu, images[i], CORPUS_BUDGET, 0, &rng, assembly, nativeCompiler != NULL, &corpusBatch);
+    }
+    int tested = 0;
+    for(int i = 0; i < randomCount; i++){
+        memset(assembly, 0, sizeof(GibCPUAssembly));
+        for(int k = 0; k < GIBCPU_MEMORY_SIZE; k++){
+            assembly->image[k] = (uint8_t)nextRandom(&rng);
+        }
+        assembly->length = GIBCPU_MEMORY_SIZE;
+        assembly->info.flags = GIBCPU_IMAGE_HAS_PRINT_ADDR;
+        assembly->info.printAddr = (uint8_t)nextRandom(&rng);
+        char name[64];
+        snprintf(name, sizeof(name), "random image %d (seed %llu)", i, (unsigned long long)seed);
+        gibcpuSetDisplay(cpu, assembly->info.printAddr, NULL, NULL);
+        gibcpuLoadImage(cpu, assembly->image, GIBCPU_MEMORY_SIZE);
+        tested += testImage(cpu, name, RANDOM_BUDGET, 1, &rng, assembly, nativeCompiler && tested < nativeRandom,
+                            &randomBatch);
+    }
+    runBatchCheck(&corpusBatch, CORPUS_BUDGET);
+    runBatchCheck(&randomBatch, RANDOM_BUDGET);
+    gibcpuDestroy(cpu);
+    free(assembly);
+    freeBatch(&corpusBatch);
+    freeBatch(&randomBatch);
+    if(nativeCompiler){
+        rmdir(nativeDir);
+    }
+
+    printf("%d corpus images, %d of %d random images halted\n", imageCount, tested, randomCount);
+    int failed = 0;
+    for(int c = 0; c < CHECK_COUNT; c++){
+        printf("%-20s %6d compared, %d mismatches\n", checks[c].name, checks[c].compared, checks[c].mismatches);
+        failed |= checks[c].mismatches != 0;
+    }
+    printf("%-20s %6d compared, %d mismatches\n", rewindCheck.name, rewindCheck.compared, rewindCheck.mismatches);
+    failed |= rewindCheck.mismatches != 0;
+    printf("%-20s %6d compared, %d mismatches\n", batchCheck.name, batchCheck.compared, batchCheck.mismatches);
+    failed |= batchCheck.mismatches != 0;
+    if(nativeCompiler || nativeCheck.mismatches){
+        printf("%-20s %6d compared, %d mismatches\n", nativeCheck.name, nativeCheck.compared, nativeCheck.mismatches);
+        failed |= nativeCheck.mismatches != 0;
+    }
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
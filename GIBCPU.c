@@ -0,0 +1,994 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "GIBCPU_Internal.h"
+#include "GIBCPU_Superinstructions.h"
+
+_Static_assert(offsetof(GibCPU, ram) == 64, "hot GibCPU fields must fit the first cache line");
+
+// posEdges each instruction takes in the cycle-level model, indexed by opcode (command >> 4).
+// JMPZ is listed as not taken; a taken JMPZ follows the JMP path. Opcode 14 is listed as TAS, POPC and an
+// empty BSUM; MUL takes MUL_COST and BSUM another BSUM_BYTE_COST per byte summed.
+const uint8_t cycleCost[16] = {
+    4, 4, 4, 4, 4, 4, 4, 4,     // AND OR XOR ADD SUB NOTB SHIFTB LSHIFTB
+    13,                         // LOAD
+    13,                         // WRT
+    11,                         // JMPZ (not taken)
+    8,                          // JMP
+    10,                         // LOADL
+    10,                         // WRTL
+    13,                         // TAS and the coprocessor
+    7                           // HALT
+};
+
+/* CPU MODULE FUNCTIONS */
+
+// "Arithmetic Logic Unit", Module that performs Arithmetic Operations on RegA and RegB
+static void ALU(GibCPU *cpu){
+    uint8_t ALUout = cpu->ALUout;
+    switch((cpu->command & 0b11110000)){
+        case AND:
+            cpu->ALUout = cpu->regB & cpu->regA;
+            break;
+        case OR:
+            cpu->ALUout = cpu->regB | cpu->regA;
+            break;
+        case XOR:
+            cpu->ALUout = cpu->regB ^ cpu->regA;
+            break;
+        case ADD:
+            cpu->ALUout = cpu->regB + cpu->regA;
+            break;
+        case SUB:
+            cpu->ALUout = cpu->regB - cpu->regA;
+            break;
+        case NOTB:
+            cpu->ALUout = ~cpu->regB;
+            break;
+        case SHIFTB:
+            cpu->ALUout = cpu->regB >> 1;
+            break;
+        case LSHIFTB:
+            cpu->ALUout = cpu->regB << 1;
+            break;
+        default:
+            cpu->ALUout = 0;
+            break;
+    }
+    if(cpu->ALUout != ALUout){
+        cpu->pending |= MODULE_REGBANK;
+    }
+}
+
+// Module that loads RegA and RegB with correct registers based on the Command
+static void regPathSet(GibCPU *cpu){
+    uint8_t regA = cpu->regA;
+    uint8_t regB = cpu->regB;
+    uint8_t instruction = ((cpu->command & 0b11110000) >> 4);
+    if(instruction < 5 || instruction == 12 || instruction == 13){  //if two-variable op
+        cpu->regA = cpu->reg[(cpu->command & 0b1100) >> 2];         //set reg a
+        cpu->regB = cpu->reg[cpu->command & 0b11];                  //set reg b
+    }
+    else if((instruction >= 5 && instruction < 11) || instruction == 14){  //if one-variable op
+        cpu->regB = cpu->reg[cpu->command & 0b11];                  //set reg b
+    }
+    if(cpu->regA != regA || cpu->regB != regB){
+        cpu->pending |= MODULE_ALU;
+    }
+}
+
+// Module that loads the registers with a given module source based on the Command
+static void regBank(GibCPU *cpu){
+    if(cpu->setReg && !cpu->regSet){
+        if((cpu->command & 0b10000000) >> 7){                       // if not an ALU op, pull from memCtrlReg
+            cpu->reg[cpu->command & 0b11] = cpu->memCtrlReg;
+        }
+        else{                                                       // if ALU op, pull from ALU
+            cpu->reg[cpu->command & 0b11] = cpu->ALUout;
+        }
+        cpu->regSet = 1;
+        cpu->pending |= MODULE_REGPATHSET;
+    }
+    if(!cpu->setReg && cpu->regSet){
+        cpu->regSet = 0;
+    }
+}
+
+// Module that reads/writes specific memory locations in the RAM
+static void ramModule(GibCPU *cpu){
+    if(cpu->setRAM && !cpu->RAMSet){
+        cpu->ram[cpu->count] = cpu->memCtrlRAM;
+        ramWritten(cpu, cpu->count);
+        cpu->RAMSet = 1;
+    }
+    if(!cpu->setRAM && cpu->RAMSet){
+        cpu->RAMSet = 0;
+    }
+    cpu->ramDataOut = cpu->ram[cpu->count];
+}
+
+// Module that increments or sets the Program Counter
+static void progCounter(GibCPU *cpu){
+    if(cpu->setCount && !cpu->countSet){
+        cpu->count = cpu->memCtrlCount;
+        cpu->countSet = 1;
+        cpu->pending |= MODULE_RAM;
+    }
+    if(!cpu->setCount && cpu->countSet){
+        cpu->countSet = 0;
+    }
+    if(cpu->incrementCount && !cpu->countIncremented){
+        cpu->count++;
+        cpu->countIncremented = 1;
+        cpu->pending |= MODULE_RAM;
+        // DEBUG
+        if(cpu->count == cpu->printAddr){
+            cpu->loopCounter++;
+            if(cpu->displayHook){
+                cpu->displayHook(cpu, cpu->displayUser);
+            }
+        }
+    }
+    if(!cpu->incrementCount && cpu->countIncremented){
+        cpu->countIncremented = 0;
+    }
+}
+
+// Module that controls all other modules: runs the microinstruction the ROM holds for the state, the
+// command and the condition bits (GIBCPU_Microcode.c)
+static void memCtrl(GibCPU *cpu, const MicroRom *rom){
+    uint8_t state = cpu->state;
+    if(state == 0){                 // get next ram data, the lookup decodes it
+        cpu->command = cpu->ramDataOut;
+        if(isTas(cpu->command) && tasWaitsForBus(cpu)){
+            cpu->posEdgeCounter--;  // stop on the boundary like the other engines, the arbiter counts the wait
+            return;
+        }
+    }
+    int key = microClass[cpu->command] * MICRO_CONDITIONS;
+    if(rom->tests[state]){
+        key |= ((cpu->regB == 0) * COND_ZERO | (cpu->coprocLeft == 0) * COND_DONE |
+                (cpu->coprocLeft == 1) * COND_LAST) & rom->tests[state];
+    }
+    const MicroInstruction *u = &rom->micro[rom->entry[state][key]];
+    uint8_t shift;
+    static const void *handlers[UOPS] = {       // in UOP_* order
+        &&done, &&opFetch, &&opWaitCount, &&opWaitInc, &&opWaitReg, &&opWaitRam, &&opHalt, &&opClrCount,
+        &&opClrInc, &&opClrReg, &&opClrRam, &&opBookmark, &&opMdata, &&opCountRega, &&opCountData,
+        &&opCountBookmark, &&opCountMdata, &&opCountRegb, &&opRegMdata, &&opRegAcc, &&opRegPopc, &&opRamRegb,
+        &&opRamOne, &&opAccClear, &&opLeftFour, &&opLeftMdata, &&opMulStep, &&opAccAdd, &&opSetCount, &&opInc,
+        &&opSetReg, &&opSetRam, &&opDoCount, &&opDoInc, &&opDoReg, &&opDoRam
+    };
+    const uint8_t *op = u->ops;
+
+#define NEXT_OP() goto *handlers[*op++]
+    NEXT_OP();
+
+opFetch:            NEXT_OP();     // done before the lookup
+opWaitCount:        if(!cpu->countSet) return; NEXT_OP();
+opWaitInc:          if(!cpu->countIncremented) return; NEXT_OP();
+opWaitReg:          if(!cpu->regSet) return; NEXT_OP();
+opWaitRam:          if(!cpu->RAMSet) return; NEXT_OP();
+opHalt:             cpu->programHalt = 1; NEXT_OP();
+opClrCount:         cpu->setCount = 0; NEXT_OP();
+opClrInc:           cpu->incrementCount = 0; NEXT_OP();
+opClrReg:           cpu->setReg = 0; NEXT_OP();
+opClrRam:           cpu->setRAM = 0; NEXT_OP();
+opBookmark:         cpu->bookmark = cpu->count; NEXT_OP();
+opMdata:            cpu->Mdata = cpu->ramDataOut; NEXT_OP();
+opCountRega:        cpu->memCtrlCount = cpu->regA; NEXT_OP();
+opCountData:        cpu->memCtrlCount = cpu->ramDataOut; NEXT_OP();
+opCountBookmark:    cpu->memCtrlCount = cpu->bookmark; NEXT_OP();
+opCountMdata:       cpu->memCtrlCount = cpu->Mdata; NEXT_OP();
+opCountRegb:        cpu->memCtrlCount = cpu->regB; NEXT_OP();
+opRegMdata:         cpu->memCtrlReg = cpu->Mdata; NEXT_OP();
+opRegAcc:           cpu->memCtrlReg = cpu->coprocAcc; NEXT_OP();
+opRegPopc:          cpu->memCtrlReg = __builtin_popcount(cpu->Mdata); NEXT_OP();   // one pass through the adder tree
+opRamRegb:          cpu->memCtrlRAM = cpu->regB; NEXT_OP();
+opRamOne:           cpu->memCtrlRAM = 1; NEXT_OP();
+opAccClear:         cpu->coprocAcc = 0; NEXT_OP();
+opLeftFour:         cpu->coprocLeft = 4; NEXT_OP();
+opLeftMdata:        cpu->coprocLeft = cpu->Mdata; NEXT_OP();
+opSetCount:         cpu->setCount = 1; NEXT_OP();
+opInc:              cpu->incrementCount = 1; NEXT_OP();
+opSetReg:           cpu->setReg = 1; NEXT_OP();
+opSetRam:           cpu->setRAM = 1; NEXT_OP();
+
+opMulStep:                          // MUL: shift and add, two bits of Mdata per posEdge
+    shift = 2 * (4 - cpu->coprocLeft);
+    cpu->coprocAcc += (uint8_t)(cpu->regB << shift) * ((cpu->Mdata >> shift) & 0b11);
+    cpu->coprocLeft--;
+    NEXT_OP();
+
+opAccAdd:                           // BSUM: one more byte, count moves on to the next
+    cpu->coprocAcc += cpu->ramDataOut;
+    cpu->coprocLeft--;
+    cpu->memCtrlCount++;
+    NEXT_OP();
+
+opDoCount:                          // collapsed: what progCounter() and ramModule() would do next posEdge
+    cpu->count = cpu->memCtrlCount;
+    cpu->ramDataOut = cpu->ram[cpu->count];
+    NEXT_OP();
+
+opDoInc:
+    cpu->count++;
+    countIncrement(cpu, cpu->count);
+    cpu->ramDataOut = cpu->ram[cpu->count];
+    NEXT_OP();
+
+opDoReg:                            // what regBank() would do
+    cpu->reg[cpu->command & 0b11] = (cpu->command & 0b10000000) ? cpu->memCtrlReg : cpu->ALUout;
+    cpu->pending |= MODULE_REGPATHSET;
+    NEXT_OP();
+
+opDoRam:
+    cpu->ram[cpu->count] = cpu->memCtrlRAM;
+    ramWritten(cpu, cpu->count);
+    cpu->ramDataOut = cpu->ram[cpu->count];
+    NEXT_OP();
+#undef NEXT_OP
+
+done:
+    cpu->state = u->next;
+}
+
+// One posEdge of the cycle-level model. Modules run in the same order as the hardware settles, but only
+// those with a changed input: a skipped module would have recomputed the outputs it already holds. Each
+// module clears its pending bit before running, so a display hook writing RAM can wake it again.
+static inline void posEdge(GibCPU *cpu){
+    cpu->posEdgeCounter++;
+    if(cpu->pending & MODULE_REGBANK){
+        cpu->pending &= ~MODULE_REGBANK;
+        regBank(cpu);       // ALUOut OR memCtrlReg -> reg0-3
+    }
+    if(cpu->pending & MODULE_REGPATHSET){
+        cpu->pending &= ~MODULE_REGPATHSET;
+        regPathSet(cpu);    // reg0-3 -> regA-B
+    }
+    if(cpu->pending & MODULE_ALU){
+        cpu->pending &= ~MODULE_ALU;
+        ALU(cpu);           // regA-B -> ALUOut
+    }
+    if(cpu->pending & MODULE_PROGCOUNTER){
+        cpu->pending &= ~MODULE_PROGCOUNTER;
+        progCounter(cpu);   // count++ OR memCtrlCount -> count
+    }
+    if(cpu->pending & MODULE_RAM){
+        cpu->pending &= ~MODULE_RAM;
+        ramModule(cpu);     // memCtrlRAM -> ram[count] AND ram[count] -> ramDataOut
+    }
+    const MicroRom *rom = &microcodeRoms[cpu->microcode];
+    cpu->pending |= rom->drives[cpu->state];
+    memCtrl(cpu, rom);      // CPU Control State Machine
+}
+
+// Run the module loop until memCtrl() is back in state 0, i.e. one whole instruction from an instruction boundary
+void stepInstructionCycles(GibCPU *cpu){
+    cpu->pending = MODULE_ALL;      // the calling engine moved the registers and RAM behind the modules' backs
+    do{
+        posEdge(cpu);
+    } while(cpu->state != 0 && !cpu->programHalt);
+}
+
+void stepPosEdge(GibCPU *cpu){
+    posEdge(cpu);
+}
+
+/* INSTRUCTION-LEVEL ENGINE */
+
+// Runs one whole instruction per dispatch instead of stepping memCtrl() through its handshake states.
+// Program counter increments happen in the same order as the cycle-level model so the print hook matches.
+// Stops at HALT, at the first instruction boundary where posEdgeCounter has reached limit, or before the
+// instruction at stopAt (MAX_VALUES for none) once at least one instruction has run.
+void runFast(GibCPU *cpu, uint64_t limit, int stopAt){
+    uint8_t *mem = cpu->ram;
+    uint8_t *r = cpu->reg;
+    uint8_t pc = cpu->count;
+    uint64_t cycles = cpu->posEdgeCounter;
+    int traced = cpu->trace != NULL;
+
+    while(!cpu->programHalt && cycles < limit){
+        if(pc == stopAt && cycles != cpu->posEdgeCounter){
+            break;
+        }
+        uint8_t cmd = mem[pc];
+        uint8_t op = cmd >> 4;
+        uint8_t b = cmd & 0b11;                 // register B / destination
+        uint8_t a = (cmd & 0b1100) >> 2;        // register A
+        uint8_t operand;
+        cycles += cycleCost[op];
+
+        switch(cmd & 0b11110000){
+            case AND:
+                r[b] = r[b] & r[a];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case OR:
+                r[b] = r[b] | r[a];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case XOR:
+                r[b] = r[b] ^ r[a];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case ADD:
+                r[b] = r[b] + r[a];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case SUB:
+                r[b] = r[b] - r[a];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case NOTB:
+                r[b] = ~r[b];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case SHIFTB:
+                r[b] = r[b] >> 1;
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case LSHIFTB:
+                r[b] = r[b] << 1;
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case LOAD:                              // fetch operand, load, return to bookmark and skip both bytes
+                countIncrement(cpu, pc + 1);
+                r[b] = mem[mem[(uint8_t)(pc + 1)]];
+                countIncrement(cpu, pc + 1);
+                pc = countIncrement(cpu, pc + 2);
+                break;
+            case WRT:
+                countIncrement(cpu, pc + 1);
+                operand = mem[(uint8_t)(pc + 1)];     // the write may land on the operand itself
+                mem[operand] = r[b];
+                ramWritten(cpu, operand);
+                countIncrement(cpu, pc + 1);
+                pc = countIncrement(cpu, pc + 2);
+                break;
+            case JMPZ:
+                countIncrement(cpu, pc + 1);
+                if(r[b] == 0){
+                    cycles += JMPZ_TAKEN_COST - cycleCost[op];
+                    pc = mem[mem[(uint8_t)(pc + 1)]];
+                }
+                else{
+                    countIncrement(cpu, pc + 1);
+                    pc = countIncrement(cpu, pc + 2);
+                }
+                break;
+            case JMP:
+                countIncrement(cpu, pc + 1);
+                pc = mem[mem[(uint8_t)(pc + 1)]];
+                break;
+            case LOADL:
+                r[b] = mem[r[a]];
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case WRTL:
+                mem[r[a]] = r[b];
+                ramWritten(cpu, r[a]);
+                pc = countIncrement(cpu, pc + 1);
+                break;
+            case HALT:                              // memCtrl() still fetches the next byte into count before halting
+                countIncrement(cpu, pc + 1);
+                pc = mem[(uint8_t)(pc + 1)];
+                cpu->programHalt = 1;
+                break;
+            case TAS:                               // LOAD that also writes 1 back, or the coprocessor
+                if(!isTas(cmd)){
+                    countIncrement(cpu, pc + 1);
+                    operand = mem[(uint8_t)(pc + 1)];
+                    if((cmd & 0b11111100) == MUL){
+                        cycles += MUL_COST - cycleCost[op];
+                    }
+                    else if((cmd & 0b11111100) == BSUM){
+                        cycles += BSUM_BYTE_COST * mem[operand];
+                    }
+                    r[b] = coprocResult(mem, cmd, r[b], mem[operand]);
+                    countIncrement(cpu, pc + 1);
+                    pc = countIncrement(cpu, pc + 2);
+                    break;
+                }
+                if(tasWaitsForBus(cpu)){
+                    cycles -= cycleCost[op];
+                    limit = cycles;
+                    break;
+                }
+                countIncrement(cpu, pc + 1);
+                operand = mem[(uint8_t)(pc + 1)];
+                r[b] = mem[operand];
+                mem[operand] = 1;
+                ramWritten(cpu, operand);
+                countIncrement(cpu, pc + 1);
+                pc = countIncrement(cpu, pc + 2);
+                break;
+        }
+        if(traced){
+            cpu->count = pc;
+            cpu->posEdgeCounter = cycles;
+            traceInstruction(cpu, cmd);
+        }
+    }
+
+    cpu->count = pc;
+    cpu->posEdgeCounter = cycles;
+}
+
+/* PREDECODED THREADED ENGINE */
+
+// Superinstruction opcode sequences (GIBCPU_Superinstructions.h) in handler order, past the 16 opcodes:
+// triples, then pairs, then an end marker that never matches
+typedef struct {
+    uint8_t ops[3];
+    uint8_t length;
+} SuperSequence;
+
+#define SUPER_TRIPLE_SEQUENCE(x, y, z) {{x, y, z}, 3},
+#define SUPER_PAIR_SEQUENCE(x, y) {{x, y}, 2},
+static const SuperSequence superSequences[] = {
+    GIBCPU_SUPER_TRIPLES(SUPER_TRIPLE_SEQUENCE)
+    GIBCPU_SUPER_PAIRS(SUPER_PAIR_SEQUENCE)
+    {{HALT, HALT, HALT}, 3}
+};
+#undef SUPER_TRIPLE_SEQUENCE
+#undef SUPER_PAIR_SEQUENCE
+
+// Fill in decoded[pc] for the single instruction in the bytes currently in ram[]
+static void decodeInstruction(GibCPU *cpu, uint8_t pc){
+    Decoded *d = &cpu->decoded[pc];
+    uint8_t cmd = cpu->ram[pc];
+    uint8_t op = cmd >> 4;
+    uint8_t first = ((uint8_t)(pc + 1) == cpu->printAddr);
+    uint8_t second = ((uint8_t)(pc + 2) == cpu->printAddr);
+
+    d->a = (cmd & 0b1100) >> 2;
+    d->b = cmd & 0b11;
+    d->operand = cpu->ram[(uint8_t)(pc + 1)];
+    d->printsBefore = 0;
+    d->printsAfter = 0;
+    switch(cmd & 0b11110000){
+        case LOAD:
+        case WRT:
+        case TAS:
+        case JMPZ:                  // printsAfter only applies when JMPZ is not taken
+            d->next = pc + 2;
+            d->printsBefore = first;
+            d->printsAfter = first + second;
+            break;
+        case JMP:
+        case HALT:
+            d->next = pc + 2;
+            d->printsBefore = first;
+            break;
+        default:                    // ALU ops, LOADL and WRTL are one byte
+            d->next = pc + 1;
+            d->printsAfter = first;
+            break;
+    }
+    d->kind = op + 1;
+}
+
+// Handler index of the longest superinstruction starting at pc, 0 if none does. The instructions after the
+// first have to be decoded too, since the superinstruction runs from their entries. Print hits rule fusing out.
+static uint8_t superKind(GibCPU *cpu, uint8_t pc){
+    uint8_t ops[3];
+    int length = 0;
+    uint8_t at = pc;
+    while(length < 3){
+        Decoded *d = &cpu->decoded[at];
+        if(!d->kind){
+            decodeInstruction(cpu, at);
+        }
+        uint8_t op = cpu->ram[at] & 0b11110000;
+        if(d->printsBefore || d->printsAfter || op == TAS || op == HALT){
+            break;
+        }
+        ops[length++] = op;
+        if(op == JMPZ || op == JMP){
+            break;
+        }
+        at = d->next;
+    }
+
+    int count = sizeof(superSequences) / sizeof(superSequences[0]) - 1;
+    for(int i = 0; i < count; i++){
+        const SuperSequence *sequence = &superSequences[i];
+        if(sequence->length <= length && !memcmp(sequence->ops, ops, sequence->length)){
+            return 17 + i;          // after decode and the 16 opcode handlers
+        }
+    }
+    return 0;
+}
+
+// Fill in decoded[pc] from the bytes currently in ram[], fusing what follows when the set has it
+static void decodeAt(GibCPU *cpu, uint8_t pc){
+    decodeInstruction(cpu, pc);
+    uint8_t kind = superKind(cpu, pc);
+    if(kind){
+        cpu->decoded[pc].kind = kind;
+        uint8_t span = 0;
+        for(int i = 0; i < superSequences[kind - 17].length; i++){
+            span += instructionLength(superSequences[kind - 17].ops[i] >> 4);
+        }
+        for(uint8_t back = 1; back < span; back++){     // so writes into it drop this entry too
+            Decoded *covered = &cpu->decoded[(uint8_t)(pc + back)];
+            if(covered->superBack < back){
+                covered->superBack = back;
+            }
+        }
+    }
+}
+
+static inline void printHits(GibCPU *cpu, uint8_t hits){
+    for(uint8_t i = 0; i < hits; i++){
+        countIncrement(cpu, cpu->printAddr);
+    }
+}
+
+// Same semantics and cycle accounting as runFast(), but every address is decoded once into decoded[]
+// and instructions chain to each other through computed gotos instead of a central switch. Sequences in
+// the superinstruction set run in one dispatch.
+static void runThreaded(GibCPU *cpu, uint64_t limit){
+#define SUPER_TRIPLE_HANDLER(x, y, z) &&super_##x##_##y##_##z,
+#define SUPER_PAIR_HANDLER(x, y) &&super_##x##_##y,
+    static const void *handlers[] = {
+        &&decode,
+        &&opAnd, &&opOr, &&opXor, &&opAdd, &&opSub, &&opNotb, &&opShiftb, &&opLshiftb,
+        &&opLoad, &&opWrt, &&opJmpz, &&opJmp, &&opLoadl, &&opWrtl, &&opTas, &&opHalt,
+        GIBCPU_SUPER_TRIPLES(SUPER_TRIPLE_HANDLER)
+        GIBCPU_SUPER_PAIRS(SUPER_PAIR_HANDLER)
+    };
+#undef SUPER_TRIPLE_HANDLER
+#undef SUPER_PAIR_HANDLER
+    uint8_t *mem = cpu->ram;
+    uint8_t *r = cpu->reg;
+    uint8_t pc = cpu->count;
+    uint64_t cycles = cpu->posEdgeCounter;
+    Decoded *d;
+
+    if(cpu->programHalt){
+        return;
+    }
+
+#define DISPATCH() do { if(cycles >= limit) goto done; d = &cpu->decoded[pc]; goto *handlers[d->kind]; } while(0)
+#define ALU_OP(expr) do { r[d->b] = (expr); cycles += 4; pc = d->next; printHits(cpu, d->printsAfter); DISPATCH(); } while(0)
+
+    DISPATCH();
+
+decode:
+    decodeAt(cpu, pc);
+    goto *handlers[d->kind];
+
+opAnd:      ALU_OP(r[d->b] & r[d->a]);
+opOr:       ALU_OP(r[d->b] | r[d->a]);
+opXor:      ALU_OP(r[d->b] ^ r[d->a]);
+opAdd:      ALU_OP(r[d->b] + r[d->a]);
+opSub:      ALU_OP(r[d->b] - r[d->a]);
+opNotb:     ALU_OP(~r[d->b]);
+opShiftb:   ALU_OP(r[d->b] >> 1);
+opLshiftb:  ALU_OP(r[d->b] << 1);
+
+opLoad:
+    cycles += 13;
+    printHits(cpu, d->printsBefore);
+    r[d->b] = mem[d->operand];
+    pc = d->next;
+    printHits(cpu, d->printsAfter);
+    DISPATCH();
+
+opWrt:
+    cycles += 13;
+    printHits(cpu, d->printsBefore);
+    mem[d->operand] = r[d->b];
+    pc = d->next;
+    printHits(cpu, d->printsAfter);
+    ramWritten(cpu, d->operand);
+    DISPATCH();
+
+opJmpz:
+    printHits(cpu, d->printsBefore);
+    if(r[d->b] == 0){
+        cycles += JMPZ_TAKEN_COST;
+        pc = mem[d->operand];
+    }
+    else{
+        cycles += 11;
+        pc = d->next;
+        printHits(cpu, d->printsAfter);
+    }
+    DISPATCH();
+
+opJmp:
+    cycles += 8;
+    printHits(cpu, d->printsBefore);
+    pc = mem[d->operand];
+    DISPATCH();
+
+opLoadl:
+    cycles += 10;
+    r[d->b] = mem[r[d->a]];
+    pc = d->next;
+    printHits(cpu, d->printsAfter);
+    DISPATCH();
+
+opWrtl:
+    cycles += 10;
+    mem[r[d->a]] = r[d->b];
+    ramWritten(cpu, r[d->a]);
+    pc = d->next;
+    printHits(cpu, d->printsAfter);
+    DISPATCH();
+
+opHalt:
+    cycles += 7;
+    printHits(cpu, d->printsBefore);
+    pc = d->operand;
+    cpu->programHalt = 1;
+    goto done;
+
+opTas:
+    if(d->a){                   // coprocessor
+        uint8_t cmd = TAS | (d->a << 2);
+        cycles += cmd == MUL ? MUL_COST : 13;
+        printHits(cpu, d->printsBefore);
+        if(cmd == BSUM){
+            cycles += BSUM_BYTE_COST * mem[d->operand];
+        }
+        r[d->b] = coprocResult(mem, cmd, r[d->b], mem[d->operand]);
+        pc = d->next;
+        printHits(cpu, d->printsAfter);
+        DISPATCH();
+    }
+    if(tasWaitsForBus(cpu)){
+        goto done;
+    }
+    cycles += 13;
+    printHits(cpu, d->printsBefore);
+    r[d->b] = mem[d->operand];
+    mem[d->operand] = 1;
+    pc = d->next;
+    printHits(cpu, d->printsAfter);
+    ramWritten(cpu, d->operand);
+    DISPATCH();
+
+// The instructions of a superinstruction, from their own decoded entries and without print hits
+#define STEP_AND        r[d->b] = r[d->b] & r[d->a]; cycles += 4; pc = d->next;
+#define STEP_OR         r[d->b] = r[d->b] | r[d->a]; cycles += 4; pc = d->next;
+#define STEP_XOR        r[d->b] = r[d->b] ^ r[d->a]; cycles += 4; pc = d->next;
+#define STEP_ADD        r[d->b] = r[d->b] + r[d->a]; cycles += 4; pc = d->next;
+#define STEP_SUB        r[d->b] = r[d->b] - r[d->a]; cycles += 4; pc = d->next;
+#define STEP_NOTB       r[d->b] = ~r[d->b]; cycles += 4; pc = d->next;
+#define STEP_SHIFTB     r[d->b] = r[d->b] >> 1; cycles += 4; pc = d->next;
+#define STEP_LSHIFTB    r[d->b] = r[d->b] << 1; cycles += 4; pc = d->next;
+#define STEP_LOAD       r[d->b] = mem[d->operand]; cycles += 13; pc = d->next;
+#define STEP_WRT        mem[d->operand] = r[d->b]; ramWritten(cpu, d->operand); cycles += 13; pc = d->next;
+#define STEP_JMPZ       if(r[d->b] == 0){ cycles += JMPZ_TAKEN_COST; pc = mem[d->operand]; } \
+                        else{ cycles += 11; pc = d->next; }
+#define STEP_JMP        cycles += 8; pc = mem[d->operand];
+#define STEP_LOADL      r[d->b] = mem[r[d->a]]; cycles += 10; pc = d->next;
+#define STEP_WRTL       mem[r[d->a]] = r[d->b]; ramWritten(cpu, r[d->a]); cycles += 10; pc = d->next;
+
+// Between two of them: stop on the boundary as single dispatch would, or carry on that way if a write
+// dropped the superinstruction
+#define STEP_NEXT() do { if(cycles >= limit || !super->kind){ DISPATCH(); } d = &cpu->decoded[pc]; } while(0)
+#define SUPER_TRIPLE(x, y, z) super_##x##_##y##_##z: { \
+        Decoded *super = d; STEP_##x STEP_NEXT(); STEP_##y STEP_NEXT(); STEP_##z DISPATCH(); }
+#define SUPER_PAIR(x, y) super_##x##_##y: { \
+        Decoded *super = d; STEP_##x STEP_NEXT(); STEP_##y DISPATCH(); }
+
+    GIBCPU_SUPER_TRIPLES(SUPER_TRIPLE)
+    GIBCPU_SUPER_PAIRS(SUPER_PAIR)
+
+done:
+#undef SUPER_TRIPLE
+#undef SUPER_PAIR
+#undef STEP_NEXT
+#undef ALU_OP
+#undef DISPATCH
+    cpu->count = pc;
+    cpu->posEdgeCounter = cycles;
+}
+
+/* CONTEXT API */
+
+GibCPU *gibcpuCreate(void){
+    GibCPU *cpu = aligned_alloc(64, sizeof(GibCPU));
+    if(!cpu){
+        return NULL;
+    }
+    memset(cpu, 0, sizeof(GibCPU));
+    cpu->printAddr = GIBCPU_DEFAULT_PRINT_ADDR;
+    cpu->engine = GIBCPU_ENGINE_CYCLE;
+    cpu->microcode = GIBCPU_MICROCODE_HANDSHAKE;
+    microcodeInit();
+    cpu->nextCheckpoint = UINT64_MAX;
+    return cpu;
+}
+
+void gibcpuDestroy(GibCPU *cpu){
+    if(!cpu){
+        return;
+    }
+    gibcpuStopTrace(cpu);
+    jitDestroy(cpu);
+    checkpointsDestroy(cpu);
+    memoDestroy(cpu);
+    free(cpu);
+}
+
+void gibcpuReset(GibCPU *cpu){
+    memset(cpu, 0, offsetof(GibCPU, printAddr));
+    cpu->count = cpu->entry;
+    cpu->fault = GIBCPU_FAULT_NONE;
+    cpu->pending = MODULE_ALL;
+    cpu->busWait = 0;
+    cpu->posEdgeCounter = 0;
+    cpu->loopCounter = 0;
+    memoClear(cpu);
+    checkpointsReset(cpu);
+    if(cpu->trace){
+        traceDiscontinuity(cpu);
+    }
+}
+
+size_t gibcpuLoadImage(GibCPU *cpu, const uint8_t *image, size_t length){
+    return loadImageAt(cpu, image, length, 0);
+}
+
+size_t loadImageAt(GibCPU *cpu, const uint8_t *image, size_t length, uint8_t entry){
+    if(length > MAX_VALUES){
+        length = MAX_VALUES;
+    }
+    memset(cpu->ram, 0, MAX_VALUES);
+    memcpy(cpu->ram, image, length);
+    cpu->bankCount = 0;
+    cpu->bankMapped = 0;
+    memset(cpu->banks, 0, sizeof(cpu->banks));
+    memset(cpu->decoded, 0, sizeof(cpu->decoded));
+    jitFlush(cpu);
+    cpu->entry = entry;
+    gibcpuReset(cpu);
+    return length;
+}
+
+int gibcpuSetEngine(GibCPU *cpu, GibCPUEngine engine){
+    if(engine == GIBCPU_ENGINE_JIT && !jitAvailable()){
+        return 0;
+    }
+    // JIT stores only tell the other caches about writes into translated code, so neither cache can be trusted
+    // by the next engine
+    if(engine != cpu->engine){
+        memset(cpu->decoded, 0, sizeof(cpu->decoded));
+        jitFlush(cpu);
+    }
+    cpu->engine = engine;
+    return 1;
+}
+
+GibCPUEngine gibcpuEngine(const GibCPU *cpu){
+    return (GibCPUEngine)cpu->engine;
+}
+
+int gibcpuSetMicrocode(GibCPU *cpu, GibCPUMicrocode microcode){
+    if(microcode != GIBCPU_MICROCODE_HANDSHAKE && microcode != GIBCPU_MICROCODE_COLLAPSED){
+        return 0;
+    }
+    cpu->microcode = microcode;
+    return 1;
+}
+
+GibCPUMicrocode gibcpuMicrocode(const GibCPU *cpu){
+    return (GibCPUMicrocode)cpu->microcode;
+}
+
+uint64_t gibcpuStep(GibCPU *cpu, uint64_t cycles){
+    uint64_t start = cpu->posEdgeCounter;
+    cpu->pending = MODULE_ALL;
+    if(cpu->trace){
+        traceSync(cpu);
+    }
+    while(!cpu->programHalt && cpu->posEdgeCounter - start < cycles && !cpu->busWait){
+        if(cpu->profile){
+            profilePosEdge(cpu);
+        }
+        else{
+            posEdge(cpu);
+        }
+        if(cpu->trace && (cpu->state == 0 || cpu->programHalt)){
+            traceInstruction(cpu, cpu->command);
+        }
+        if(cpu->posEdgeCounter >= cpu->nextCheckpoint){
+            checkpointTake(cpu);
+        }
+    }
+    return cpu->posEdgeCounter - start;
+}
+
+// Run the selected engine until HALT or limit
+static void runEngine(GibCPU *cpu, uint64_t limit){
+    cpu->pending = MODULE_ALL;      // another engine or the caller may have changed the state since
+    if(cpu->trace){
+        runTraced(cpu, limit);
+        return;
+    }
+    if(cpu->profile){
+        while(!cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+            profilePosEdge(cpu);
+        }
+        return;
+    }
+    // the memo key is RAM and registers, which miss the banks, and its entries replay handshake costs
+    int memo = cpu->memo && !cpu->bankCount && !cpu->microcode;
+    if((cpu->engine == GIBCPU_ENGINE_CYCLE || cpu->microcode) && !memo){
+        while(!cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+            posEdge(cpu);
+        }
+        return;
+    }
+
+    // instruction-level engines start from an instruction boundary, so finish one gibcpuStep() left open
+    while(cpu->state != 0 && !cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+        posEdge(cpu);
+    }
+
+    if(memo){
+        runMemo(cpu, limit);
+        return;
+    }
+    switch(cpu->engine){
+        case GIBCPU_ENGINE_FAST:
+            runFast(cpu, limit, MAX_VALUES);
+            break;
+        case GIBCPU_ENGINE_THREADED:
+            runThreaded(cpu, limit);
+            break;
+        case GIBCPU_ENGINE_JIT:
+            if(!runJit(cpu, limit)){
+                runFast(cpu, limit, MAX_VALUES);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+int gibcpuRun(GibCPU *cpu, uint64_t budget){
+    uint64_t limit = cpu->posEdgeCounter + budget;
+    if(limit < cpu->posEdgeCounter){
+        limit = UINT64_MAX;
+    }
+
+    // stop at every checkpoint that falls due on the way, and in front of a TAS waiting for the bus
+    while(!cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+        runEngine(cpu, limit < cpu->nextCheckpoint ? limit : cpu->nextCheckpoint);
+        if(cpu->posEdgeCounter >= cpu->nextCheckpoint){
+            checkpointTake(cpu);
+        }
+    }
+    return cpu->programHalt;
+}
+
+uint8_t gibcpuRead(const GibCPU *cpu, uint8_t addr){
+    return cpu->ram[addr];
+}
+
+void gibcpuWrite(GibCPU *cpu, uint8_t addr, uint8_t value){
+    cpu->ram[addr] = value;
+    ramWritten(cpu, addr);
+    cpu->pending |= MODULE_RAM;
+    memoClear(cpu);
+}
+
+void gibcpuReadMemory(const GibCPU *cpu, uint8_t addr, uint8_t *out, size_t length){
+    for(size_t i = 0; i < length; i++){
+        out[i] = cpu->ram[(uint8_t)(addr + i)];
+    }
+}
+
+void gibcpuWriteMemory(GibCPU *cpu, uint8_t addr, const uint8_t *data, size_t length){
+    for(size_t i = 0; i < length; i++){
+        gibcpuWrite(cpu, addr + i, data[i]);
+    }
+}
+
+uint8_t gibcpuRegister(const GibCPU *cpu, int reg){
+    return cpu->reg[reg & 0b11];
+}
+
+uint8_t gibcpuProgramCounter(const GibCPU *cpu){
+    return cpu->count;
+}
+
+int gibcpuHalted(const GibCPU *cpu){
+    return cpu->programHalt;
+}
+
+GibCPUFault gibcpuFault(const GibCPU *cpu){
+    return (GibCPUFault)cpu->fault;
+}
+
+uint64_t gibcpuCycles(const GibCPU *cpu){
+    return cpu->posEdgeCounter;
+}
+
+uint64_t gibcpuLoops(const GibCPU *cpu){
+    return cpu->loopCounter;
+}
+
+void gibcpuSetDisplay(GibCPU *cpu, uint8_t printAddr, GibCPUDisplayHook hook, void *user){
+    cpu->printAddr = printAddr;
+    cpu->displayHook = hook;
+    cpu->displayUser = user;
+    memoClear(cpu);                                     // loop counts between recorded states change with printAddr
+    memset(cpu->decoded, 0, sizeof(cpu->decoded));     // print hits are baked into decoded entries and JIT blocks
+    jitFlush(cpu);
+}
+
+/* BANKED MEMORY */
+
+void switchBank(GibCPU *cpu){
+    uint8_t bank = cpu->ram[GIBCPU_BANK_SELECT] % cpu->bankCount;
+    if(bank == cpu->bankMapped){
+        return;
+    }
+    memcpy(cpu->banks[cpu->bankMapped], cpu->ram + GIBCPU_BANK_WINDOW, GIBCPU_BANK_SIZE);
+    memcpy(cpu->ram + GIBCPU_BANK_WINDOW, cpu->banks[bank], GIBCPU_BANK_SIZE);
+    cpu->bankMapped = bank;
+    for(int addr = GIBCPU_BANK_WINDOW - cpu->decoded[GIBCPU_BANK_WINDOW].superBack; addr < MAX_VALUES; addr++){
+        cpu->decoded[addr].kind = 0;
+    }
+    for(int addr = GIBCPU_BANK_WINDOW; addr < MAX_VALUES; addr++){
+        if(cpu->jitCovered[addr]){
+            jitInvalidate(cpu, addr);
+        }
+    }
+}
+
+void loadBanks(GibCPU *cpu, const uint8_t *banks, int bankCount){
+    cpu->bankCount = bankCount;
+    memcpy(cpu->banks, banks, bankCount * GIBCPU_BANK_SIZE);
+    cpu->bankMapped = cpu->ram[GIBCPU_BANK_SELECT] % bankCount;
+    memcpy(cpu->ram + GIBCPU_BANK_WINDOW, cpu->banks[cpu->bankMapped], GIBCPU_BANK_SIZE);
+    memset(cpu->decoded, 0, sizeof(cpu->decoded));
+    jitFlush(cpu);
+}
+
+int gibcpuBankCount(const GibCPU *cpu){
+    return cpu->bankCount;
+}
+
+int gibcpuMappedBank(const GibCPU *cpu){
+    return cpu->bankMapped;
+}
+
+void gibcpuReadExtended(const GibCPU *cpu, uint16_t addr, uint8_t *out, size_t length){
+    size_t at = addr;
+    while(length){
+        const uint8_t *from;
+        size_t chunk;
+        if(at < MAX_VALUES){
+            from = cpu->ram + at;
+            chunk = MAX_VALUES - at;
+        }
+        else if(at < MAX_VALUES + GIBCPU_EXTENDED_SIZE){
+            size_t bank = (at - MAX_VALUES) / GIBCPU_BANK_SIZE;
+            size_t offset = (at - MAX_VALUES) % GIBCPU_BANK_SIZE;
+            int mapped = cpu->bankCount && bank == cpu->bankMapped;     // the live copy is in the window
+            from = mapped ? cpu->ram + GIBCPU_BANK_WINDOW + offset : cpu->banks[bank] + offset;
+            chunk = GIBCPU_BANK_SIZE - offset;
+        }
+        else{
+            memset(out, 0, length);
+            return;
+        }
+        chunk = chunk < length ? chunk : length;
+        memcpy(out, from, chunk);
+        out += chunk;
+        at += chunk;
+        length -= chunk;
+    }
+}
@@ -0,0 +1,599 @@
+#ifndef GIBCPU_H
+#define GIBCPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* GIBCPU EMULATOR LIBRARY
+ *
+ * Every emulated machine lives in its own GibCPU context, so any number of them can run in one process
+ * (one context per thread at a time). Typical use:
+ *
+ *     GibCPU *cpu = gibcpuCreate();
+ *     gibcpuLoadImageFile(cpu, "RAM.gib", NULL);
+ *     gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+ *     gibcpuRun(cpu, GIBCPU_NO_BUDGET);
+ *     printf("%llu cycles\n", (unsigned long long)gibcpuCycles(cpu));
+ *     gibcpuDestroy(cpu);
+ */
+
+#define GIBCPU_MEMORY_SIZE 256
+#define GIBCPU_NO_BUDGET UINT64_MAX
+
+#define GIBCPU_DEFAULT_PRINT_ADDR 6         // progCounter value that marks one pass of the Game of Life loop
+#define GIBCPU_DEFAULT_DISPLAY_START 161    // address of #currentStateFirst in the shipped Game of Life
+#define GIBCPU_DEFAULT_DISPLAY_WIDTH 6
+#define GIBCPU_DEFAULT_DISPLAY_HEIGHT 6
+
+// Banked memory: writing N to GIBCPU_BANK_SELECT maps bank N (modulo the image's bank count) into the
+// GIBCPU_BANK_SIZE bytes of RAM from GIBCPU_BANK_WINDOW up. Only images with banks have the register.
+#define GIBCPU_BANK_SELECT 0xBF
+#define GIBCPU_BANK_WINDOW 0xC0
+#define GIBCPU_BANK_SIZE 64
+#define GIBCPU_MAX_BANKS 32
+#define GIBCPU_EXTENDED_SIZE (GIBCPU_MAX_BANKS * GIBCPU_BANK_SIZE)
+
+typedef struct GibCPU GibCPU;
+typedef struct GibCPUSystem GibCPUSystem;
+
+typedef enum {
+    GIBCPU_ENGINE_CYCLE,        // module by module each posEdge, re-evaluating those whose inputs changed
+    GIBCPU_ENGINE_FAST,         // one whole instruction per dispatch, cycles from the cost table
+    GIBCPU_ENGINE_THREADED,     // predecoded RAM dispatched through computed gotos
+    GIBCPU_ENGINE_JIT           // basic blocks translated to x86-64
+} GibCPUEngine;
+
+// Control unit microcode the cycle-level model runs, see gibcpuSetMicrocode()
+typedef enum {
+    GIBCPU_MICROCODE_HANDSHAKE, // memCtrl() as built: every request waits a posEdge for its acknowledge
+    GIBCPU_MICROCODE_COLLAPSED  // requests whose acknowledge would be the only thing waited for done in place
+} GibCPUMicrocode;
+
+typedef enum {
+    GIBCPU_FAULT_NONE,
+    GIBCPU_FAULT_UNUSED_OPCODE  // no longer raised now that the coprocessor fills opcode 14; kept for saved states
+} GibCPUFault;
+
+// Called every time the program counter is incremented onto the print address
+typedef void (*GibCPUDisplayHook)(GibCPU *cpu, void *user);
+
+// Returns a zeroed, powered-on context or NULL when out of memory
+GibCPU *gibcpuCreate(void);
+void gibcpuDestroy(GibCPU *cpu);
+
+// Back to the power-on state: registers, latches and counters cleared, program counter at the entry point,
+// RAM kept
+void gibcpuReset(GibCPU *cpu);
+
+// Copy an image into RAM starting at address 0 (the rest is cleared) and reset with entry point 0.
+// Returns bytes loaded.
+size_t gibcpuLoadImage(GibCPU *cpu, const uint8_t *image, size_t length);
+
+/* IMAGE FILES
+ *
+ * Binary images (".gib") are a 16-byte header followed by the RAM bytes:
+ *
+ *     0  "GIBR"           magic
+ *     4  version          GIBCPU_IMAGE_VERSION
+ *     5  header size      16, RAM starts here
+ *     6  length           bytes of RAM, 16-bit little-endian, at most 256
+ *     8  entry point      program counter at power-on
+ *     9  flags            GIBCPU_IMAGE_HAS_* bits for the optional fields below
+ *    10  print address
+ *    11  display start    first address of the display region
+ *    12  display width
+ *    13  display height
+ *    14  bank count       version 2 only, banks of GIBCPU_BANK_SIZE bytes follow the RAM bytes
+ *    15  display start    version 2 only, high byte of an extended display start
+ *
+ * Version 1 images have 0 in bytes 14 and 15 and no banks. Images are written as version 1 unless they
+ * have banks or display past address 255, so older readers still load them.
+ *
+ * Files without the magic are read as legacy RAM.txt text, one "01010101" line per byte.
+ */
+
+#define GIBCPU_IMAGE_VERSION 2
+#define GIBCPU_IMAGE_HEADER_SIZE 16
+#define GIBCPU_IMAGE_HAS_PRINT_ADDR 1
+#define GIBCPU_IMAGE_HAS_DISPLAY 2
+#define GIBCPU_IMAGE_HAS_BANKS 4
+
+typedef struct {
+    uint8_t entry;
+    uint8_t flags;
+    uint8_t printAddr;
+    uint16_t displayStart;      // extended address, see gibcpuReadExtended()
+    uint8_t displayWidth;
+    uint8_t displayHeight;
+    uint8_t bankCount;          // with GIBCPU_IMAGE_HAS_BANKS, 1 to GIBCPU_MAX_BANKS
+} GibCPUImageInfo;
+
+// Load an image file and reset at its entry point. A print address in the header replaces the current one.
+// info (may be NULL) receives the header fields. Returns bytes loaded, 0 on error.
+size_t gibcpuLoadImageFile(GibCPU *cpu, const char *filename, GibCPUImageInfo *info);
+
+// Read an image file into array without a context. The banks of a banked image follow at
+// array + GIBCPU_MEMORY_SIZE if maxValues leaves room for them. Returns RAM bytes loaded, 0 on error.
+size_t gibcpuReadImageFile(const char *filename, uint8_t *array, size_t maxValues, GibCPUImageInfo *info);
+
+// Write a binary image, info may be NULL for entry point 0 and no metadata. With GIBCPU_IMAGE_HAS_BANKS the
+// banks are read from image + GIBCPU_MEMORY_SIZE. Returns 0 on success.
+int gibcpuWriteImageFile(const char *filename, const uint8_t *image, size_t length, const GibCPUImageInfo *info);
+
+/* ASSEMBLER
+ *
+ * Source text in, RAM image out, without touching the filesystem:
+ *
+ *     GibCPUAssembly assembly;
+ *     if(!gibcpuAssemble(source, strlen(source), &assembly)){
+ *         gibcpuLoadAssembly(cpu, &assembly);
+ *     }
+ *
+ * Image files that are neither binary images nor legacy RAM.txt are assembled the same way when loaded.
+ * Statements after ".bank N" go into bank N from GIBCPU_BANK_WINDOW up, "$x" and "#x" there naming window
+ * addresses, and ".fill COUNT VALUE" reserves COUNT bytes of VALUE.
+ */
+
+typedef struct {
+    char name[16];              // "$3", "#12"
+    uint8_t addr;
+} GibCPUSymbol;
+
+typedef struct {
+    uint8_t image[GIBCPU_MEMORY_SIZE + GIBCPU_EXTENDED_SIZE];  // RAM, then info.bankCount banks
+    size_t length;                          // bytes of RAM used, 0 on error
+    GibCPUImageInfo info;                   // from the .entry, .print, .display, .grid and .bank directives
+    int line[GIBCPU_MEMORY_SIZE];           // source line of each byte, from 1, 0 in the bank window
+    int symbolCount;
+    GibCPUSymbol symbols[GIBCPU_MEMORY_SIZE];   // every $variable and #location, in source order
+    int errorLine;                          // first line in error, 0 if none
+    char error[64];
+    int removed;                            // instructions dropped by gibcpuAssembleOptimized()
+    int removedLine[GIBCPU_MEMORY_SIZE];    // and their source lines
+    uint64_t cyclesSaved;                   // clock cycles those instructions cost, once each
+    char note[64];                          // why the optimizer left the program alone, if it did
+} GibCPUAssembly;
+
+// Assemble length bytes of source. Returns 0 on success, otherwise 1 with errorLine and error set.
+int gibcpuAssemble(const char *source, size_t length, GibCPUAssembly *assembly);
+
+// Assemble, then drop loads of values a register already holds, stores of values RAM already holds and
+// stores overwritten before they are read. #locations and the .entry, .print and .display addresses are
+// renumbered to follow the code. Programs that write a #location they jump through, and programs with
+// banks, are left as they are.
+int gibcpuAssembleOptimized(const char *source, size_t length, GibCPUAssembly *assembly);
+
+// Load an assembled image and reset at its entry point, like gibcpuLoadImageFile(). Returns bytes loaded.
+size_t gibcpuLoadAssembly(GibCPU *cpu, const GibCPUAssembly *assembly);
+
+// Write the symbol map read by gibcpuPrintProfile(): source line and text of every image byte, then every
+// symbol address. Returns 0 on success.
+int gibcpuWriteSymbolMap(const char *filename, const char *source, size_t length, const GibCPUAssembly *assembly);
+
+// Translate an assembled program ahead of time into a standalone C program that needs no library. Each basic
+// block becomes straight-line C that adds its clock cycles once, and jumps go through a switch over the block
+// addresses. Code bytes the program overwrites run on an embedded copy of the fast engine until they hold
+// what was translated again. Built with the host compiler, it runs to HALT with the same clock cycles, print
+// passes and final RAM as gibcpuRun(), "--budget CYCLES" stopping it at the first block exit past CYCLES.
+// Returns 0 on success, 1 for programs with banks or if the file cannot be written.
+int gibcpuWriteC(const char *filename, const GibCPUAssembly *assembly);
+
+// Select the engine used by gibcpuRun(), also between two runs of the same program: a different engine starts
+// with empty code caches. Returns 0 (and keeps the current engine) if it is unavailable.
+int gibcpuSetEngine(GibCPU *cpu, GibCPUEngine engine);
+GibCPUEngine gibcpuEngine(const GibCPU *cpu);
+
+// Select the microcode memCtrl() runs. The collapsed variant exists only as microcode, so while it is selected
+// gibcpuRun() uses the cycle-level model whatever the engine (the selection is kept, like under the
+// profiler), memoization is skipped, and gibcpuRunPipelined() still compares against the handshake costs.
+// It takes ALU 2 posEdges, LOAD and WRT 7, JMPZ 6 (5 taken), JMP 5, LOADL and WRTL 6, HALT 5, TAS and POPC 7,
+// MUL 10 and BSUM 7 plus 1 per byte. Kept across gibcpuReset() and not part of snapshots. Returns 0 (and
+// keeps the current microcode) if microcode is out of range.
+int gibcpuSetMicrocode(GibCPU *cpu, GibCPUMicrocode microcode);
+GibCPUMicrocode gibcpuMicrocode(const GibCPU *cpu);
+
+// Step the cycle-level model by up to cycles posEdges, stopping early on HALT. Returns posEdges run.
+uint64_t gibcpuStep(GibCPU *cpu, uint64_t cycles);
+
+// Run on the selected engine until HALT or until budget more posEdges have run. Instruction-level engines
+// stop at the first instruction boundary at or past the budget, the JIT at the first block exit past it.
+// Returns 1 if the machine has halted.
+int gibcpuRun(GibCPU *cpu, uint64_t budget);
+
+uint8_t gibcpuRead(const GibCPU *cpu, uint8_t addr);
+void gibcpuWrite(GibCPU *cpu, uint8_t addr, uint8_t value);
+void gibcpuReadMemory(const GibCPU *cpu, uint8_t addr, uint8_t *out, size_t length);
+void gibcpuWriteMemory(GibCPU *cpu, uint8_t addr, const uint8_t *data, size_t length);
+
+uint8_t gibcpuRegister(const GibCPU *cpu, int reg);
+uint8_t gibcpuProgramCounter(const GibCPU *cpu);
+int gibcpuHalted(const GibCPU *cpu);
+GibCPUFault gibcpuFault(const GibCPU *cpu);
+uint64_t gibcpuCycles(const GibCPU *cpu);   // posEdgeCounter
+uint64_t gibcpuLoops(const GibCPU *cpu);    // loopCounter, increments onto the print address
+
+// Set the print address and the hook called when it is reached (hook may be NULL)
+void gibcpuSetDisplay(GibCPU *cpu, uint8_t printAddr, GibCPUDisplayHook hook, void *user);
+
+/* BANKED MEMORY
+ *
+ * An image with banks (".bank N" in assembly, GIBCPU_IMAGE_HAS_BANKS in the header) splits RAM into
+ *
+ *     0x00-0xBE   home RAM, always visible
+ *     0xBF        bank register: writing N maps bank N modulo the bank count into the window
+ *     0xC0-0xFF   window onto the mapped bank, bank 0 at power-on
+ *
+ * Every engine indexes RAM directly as before. A write to the bank register copies the window back to its
+ * bank and the new bank in, so reads and instruction fetches cost nothing extra. Images without banks keep
+ * all 256 bytes as plain RAM. The batch engine runs unbanked images only and the memo cache is bypassed
+ * while banks are in use.
+ *
+ * Extended addresses reach every bank from outside: 0-255 are RAM as the program sees it, then bank N
+ * starts at GIBCPU_MEMORY_SIZE + N * GIBCPU_BANK_SIZE.
+ */
+
+// 0 for a machine without banks
+int gibcpuBankCount(const GibCPU *cpu);
+int gibcpuMappedBank(const GibCPU *cpu);
+
+// Read length bytes from an extended address. Bytes past the last bank read as 0.
+void gibcpuReadExtended(const GibCPU *cpu, uint16_t addr, uint8_t *out, size_t length);
+
+/* ASYNCHRONOUS DISPLAY
+ *
+ * Draws a region of RAM as a grid of cells (1 = dark, anything else = light) on a renderer thread, so the
+ * emulator only copies the region into a lock-free ring when the print address is reached:
+ *
+ *     GibCPUDisplay *display = gibcpuDisplayCreate(&config);
+ *     gibcpuSetDisplay(cpu, GIBCPU_DEFAULT_PRINT_ADDR, gibcpuDisplayHook, display);
+ *     gibcpuRun(cpu, GIBCPU_NO_BUDGET);
+ *     gibcpuDisplayDestroy(display);
+ */
+
+typedef struct GibCPUDisplay GibCPUDisplay;
+
+typedef struct {
+    uint16_t start;             // first extended address of the region, drawn row by row
+    uint8_t width;
+    uint8_t height;
+    int fps;                    // 0 draws every frame (the emulator waits if the renderer falls behind),
+                                // otherwise at most fps frames a second, skipping the ones in between
+    int delta;                  // redraw only changed cells with ANSI cursor moves instead of whole frames
+    FILE *out;
+} GibCPUDisplayConfig;
+
+// Starts the renderer thread. Returns NULL if the region runs past the last bank or out of resources.
+GibCPUDisplay *gibcpuDisplayCreate(const GibCPUDisplayConfig *config);
+
+// Display hook, installed with the display as the user pointer
+void gibcpuDisplayHook(GibCPU *cpu, void *display);
+
+// Draws whatever is still queued, then stops the renderer
+void gibcpuDisplayDestroy(GibCPUDisplay *display);
+
+// Frames skipped by frame rate throttling
+uint64_t gibcpuDisplayDropped(const GibCPUDisplay *display);
+
+/* PROFILER
+ *
+ * While a profile is attached, gibcpuRun() and gibcpuStep() use the cycle-level model whatever the engine,
+ * and every posEdge is charged to the instruction in flight and to the memCtrl() state it ran in:
+ *
+ *     GibCPUProfile profile = {0};
+ *     gibcpuSetProfile(cpu, &profile);
+ *     gibcpuRun(cpu, GIBCPU_NO_BUDGET);
+ *     gibcpuPrintProfile(&profile, "RAM.map", stdout);
+ */
+
+#define GIBCPU_PROFILE_STATES 27    // memCtrl() states 0-26
+
+typedef struct {
+    uint64_t opcodeCount[16];                   // instructions started, by opcode (command >> 4)
+    uint64_t opcodeCycles[16];                  // posEdges, by opcode
+    uint64_t stateCycles[GIBCPU_PROFILE_STATES];    // posEdges spent in each memCtrl() state
+    uint64_t pcCount[GIBCPU_MEMORY_SIZE];       // instructions started at each address
+    uint64_t pcCycles[GIBCPU_MEMORY_SIZE];      // posEdges, by instruction address
+    uint64_t ramReads[GIBCPU_MEMORY_SIZE];      // data reads: LOAD, LOADL, TAS, the coprocessor and jump targets
+    uint64_t ramWrites[GIBCPU_MEMORY_SIZE];     // WRT, WRTL and TAS
+    uint64_t opcodePairs[16][16];               // instructions that ran back to back, each falling through
+    uint64_t opcodeTriples[16][16][16];         // to the next, by opcode
+} GibCPUProfile;
+
+// Accumulate into profile from now on, NULL to stop. The caller owns profile and clears it.
+void gibcpuSetProfile(GibCPU *cpu, GibCPUProfile *profile);
+
+// Print opcode, memCtrl() state, hot source line and RAM heatmap tables. mapFile is the symbol map written
+// by the Assembler ("RAM.map"), or NULL to report addresses only. Returns 0 on success.
+int gibcpuPrintProfile(const GibCPUProfile *profile, const char *mapFile, FILE *out);
+
+/* PIPELINE MODEL
+ *
+ * What a pipelined hardware revision would make of a program, next to memCtrl(): the machine runs on the
+ * fast engine as usual while every instruction it executes is timed on a four-stage in-order pipeline
+ *
+ *     fetch       fetchBytes bytes of the instruction per posEdge through the single RAM port
+ *     decode      command decoded, registers read
+ *     execute     the ALU, or RAM through the same port: LOAD, WRT, LOADL, WRTL, jump targets, TAS and the
+ *                 coprocessor, which stays in execute for as many posEdges as it needs
+ *     writeback   register written
+ *
+ * Execute has the port whenever it needs it and fetch waits. Jumps are predicted not taken and resolved in
+ * execute, so a taken JMPZ or JMP flushes fetch and decode, and so does a write to bytes already fetched.
+ * With forwarding an instruction takes the result of the one ahead of it straight from execute, without it
+ * waits in decode until that one writes back. Every posEdge in which nothing writes back is charged to a
+ * stall cause, so posEdges = instructions + stalls:
+ *
+ *     GibCPUPipelineConfig config = {1, 1};
+ *     GibCPUPipelineStats stats;
+ *     gibcpuRunPipelined(cpu, GIBCPU_NO_BUDGET, &config, &stats);
+ *     gibcpuPrintPipeline(&stats, stdout);
+ */
+
+typedef enum {
+    GIBCPU_STALL_FILL,          // the first instruction on its way to writeback
+    GIBCPU_STALL_FETCH,         // fetch still reading the second byte of an instruction
+    GIBCPU_STALL_PORT,          // fetch waiting while execute holds the RAM port
+    GIBCPU_STALL_DATA,          // decode waiting for a register to be written back
+    GIBCPU_STALL_EXECUTE,       // TAS or a coprocessor instruction still in execute
+    GIBCPU_STALL_JUMP,          // fetch and decode flushed by a taken jump
+    GIBCPU_STALL_SELF_MODIFY,   // fetch and decode flushed by a write to fetched bytes
+    GIBCPU_STALL_CAUSES
+} GibCPUStall;
+
+typedef struct {
+    int fetchBytes;             // bytes fetch reads per posEdge, 1 or 2
+    int forwarding;             // forward execute results to the next instruction
+} GibCPUPipelineConfig;
+
+typedef struct {
+    GibCPUPipelineConfig config;
+    uint64_t posEdges;                      // on the pipeline
+    uint64_t instructions;
+    uint64_t fsmPosEdges;                   // the same instructions through memCtrl()
+    uint64_t stalls[GIBCPU_STALL_CAUSES];   // posEdges in which nothing wrote back, by cause
+    uint64_t jumpFlushes;
+    uint64_t selfModifyFlushes;
+} GibCPUPipelineStats;
+
+// Run like gibcpuRun() on the fast engine, budget counting memCtrl() posEdges, bypassing the profiler and the
+// memo cache, and time the instructions on the pipeline into stats. Returns 1 if the machine has halted.
+int gibcpuRunPipelined(GibCPU *cpu, uint64_t budget, const GibCPUPipelineConfig *config, GibCPUPipelineStats *stats);
+
+// Print CPI against memCtrl() and the stall breakdown
+void gibcpuPrintPipeline(const GibCPUPipelineStats *stats, FILE *out);
+
+/* REAL-TIME PACING
+ *
+ * Runs the machine at a fixed rate of posEdges per second of the monotonic clock, for a timing model next to
+ * other simulated components. The selected engine runs a batch of posEdges, then the loop waits for the time
+ * the emulated clock is due: it sleeps, and with spin set, stops sleeping early by as much as the OS has lately
+ * overslept and spins the rest. Batches are period seconds of emulated clock. While the loop falls behind they
+ * double, up to 64 periods, so fewer wakeups leave more time to emulate; once it keeps up they halve back. A
+ * longer period costs the host less CPU, a shorter one spaces the emulated clock more finely. Lateness is how
+ * far past its due time each batch boundary was reached, the jitter seen by the components alongside:
+ *
+ *     GibCPUPaceConfig config = {1e6, 1e-3, 1};
+ *     GibCPUPaceStats stats;
+ *     gibcpuRunPaced(cpu, GIBCPU_NO_BUDGET, &config, &stats);
+ *     gibcpuPrintPace(&stats, stdout);
+ */
+
+typedef struct {
+    double hz;                  // target posEdges per second
+    double period;              // seconds of emulated clock per batch while on time, 0 for 1 ms
+    int spin;                   // spin through the last stretch instead of trusting the sleep
+} GibCPUPaceConfig;
+
+typedef struct {
+    GibCPUPaceConfig config;
+    uint64_t posEdges;
+    uint64_t batches;
+    uint64_t lateBatches;       // reached their due time already running, so did not wait
+    uint64_t minBatch;          // posEdges in a batch, past the request at the first instruction boundary
+    uint64_t maxBatch;
+    double seconds;             // wall clock from the start to the last due time
+    double runSeconds;          // of those running the machine
+    double spinSeconds;         // and spinning
+    double rate;                // achieved posEdges per second
+    double latenessP50;         // seconds, within 1/16 of the value
+    double latenessP90;
+    double latenessP99;
+    double latenessP999;
+    double latenessMax;
+    double latenessMean;
+} GibCPUPaceStats;
+
+// Run like gibcpuRun() until HALT or budget posEdges, paced to config->hz, and fill in stats. An hz of 0 runs
+// flat out. Returns 1 if the machine has halted.
+int gibcpuRunPaced(GibCPU *cpu, uint64_t budget, const GibCPUPaceConfig *config, GibCPUPaceStats *stats);
+
+// Print the achieved rate, host CPU share and lateness percentiles
+void gibcpuPrintPace(const GibCPUPaceStats *stats, FILE *out);
+
+/* SNAPSHOTS AND CHECKPOINTS */
+
+#define GIBCPU_SNAPSHOT_SIZE (320 + GIBCPU_EXTENDED_SIZE)
+
+// Full machine state: RAM, banks, registers, the memCtrl() state and handshake latches, fault and counters.
+// The engine, display settings and checkpoints are not part of it. Counters are stored little-endian,
+// so snapshot files move between hosts.
+typedef struct {
+    uint8_t data[GIBCPU_SNAPSHOT_SIZE];
+} GibCPUSnapshot;
+
+void gibcpuSnapshot(const GibCPU *cpu, GibCPUSnapshot *snapshot);
+void gibcpuRestore(GibCPU *cpu, const GibCPUSnapshot *snapshot);
+
+// Write or read a snapshot file. Both return 0 on success.
+int gibcpuSaveSnapshot(const GibCPU *cpu, const char *filename);
+int gibcpuLoadSnapshot(GibCPU *cpu, const char *filename);
+
+// Take a checkpoint every interval posEdges while running, keeping the newest capacity of them
+// (interval 0 turns checkpoints off). Checkpoints are delta-compressed against their neighbours.
+// The first checkpoint is the current state. Returns 0 on success.
+int gibcpuEnableCheckpoints(GibCPU *cpu, uint64_t interval, int capacity);
+
+// Checkpoints are numbered from 0, the oldest still kept
+int gibcpuCheckpointCount(const GibCPU *cpu);
+uint64_t gibcpuCheckpointCycle(const GibCPU *cpu, int index);
+
+// Restore a checkpoint. Newer checkpoints are dropped, running on records a new timeline. Returns 0 on success.
+int gibcpuRestoreCheckpoint(GibCPU *cpu, int index);
+
+// Restore the newest checkpoint at or before cycle and replay forward to exactly that cycle, without calling
+// the display hook. A program that halts before cycle is left halted. Returns 0 on success, or 1 if cycle is
+// older than every checkpoint kept or the replay ran past it (the machine is then left where it stopped).
+int gibcpuRewind(GibCPU *cpu, uint64_t cycle);
+
+/* STATE MEMOIZATION */
+
+// Record (RAM, registers) every time an instruction boundary is reached at addr, in a table of up to capacity
+// states (0 turns it off). When a state comes round again the program is in a loop, and gibcpuRun()
+// fast-forwards by whole periods and then along the recorded states, leaving the cycle and loop counters
+// exactly where a full run would. gibcpuRun() uses the fast engine while enabled, the display hook is not called
+// for skipped periods, and no skip crosses a checkpoint. Returns 0 on success.
+int gibcpuEnableMemo(GibCPU *cpu, uint8_t addr, int capacity);
+
+// posEdges skipped by fast-forwarding so far
+uint64_t gibcpuMemoSkipped(const GibCPU *cpu);
+
+/* EXECUTION TRACE */
+
+// Stream a record of every instruction to filename: the program counter, the command, the registers that
+// changed and the RAM written, delta-encoded, with a snapshot every megabyte or so and wherever the machine
+// is restored or reset. A writer thread takes full buffers off the emulator and, with compress, packs them
+// LZ-style. gibcpuRun() uses the fast engine while tracing (the cycle-level model if selected or profiling)
+// and skips memoization. Returns 0 on success.
+int gibcpuStartTrace(GibCPU *cpu, const char *filename, int compress);
+
+// Flush the trace and close its file. Returns 0 if everything was written.
+int gibcpuStopTrace(GibCPU *cpu);
+
+// Rebuild the machine state at the last instruction boundary at or before cycle (GIBCPU_NO_BUDGET for the end)
+// from a trace file, without running anything: the nearest snapshot plus the records after it. Display
+// settings, the engine and the latches the cycle-level model recomputes on its next posEdge are not traced.
+// Returns 0 on success.
+int gibcpuReplayTrace(GibCPU *cpu, const char *filename, uint64_t cycle);
+
+/* BATCH HELPERS */
+
+// Run images on the SIMD batch engine, BATCH_LANES at a time, with no display. infos (may be NULL for entry
+// point 0 and the default print address) holds each image's header as gibcpuReadImageFile() reads it. Every
+// image stops at HALT or at the first instruction boundary at or past budget posEdges, like gibcpuRun().
+// cycles, loops and halted (1 at HALT, 0 out of budget) receive one entry per image. Returns 0 on success,
+// 1 if out of memory or an image has banks.
+int gibcpuRunBatch(uint8_t (*images)[GIBCPU_MEMORY_SIZE], const GibCPUImageInfo *infos, int imageCount,
+                   uint64_t budget, uint64_t *cycles, uint64_t *loops, int *halted);
+
+// Run every RAM image from a directory or manifest across threadCount workers, each on its own context,
+// and write one result line per image to outFile. Returns 0 on success, 1 if the images could not be
+// collected, the run could not be set up, outFile could not be written or any image was left unrun.
+int gibcpuRunJobs(const char *source, const char *outFile, int threadCount, uint64_t budget);
+
+/* PROGRAM SEARCH
+ *
+ * Searches for programs that turn given RAM inputs into given RAM outputs. Every candidate is the image with
+ * codeLength bytes from codeStart replaced, run from entry once per case on the fast engine. Its fitness
+ * is the scored bits it gets wrong over all cases, then its size, then its posEdges: lower is better, and 0
+ * wrong bits is a solution. A case that does not halt within cycleCap posEdges gets every scored bit wrong.
+ * Candidates are evaluated across threads, each on its own context, and a candidate stops running cases as
+ * soon as it has more wrong bits than it needs to win.
+ *
+ * GIBCPU_SEARCH_MUTATE climbs from the code in the image: each thread keeps a parent, mutates it (byte and bit
+ * changes, inserts and deletes) and keeps any child with no more wrong bits, and every so often takes over the best
+ * program found so far if it is better. GIBCPU_SEARCH_ENUMERATE tries every code in turn, the byte at codeStart
+ * counting fastest, which is exhaustive up to about 4 bytes.
+ */
+
+#define GIBCPU_SEARCH_MAX_CASES 64
+
+typedef enum {
+    GIBCPU_SEARCH_MUTATE,
+    GIBCPU_SEARCH_ENUMERATE
+} GibCPUSearchMode;
+
+// Input bits replace image bits before a run, and the scored bits of the final RAM are compared with expected
+typedef struct {
+    uint8_t input[GIBCPU_MEMORY_SIZE];
+    uint8_t inputMask[GIBCPU_MEMORY_SIZE];
+    uint8_t expected[GIBCPU_MEMORY_SIZE];
+    uint8_t expectedMask[GIBCPU_MEMORY_SIZE];
+} GibCPUSearchCase;
+
+typedef struct {
+    uint8_t image[GIBCPU_MEMORY_SIZE];  // candidate size counts code bytes up to the last nonzero one
+    uint32_t wrongBits;
+    uint32_t size;
+    uint64_t cycles;                    // over all cases
+    uint64_t evaluated;                 // candidates when this one was found, then in total
+    uint64_t casesRun;                  // in total, short of evaluated * caseCount by the cases cut short
+    uint64_t timeouts;                  // cases that hit cycleCap
+    double seconds;
+} GibCPUSearchResult;
+
+typedef struct {
+    GibCPUSearchMode mode;
+    uint8_t image[GIBCPU_MEMORY_SIZE];
+    uint8_t entry;
+    uint8_t codeStart;
+    uint16_t codeLength;                // 1 to GIBCPU_MEMORY_SIZE - codeStart
+    const GibCPUSearchCase *cases;
+    int caseCount;                      // 1 to GIBCPU_SEARCH_MAX_CASES
+    uint64_t cycleCap;
+    uint64_t candidates;                // stop after this many, 0 for no limit (enumeration stops when done)
+    double seconds;                     // stop after this long, 0 for no limit
+    int stopAtSolution;                 // stop at the first candidate with 0 wrong bits
+    int threads;                        // at least 1
+    uint64_t seed;                      // mutation random numbers
+    void (*improved)(const GibCPUSearchResult *best, void *user);  // on every new best, may be NULL
+    void *user;
+} GibCPUSearchConfig;
+
+// Run a search and return the fittest candidate in result. Returns 0 on success, 1 on a bad config or
+// out of memory or threads.
+int gibcpuSearch(const GibCPUSearchConfig *config, GibCPUSearchResult *result);
+
+/* MULTI-CORE SYSTEM */
+
+#define GIBCPU_MAX_CORES 64
+#define GIBCPU_DEFAULT_EPOCH 1024
+#define GIBCPU_DEFAULT_BUS_COST 2
+
+// Cores share the 256 bytes of RAM over one bus. Each core runs epoch posEdges on its own copy, then the bus
+// arbiter publishes the bytes every core wrote (the later core in round-robin order wins a conflict), stalls
+// each writer busCost posEdges per bus transaction queued up to its own, runs the TAS instructions cores are
+// waiting on one at a time against the shared RAM, and hands every core the result. A TAS is the only
+// instruction that sees the other cores' writes at once, so programs share data under a TAS lock. Results
+// do not depend on threads; a JIT core gives way at block ends rather than instruction boundaries.
+typedef struct {
+    int cores;                  // 1 to GIBCPU_MAX_CORES
+    uint32_t epoch;             // posEdges between bus arbitrations, 0 for GIBCPU_DEFAULT_EPOCH
+    uint32_t busCost;           // posEdges per bus transaction
+    int threads;                // worker threads running the cores, 0 runs them in turn on the caller
+    GibCPUEngine engine;
+} GibCPUSystemConfig;
+
+// Returns a system of powered-on cores with empty RAM, or NULL when out of memory or threads
+GibCPUSystem *gibcpuSystemCreate(const GibCPUSystemConfig *config);
+void gibcpuSystemDestroy(GibCPUSystem *system);
+
+// Load an image into the shared RAM and power every core on at its entry point, core k with k in register 0,
+// so one program can split the work. Returns bytes loaded, 0 on error or for an image with banks.
+size_t gibcpuSystemLoadImageFile(GibCPUSystem *system, const char *filename, GibCPUImageInfo *info);
+
+// Run whole epochs until every core has halted or budget posEdges have passed. Returns 1 once all cores
+// have halted.
+int gibcpuSystemRun(GibCPUSystem *system, uint64_t budget);
+
+// Core k, for the per-core accessors (gibcpuCycles(), gibcpuHalted(), gibcpuRegister(), ...)
+GibCPU *gibcpuSystemCore(GibCPUSystem *system, int core);
+
+// posEdges of system time run so far, and those core k spent waiting for the bus
+uint64_t gibcpuSystemCycles(const GibCPUSystem *system);
+uint64_t gibcpuSystemBusWait(const GibCPUSystem *system, int core);
+
+// Shared RAM as of the last arbitration
+uint8_t gibcpuSystemRead(const GibCPUSystem *system, uint8_t addr);
+
+#endif
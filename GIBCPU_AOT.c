@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+/* AHEAD-OF-TIME TRANSLATION TO C */
+
+// What the walk from the entry point found in the image, and the blocks cut from it
+typedef struct {
+    const uint8_t *ram;
+    uint8_t printAddr;
+    uint8_t code[MAX_VALUES];       // an instruction starts here
+    uint8_t leader[MAX_VALUES];     // a block starts here
+    uint8_t covered[MAX_VALUES];    // a block translated this byte, as an opcode or an operand
+    int blocks;
+} Translation;
+
+static const char *const mnemonics[16] = {
+    "and", "or", "xor", "add", "sub", "notb", "shiftb", "lshiftb",
+    "load", "wrt", "jmpz", "jmp", "loadl", "wrtl", "tas", "halt"
+};
+
+static const char *const coprocMnemonics[4] = {"tas", "mul", "popc", "bsum"};
+
+// A two-byte instruction at 255 reads its operand from 0; those run on the interpreter
+static int translatable(const Translation *t, int pc){
+    return pc + instructionLength(t->ram[pc] >> 4) <= MAX_VALUES;
+}
+
+// Marks every instruction reachable from pc through fallthrough and the jump targets the image holds now
+static void walk(Translation *t, uint8_t start){
+    uint8_t stack[MAX_VALUES];
+    int top = 0;
+    stack[top++] = start;
+    while(top){
+        int pc = stack[--top];
+        while(!t->code[pc] && translatable(t, pc)){
+            uint8_t cmd = t->ram[pc];
+            t->code[pc] = 1;
+            uint8_t op = cmd & 0b11110000;
+            if(op == JMP || op == JMPZ){
+                uint8_t target = t->ram[t->ram[pc + 1]];
+                if(!t->code[target] && top < MAX_VALUES){
+                    stack[top++] = target;
+                }
+                t->leader[target] = 1;
+            }
+            if(op == JMP || op == HALT){
+                break;
+            }
+            pc += instructionLength(cmd >> 4);
+            if(pc >= MAX_VALUES){
+                break;
+            }
+            if(op == JMPZ){
+                t->leader[pc] = 1;
+            }
+        }
+    }
+}
+
+// The address a constant-address store writes, or -1 for none
+static int storeAddress(const Translation *t, int pc){
+    uint8_t cmd = t->ram[pc];
+    if((cmd & 0b11110000) == WRT || isTas(cmd)){
+        return t->ram[pc + 1];
+    }
+    return -1;
+}
+
+// Whether a block ends after the instruction at pc, and where it goes on if it falls through
+static int blockEnds(const Translation *t, int pc, int *next){
+    uint8_t op = t->ram[pc] & 0b11110000;
+    *next = pc + instructionLength(t->ram[pc] >> 4);
+    if(op == JMP || op == JMPZ || op == HALT){
+        return 1;
+    }
+    return *next >= MAX_VALUES || t->leader[*next] || !t->code[*next] || !translatable(t, *next);
+}
+
+// Cut the found code into blocks: a block runs from a leader to a jump, HALT, the next leader or a store into
+// translated bytes, after which the bytes have to be checked again
+static void cutBlocks(Translation *t, uint8_t entry, const GibCPUAssembly *assembly){
+    t->leader[entry] = 1;
+    walk(t, entry);
+    for(int i = 0; i < assembly->symbolCount; i++){   // #locations hold the jump targets the program copies around
+        if(assembly->symbols[i].name[0] == '#'){
+            uint8_t target = t->ram[assembly->symbols[i].addr];
+            t->leader[target] = 1;
+            walk(t, target);
+        }
+    }
+    for(int start = 0; start < MAX_VALUES; start++){
+        if(!t->leader[start] || !t->code[start]){
+            continue;
+        }
+        int pc = start, next;
+        for(;;){
+            memset(t->covered + pc, 1, instructionLength(t->ram[pc] >> 4));
+            if(blockEnds(t, pc, &next)){
+                break;
+            }
+            pc = next;
+        }
+    }
+    // splitting a block after a store into covered bytes leaves them covered
+    for(int pc = 0; pc < MAX_VALUES; pc++){
+        int store = storeAddress(t, pc);
+        int next = pc + instructionLength(t->ram[pc] >> 4);
+        if(t->code[pc] && store >= 0 && t->covered[store] && next < MAX_VALUES && t->code[next]){
+            t->leader[next] = 1;
+        }
+    }
+}
+
+static void writeBytes(FILE *out, const char *declaration, const uint8_t *bytes){
+    fprintf(out, "%s = {\n", declaration);
+    for(int i = 0; i < MAX_VALUES; i++){
+        fprintf(out, "%s0x%02x,%s", i % 16 ? " " : "    ", bytes[i], i % 16 == 15 ? "\n" : "");
+    }
+    fprintf(out, "};\n\n");
+}
+
+// hit() where the emulator's program counter increment would land on the print address
+static void writeHit(FILE *out, const Translation *t, int next){
+    if((uint8_t)next == t->printAddr){
+        fprintf(out, "    hit();\n");
+    }
+}
+
+// One block: its instructions as straight-line C, the posEdges added once on each way out
+static void writeBlock(FILE *out, Translation *t, int start){
+    int pc = start, next, cycles = 0;
+    for(int at = start; !blockEnds(t, at, &next); at = next){
+    }
+    fprintf(out, "b%02x:\n", start);
+    fprintf(out, "    if(dirty && memcmp(ram + 0x%02x, original + 0x%02x, %d)){\n", start, start, next - start);
+    fprintf(out, "        pc = 0x%02x;\n        goto interpret;\n    }\n", start);
+    for(;;){
+        uint8_t cmd = t->ram[pc];
+        uint8_t op = cmd >> 4;
+        int b = cmd & 0b11;
+        int a = (cmd & 0b1100) >> 2;
+        uint8_t operand = t->ram[(uint8_t)(pc + 1)];
+        int ends = blockEnds(t, pc, &next);
+        cycles += cycleCost[op];
+        fprintf(out, "    // 0x%02x %s", pc, op == TAS >> 4 ? coprocMnemonics[a] : mnemonics[op]);
+        if(op == HALT >> 4){
+            fprintf(out, "\n");
+        }
+        else if(op == JMP >> 4){
+            fprintf(out, " 0x%02x\n", operand);
+        }
+        else if(instructionLength(op) > 1){
+            fprintf(out, " r%d 0x%02x\n", b, operand);
+        }
+        else if(op == NOTB >> 4 || op == SHIFTB >> 4 || op == LSHIFTB >> 4){
+            fprintf(out, " r%d\n", b);
+        }
+        else{
+            fprintf(out, " r%d r%d\n", a, b);
+        }
+
+        switch(cmd & 0b11110000){
+            case AND:
+                fprintf(out, "    r[%d] &= r[%d];\n", b, a);
+                break;
+            case OR:
+                fprintf(out, "    r[%d] |= r[%d];\n", b, a);
+                break;
+            case XOR:
+                fprintf(out, "    r[%d] ^= r[%d];\n", b, a);
+                break;
+            case ADD:
+                fprintf(out, "    r[%d] += r[%d];\n", b, a);
+                break;
+            case SUB:
+                fprintf(out, "    r[%d] -= r[%d];\n", b, a);
+                break;
+            case NOTB:
+                fprintf(out, "    r[%d] = ~r[%d];\n", b, b);
+                break;
+            case SHIFTB:
+                fprintf(out, "    r[%d] >>= 1;\n", b);
+                break;
+            case LSHIFTB:
+                fprintf(out, "    r[%d] <<= 1;\n", b);
+                break;
+            case LOAD:
+                writeHit(out, t, pc + 1);
+                fprintf(out, "    r[%d] = ram[0x%02x];\n", b, operand);
+                writeHit(out, t, pc + 1);
+                break;
+            case WRT:
+                writeHit(out, t, pc + 1);
+                if(t->covered[operand]){
+                    fprintf(out, "    store(0x%02x, r[%d]);\n", operand, b);
+                }
+                else{
+                    fprintf(out, "    ram[0x%02x] = r[%d];\n", operand, b);
+                }
+                writeHit(out, t, pc + 1);
+                break;
+            case JMPZ:
+                writeHit(out, t, pc + 1);
+                fprintf(out, "    if(r[%d] == 0){\n", b);
+                fprintf(out, "        cycles += %d;\n", cycles - cycleCost[op] + JMPZ_TAKEN_COST);
+                fprintf(out, "        pc = ram[0x%02x];\n        goto dispatch;\n    }\n", operand);
+                writeHit(out, t, pc + 1);
+                break;
+            case JMP:
+                writeHit(out, t, pc + 1);
+                fprintf(out, "    cycles += %d;\n", cycles);
+                fprintf(out, "    pc = ram[0x%02x];\n    goto dispatch;\n\n", operand);
+                return;
+            case LOADL:
+                fprintf(out, "    r[%d] = ram[r[%d]];\n", b, a);
+                break;
+            case WRTL:
+                fprintf(out, "    address = r[%d];\n    store(address, r[%d]);\n", a, b);
+                if(!ends){                          // the print pass below still counts when leaving early
+                    fprintf(out, "    if(covered[address]){\n%s        cycles += %d;\n",
+                            (uint8_t)next == t->printAddr ? "        hit();\n" : "", cycles);
+                    fprintf(out, "        pc = 0x%02x;\n        goto dispatch;\n    }\n", next);
+                }
+                break;
+            case HALT:
+                writeHit(out, t, pc + 1);
+                fprintf(out, "    cycles += %d;\n    goto halted;\n\n", cycles);
+                return;
+            case TAS:
+                writeHit(out, t, pc + 1);
+                if(isTas(cmd)){
+                    fprintf(out, "    r[%d] = ram[0x%02x];\n", b, operand);
+                    fprintf(out, t->covered[operand] ? "    store(0x%02x, 1);\n" : "    ram[0x%02x] = 1;\n", operand);
+                }
+                else if((cmd & 0b11111100) == MUL){
+                    cycles += MUL_COST - cycleCost[op];
+                    fprintf(out, "    r[%d] *= ram[0x%02x];\n", b, operand);
+                }
+                else if((cmd & 0b11111100) == POPC){
+                    fprintf(out, "    r[%d] = __builtin_popcount(ram[0x%02x]);\n", b, operand);
+                }
+                else{
+                    fprintf(out, "    r[%d] = bsum(r[%d], ram[0x%02x], &cycles);\n", b, b, operand);
+                }
+                writeHit(out, t, pc + 1);
+                break;
+        }
+        if(instructionLength(cmd >> 4) > 1){
+            writeHit(out, t, pc + 2);
+        }
+        else{
+            writeHit(out, t, pc + 1);
+        }
+        if(ends){
+            fprintf(out, "    cycles += %d;\n", cycles);
+            if(next < MAX_VALUES && t->leader[next] && t->code[next]){
+                fprintf(out, "    pc = 0x%02x;\n    if(cycles < budget){\n        goto b%02x;\n    }\n    goto stopped;\n\n",
+                        next, next);
+            }
+            else{
+                fprintf(out, "    pc = 0x%02x;\n    goto dispatch;\n\n", (uint8_t)next);
+            }
+            return;
+        }
+        pc = next;
+    }
+}
+
+// Everything in the generated file but the blocks: RAM, the fallback interpreter, the display and main()
+static const char *const runtimeHead =
+    "static int dirty;              // covered bytes that no longer hold what was translated\n"
+    "static uint64_t loops;\n"
+    "static int grid;\n"
+    "\n"
+    "// The Game of Life grid, in the emulator's piped layout\n"
+    "static void printGrid(void){\n"
+    "    if(DISPLAY_START + DISPLAY_WIDTH * DISPLAY_HEIGHT > 256){\n"
+    "        return;\n"
+    "    }\n"
+    "    printf(\"-----------------------------\\n\");\n"
+    "    for(int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++){\n"
+    "        fputs(ram[DISPLAY_START + i] == 1 ? \"\\u2593\" : \"\\u2591\", stdout);\n"
+    "        if((i + 1) % DISPLAY_WIDTH == 0){\n"
+    "            putchar('\\n');\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "// The program counter reached the print address\n"
+    "static inline void hit(void){\n"
+    "    loops++;\n"
+    "    if(grid){\n"
+    "        printGrid();\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void store(uint8_t addr, uint8_t value){\n"
+    "    if(covered[addr]){\n"
+    "        dirty += (value != original[addr]) - (ram[addr] != original[addr]);\n"
+    "    }\n"
+    "    ram[addr] = value;\n"
+    "}\n"
+    "\n"
+    "static uint8_t bsum(uint8_t from, uint8_t count, uint64_t *cycles){\n"
+    "    uint8_t sum = 0;\n"
+    "    for(int i = 0; i < count; i++){\n"
+    "        sum += ram[(uint8_t)(from + i)];\n"
+    "    }\n"
+    "    *cycles += BSUM_BYTE_COST * count;\n"
+    "    return sum;\n"
+    "}\n"
+    "\n"
+    "#define INC(next) do { if((uint8_t)(next) == PRINT_ADDR){ hit(); } } while(0)\n"
+    "\n"
+    "// One instruction the way the emulator's instruction-level engine runs it, for code that was not\n"
+    "// translated or no longer holds what was. Returns the next program counter.\n"
+    "static uint8_t interpret(uint8_t pc, uint8_t *r, uint64_t *cycles, int *halted){\n"
+    "    uint8_t cmd = ram[pc];\n"
+    "    uint8_t b = cmd & 3, a = (cmd >> 2) & 3;\n"
+    "    uint8_t operand = ram[(uint8_t)(pc + 1)];\n"
+    "    *cycles += cycleCost[cmd >> 4];\n"
+    "    switch(cmd >> 4){\n"
+    "        case 0: r[b] &= r[a]; break;\n"
+    "        case 1: r[b] |= r[a]; break;\n"
+    "        case 2: r[b] ^= r[a]; break;\n"
+    "        case 3: r[b] += r[a]; break;\n"
+    "        case 4: r[b] -= r[a]; break;\n"
+    "        case 5: r[b] = ~r[b]; break;\n"
+    "        case 6: r[b] >>= 1; break;\n"
+    "        case 7: r[b] <<= 1; break;\n"
+    "        case 8:\n"
+    "            INC(pc + 1);\n"
+    "            r[b] = ram[operand];\n"
+    "            INC(pc + 1);\n"
+    "            INC(pc + 2);\n"
+    "            return pc + 2;\n"
+    "        case 9:\n"
+    "            INC(pc + 1);\n"
+    "            store(operand, r[b]);\n"
+    "            INC(pc + 1);\n"
+    "            INC(pc + 2);\n"
+    "            return pc + 2;\n"
+    "        case 10:\n"
+    "            INC(pc + 1);\n"
+    "            if(r[b] == 0){\n"
+    "                *cycles += JMPZ_TAKEN_COST - cycleCost[10];\n"
+    "                return ram[operand];\n"
+    "            }\n"
+    "            INC(pc + 1);\n"
+    "            INC(pc + 2);\n"
+    "            return pc + 2;\n"
+    "        case 11:\n"
+    "            INC(pc + 1);\n"
+    "            return ram[operand];\n"
+    "        case 12: r[b] = ram[r[a]]; break;\n"
+    "        case 13: store(r[a], r[b]); break;\n"
+    "        case 14:\n"
+    "            INC(pc + 1);\n"
+    "            if(a == 0){\n"
+    "                r[b] = ram[operand];\n"
+    "                store(operand, 1);\n"
+    "            }\n"
+    "            else if(a == 1){\n"
+    "                *cycles += MUL_COST - cycleCost[14];\n"
+    "                r[b] *= ram[operand];\n"
+    "            }\n"
+    "            else if(a == 2){\n"
+    "                r[b] = __builtin_popcount(ram[operand]);\n"
+    "            }\n"
+    "            else{\n"
+    "                r[b] = bsum(r[b], ram[operand], cycles);\n"
+    "            }\n"
+    "            INC(pc + 1);\n"
+    "            INC(pc + 2);\n"
+    "            return pc + 2;\n"
+    "        default:\n"
+    "            INC(pc + 1);\n"
+    "            *halted = 1;\n"
+    "            return operand;\n"
+    "    }\n"
+    "    INC(pc + 1);\n"
+    "    return pc + 1;\n"
+    "}\n"
+    "\n"
+    "// Runs to HALT, or to the first block exit at or past budget posEdges. Returns 1 if the program halted.\n"
+    "static int run(uint64_t budget, uint64_t *cyclesOut){\n"
+    "    uint8_t r[4] = {0, 0, 0, 0};\n"
+    "    uint64_t cycles = 0;\n"
+    "    uint8_t pc = ENTRY;\n"
+    "    uint8_t address;\n"
+    "    int halt = 0;\n"
+    "    (void)address;\n"
+    "\n"
+    "dispatch:\n"
+    "    if(cycles >= budget){\n"
+    "        goto stopped;\n"
+    "    }\n"
+    "    switch(pc){\n";
+
+static const char *const runtimeTail =
+    "interpret:\n"
+    "    pc = interpret(pc, r, &cycles, &halt);\n"
+    "    if(halt){\n"
+    "        goto halted;\n"
+    "    }\n"
+    "    goto dispatch;\n"
+    "\n"
+    "halted:\n"
+    "    *cyclesOut = cycles;\n"
+    "    return 1;\n"
+    "stopped:\n"
+    "    *cyclesOut = cycles;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char *argv[]){\n"
+    "    // \"--grid\" prints the display region at every print pass, \"--ram\" the final RAM, \"--budget CYCLES\"\n"
+    "    // stops a program that does not halt\n"
+    "    uint64_t budget = UINT64_MAX;\n"
+    "    int dumpRam = 0;\n"
+    "    for(int i = 1; i < argc; i++){\n"
+    "        if(!strcmp(argv[i], \"--grid\")){\n"
+    "            grid = 1;\n"
+    "        }\n"
+    "        else if(!strcmp(argv[i], \"--ram\")){\n"
+    "            dumpRam = 1;\n"
+    "        }\n"
+    "        else if(i + 1 < argc && !strcmp(argv[i], \"--budget\")){\n"
+    "            budget = strtoull(argv[++i], NULL, 10);\n"
+    "        }\n"
+    "        else{\n"
+    "            printf(\"Unknown option %s (expected --grid, --ram or --budget)\\n\", argv[i]);\n"
+    "            return 1;\n"
+    "        }\n"
+    "    }\n"
+    "    uint64_t cycles;\n"
+    "    struct timespec start, end;\n"
+    "    clock_gettime(CLOCK_MONOTONIC, &start);\n"
+    "    int halted = run(budget, &cycles);\n"
+    "    clock_gettime(CLOCK_MONOTONIC, &end);\n"
+    "    printf(\"\\nPROGRAM %s\\n\", halted ? \"HALTED\" : \"STOPPED\");\n"
+    "    printf(\"\\nProgram iterated %llu times over %llu clock cycles in %f seconds.\\n\", (unsigned long long)loops,\n"
+    "           (unsigned long long)cycles, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);\n"
+    "    if(dumpRam){\n"
+    "        printf(\"\\nRAM:\\n\");\n"
+    "        for(int i = 0; i < 256; i++){\n"
+    "            printf(\"%02x%c\", ram[i], i % 16 == 15 ? '\\n' : ' ');\n"
+    "        }\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n";
+
+int gibcpuWriteC(const char *filename, const GibCPUAssembly *assembly){
+    if(assembly->info.flags & GIBCPU_IMAGE_HAS_BANKS){
+        fprintf(stderr, "%s: programs with banks cannot be translated\n", filename);
+        return 1;
+    }
+    Translation *t = calloc(1, sizeof(Translation));
+    if(!t){
+        return 1;
+    }
+    uint8_t ram[MAX_VALUES] = {0};
+    memcpy(ram, assembly->image, assembly->length < MAX_VALUES ? assembly->length : MAX_VALUES);
+    t->ram = ram;
+    t->printAddr = assembly->info.flags & GIBCPU_IMAGE_HAS_PRINT_ADDR ? assembly->info.printAddr : GIBCPU_DEFAULT_PRINT_ADDR;
+    uint8_t entry = assembly->info.entry;
+    cutBlocks(t, entry, assembly);
+
+    FILE *out = fopen(filename, "w");
+    if(!out){
+        perror("Error opening file");
+        free(t);
+        return 1;
+    }
+    int displayStart = GIBCPU_DEFAULT_DISPLAY_START;
+    int displayWidth = GIBCPU_DEFAULT_DISPLAY_WIDTH;
+    int displayHeight = GIBCPU_DEFAULT_DISPLAY_HEIGHT;
+    if(assembly->info.flags & GIBCPU_IMAGE_HAS_DISPLAY){
+        displayStart = assembly->info.displayStart;
+        displayWidth = assembly->info.displayWidth ? assembly->info.displayWidth : displayWidth;
+        displayHeight = assembly->info.displayHeight ? assembly->info.displayHeight : displayHeight;
+    }
+    fprintf(out, "// GIBCPU program translated ahead of time by gibcpuWriteC(). Build it with \"cc -O2\": it runs to HALT\n"
+                 "// with the clock cycle and print pass counts of the emulator. Code bytes the program overwrites run\n"
+                 "// on the interpreter at the end of the file until they hold what was translated again.\n\n");
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <stdint.h>\n#include <string.h>\n#include <time.h>\n\n");
+    fprintf(out, "#define ENTRY 0x%02x\n#define PRINT_ADDR 0x%02x\n", entry, t->printAddr);
+    fprintf(out, "#define DISPLAY_START %d\n#define DISPLAY_WIDTH %d\n#define DISPLAY_HEIGHT %d\n\n",
+            displayStart, displayWidth, displayHeight);
+    writeBytes(out, "static uint8_t ram[256]", ram);
+    writeBytes(out, "static const uint8_t original[256]", ram);
+    writeBytes(out, "// bytes the blocks below were translated from\nstatic const uint8_t covered[256]", t->covered);
+    fprintf(out, "static const uint8_t cycleCost[16] = {");
+    for(int op = 0; op < 16; op++){
+        fprintf(out, "%d%s", cycleCost[op], op < 15 ? ", " : "};\n");
+    }
+    fprintf(out, "#define JMPZ_TAKEN_COST %d\n#define MUL_COST %d\n#define BSUM_BYTE_COST %d\n\n",
+            JMPZ_TAKEN_COST, MUL_COST, BSUM_BYTE_COST);
+    fputs(runtimeHead, out);
+    for(int pc = 0; pc < MAX_VALUES; pc++){
+        if(t->leader[pc] && t->code[pc]){
+            fprintf(out, "        case 0x%02x: goto b%02x;\n", pc, pc);
+            t->blocks++;
+        }
+    }
+    fprintf(out, "        default: goto interpret;\n    }\n\n");
+    for(int pc = 0; pc < MAX_VALUES; pc++){
+        if(t->leader[pc] && t->code[pc]){
+            writeBlock(out, t, pc);
+        }
+    }
+    fputs(runtimeTail, out);
+    int failed = fclose(out) != 0;
+    free(t);
+    return failed;
+}
@@ -0,0 +1,780 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "GIBCPU_Internal.h"
+
+/* ASSEMBLER */
+
+#define MAX_WORDS 3
+#define MAX_STATEMENTS (MAX_VALUES + GIBCPU_EXTENDED_SIZE)
+#define HOME -1                     // Statement.bank outside any bank
+#define MNEMONIC_SLOTS 64           // power of two, at least twice the mnemonic count
+#define SLOT(kind, index) ((kind) == '$' ? (index) : MAX_VALUES + (index))   // $variables, then #locations
+#define UNKNOWN -1
+
+// Operand layout of each mnemonic
+enum {
+    FORMAT_NONE,                    // halt
+    FORMAT_B,                       // notb rB
+    FORMAT_AB,                      // add rA rB, loadl rA rB
+    FORMAT_B_REF,                   // load rB $var, wrt rB $var, jmpz rB #location, mul rB $var: two bytes
+    FORMAT_REF                      // jmp #location: two bytes
+};
+
+typedef struct {
+    const char *name;
+    uint8_t opcode;
+    uint8_t format;
+} Mnemonic;
+
+static const Mnemonic mnemonics[] = {
+    {"and", AND, FORMAT_AB},
+    {"or", OR, FORMAT_AB},
+    {"xor", XOR, FORMAT_AB},
+    {"add", ADD, FORMAT_AB},
+    {"sub", SUB, FORMAT_AB},
+    {"notb", NOTB, FORMAT_B},
+    {"shiftb", SHIFTB, FORMAT_B},
+    {"lshiftb", LSHIFTB, FORMAT_B},
+    {"load", LOAD, FORMAT_B_REF},
+    {"wrt", WRT, FORMAT_B_REF},
+    {"jmpz", JMPZ, FORMAT_B_REF},
+    {"jmp", JMP, FORMAT_REF},
+    {"loadl", LOADL, FORMAT_AB},
+    {"wrtl", WRTL, FORMAT_AB},
+    {"tas", TAS, FORMAT_B_REF},
+    {"mul", MUL, FORMAT_B_REF},
+    {"popc", POPC, FORMAT_B_REF},
+    {"bsum", BSUM, FORMAT_B_REF},
+    {"halt", HALT, FORMAT_NONE}
+};
+
+// Open-addressed mnemonic index, built once for every thread
+static const Mnemonic *mnemonicTable[MNEMONIC_SLOTS];
+static pthread_once_t mnemonicTableOnce = PTHREAD_ONCE_INIT;
+
+// A word of a source line, pointing into the source buffer
+typedef struct {
+    const char *text;
+    size_t length;
+} Token;
+
+// One instruction or value, in source order
+typedef struct {
+    Token word[MAX_WORDS];
+    int line;
+    uint8_t addr;
+    int bank;                       // HOME, or the bank whose window addr is in
+    int size;                       // bytes of RAM
+    const Mnemonic *mnemonic;       // NULL for a $variable or #location value or a .fill
+    uint8_t a, b;                   // registers
+    char kind;                      // '$' or '#': the value defined, or a two-byte instruction's operand.
+                                    // '.' for a .fill
+    int index;                      // its number
+    int value;                      // initial value of a $variable / #location, the .fill byte
+    uint8_t removed;                // dropped by the optimizer
+} Statement;
+
+static uint32_t hashWord(const char *text, size_t length){
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++){
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void buildMnemonicTable(void){
+    for(size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); i++){
+        uint32_t slot = hashWord(mnemonics[i].name, strlen(mnemonics[i].name)) & (MNEMONIC_SLOTS - 1);
+        while(mnemonicTable[slot]){
+            slot = (slot + 1) & (MNEMONIC_SLOTS - 1);
+        }
+        mnemonicTable[slot] = &mnemonics[i];
+    }
+}
+
+static const Mnemonic *findMnemonic(Token word){
+    uint32_t slot = hashWord(word.text, word.length) & (MNEMONIC_SLOTS - 1);
+    while(mnemonicTable[slot]){
+        const Mnemonic *m = mnemonicTable[slot];
+        if(strlen(m->name) == word.length && !memcmp(m->name, word.text, word.length)){
+            return m;
+        }
+        slot = (slot + 1) & (MNEMONIC_SLOTS - 1);
+    }
+    return NULL;
+}
+
+// Leading decimal digits, as the original stringToInt() read them. -1 if there are none or they overflow.
+static int parseNumber(const char *text, size_t length){
+    int value = 0;
+    size_t i = 0;
+    while(i < length && isdigit((unsigned char)text[i])){
+        value = value * 10 + (text[i] - '0');
+        if(value > 0xFFFF){
+            return -1;
+        }
+        i++;
+    }
+    return i ? value : -1;
+}
+
+static int tokenIs(Token word, const char *text){
+    return word.length == strlen(text) && !memcmp(word.text, text, word.length);
+}
+
+static int fail(GibCPUAssembly *out, int line, const char *message, Token word){
+    out->errorLine = line;
+    snprintf(out->error, sizeof(out->error), "%s %.*s", message, (int)word.length, word.text ? word.text : "");
+    return 1;
+}
+
+// "r0" to "r3"
+static int parseRegister(Token word){
+    if(word.length != 2 || word.text[0] != 'r' || word.text[1] < '0' || word.text[1] > '3'){
+        return -1;
+    }
+    return word.text[1] - '0';
+}
+
+// Image header directives: ".entry ADDR", ".print ADDR", ".display ADDR" and ".grid WIDTH HEIGHT", and
+// ".bank N", which places what follows in bank N. They take no space in RAM and do not count as
+// instructions, so location numbers are unaffected. The .display address is extended (gibcpuReadExtended()).
+static int readDirective(const Token *word, int line, int *bank, GibCPUAssembly *out){
+    GibCPUImageInfo *info = &out->info;
+    int first = parseNumber(word[1].text, word[1].length);
+    int second = parseNumber(word[2].text, word[2].length);
+    int grid = tokenIs(word[0], ".grid");
+    int display = tokenIs(word[0], ".display");
+    int banks = tokenIs(word[0], ".bank");
+    int limit = display ? GIBCPU_MEMORY_SIZE + GIBCPU_EXTENDED_SIZE - 1 : banks ? GIBCPU_MAX_BANKS - 1 : 0xFF;
+    if(first < 0 || first > limit || (grid && (second < 0 || second > 0xFF))){
+        return fail(out, line, "bad argument for", word[0]);
+    }
+    if(tokenIs(word[0], ".entry")){
+        info->entry = first;
+    }
+    else if(tokenIs(word[0], ".print")){
+        info->printAddr = first;
+        info->flags |= GIBCPU_IMAGE_HAS_PRINT_ADDR;
+    }
+    else if(display){
+        info->displayStart = first;
+        info->flags |= GIBCPU_IMAGE_HAS_DISPLAY;
+    }
+    else if(banks){
+        *bank = first;
+        info->bankCount = first + 1 > info->bankCount ? first + 1 : info->bankCount;
+        info->flags |= GIBCPU_IMAGE_HAS_BANKS;
+    }
+    else if(grid){
+        info->displayWidth = first;
+        info->displayHeight = second;
+        info->flags |= GIBCPU_IMAGE_HAS_DISPLAY;
+    }
+    else{
+        return fail(out, line, "unknown directive", word[0]);
+    }
+    return 0;
+}
+
+// Split the source into statements. Returns the statement count, or -1 on error.
+static int tokenize(const char *source, size_t length, Statement *statements, GibCPUAssembly *out){
+    int count = 0;
+    int line = 0;
+    int bank = HOME;
+    size_t pos = 0;
+    while(pos < length){
+        line++;
+        Token word[MAX_WORDS] = {{0}};
+        int words = 0;
+        while(pos < length && source[pos] != '\n'){
+            if(source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\r'){
+                pos++;
+                continue;
+            }
+            size_t start = pos;
+            while(pos < length && source[pos] != '\n' && source[pos] != ' ' && source[pos] != '\t' && source[pos] != '\r'){
+                pos++;
+            }
+            if(words < MAX_WORDS){                  // further words are ignored
+                word[words].text = source + start;
+                word[words].length = pos - start;
+                words++;
+            }
+        }
+        pos++;
+
+        if(words == 0){
+            continue;
+        }
+        if(word[0].text[0] == '.' && !tokenIs(word[0], ".fill")){
+            if(readDirective(word, line, &bank, out)){
+                return -1;
+            }
+            continue;
+        }
+        if(count == MAX_STATEMENTS){
+            fail(out, line, "program does not fit in RAM at", word[0]);
+            return -1;
+        }
+        Statement *s = &statements[count++];
+        memcpy(s->word, word, sizeof(word));
+        s->line = line;
+        s->bank = bank;
+    }
+    return count;
+}
+
+// Check one statement and read its size and value, or its mnemonic and registers. ".fill COUNT VALUE"
+// is COUNT bytes of VALUE with no name. Operands are read by readOperand().
+static int resolveStatement(Statement *s, GibCPUAssembly *out){
+    char kind = s->word[0].text[0];
+    s->size = 1;
+    if(kind == '.'){
+        s->kind = kind;
+        s->size = parseNumber(s->word[1].text, s->word[1].length);
+        s->value = s->word[2].text ? parseNumber(s->word[2].text, s->word[2].length) : 0;
+        if(s->size < 1 || s->size > MAX_VALUES || s->value < 0){
+            return fail(out, s->line, "bad value", s->word[0]);
+        }
+        return 0;
+    }
+    if(kind == '$' || kind == '#'){
+        s->kind = kind;
+        s->index = parseNumber(s->word[0].text + 1, s->word[0].length - 1);
+        s->value = s->word[1].text ? parseNumber(s->word[1].text, s->word[1].length) : 0;
+        if(s->index < 0 || s->index >= MAX_VALUES || s->value < 0){
+            return fail(out, s->line, "bad value", s->word[0]);
+        }
+        return 0;
+    }
+    s->mnemonic = findMnemonic(s->word[0]);
+    if(!s->mnemonic){
+        return fail(out, s->line, "unknown instruction", s->word[0]);
+    }
+    s->size = s->mnemonic->format >= FORMAT_B_REF ? 2 : 1;
+    return 0;
+}
+
+static int readRegisters(Statement *s, GibCPUAssembly *out){
+    int a = 0;
+    int b = 0;
+    switch(s->mnemonic->format){
+        case FORMAT_AB:
+            a = parseRegister(s->word[1]);
+            b = parseRegister(s->word[2]);
+            break;
+        case FORMAT_B:
+        case FORMAT_B_REF:
+            b = parseRegister(s->word[1]);
+            break;
+        default:
+            break;
+    }
+    if(a < 0 || b < 0){
+        return fail(out, s->line, "bad register in", s->word[0]);
+    }
+    s->a = a;
+    s->b = b;
+    return 0;
+}
+
+// The $variable or #location operand of a two-byte instruction, which must be defined somewhere
+static int readOperand(Statement *s, const int *definedAt, GibCPUAssembly *out){
+    Token ref = s->word[s->mnemonic->format == FORMAT_REF ? 1 : 2];
+    int index = ref.text ? parseNumber(ref.text + 1, ref.length - 1) : -1;
+    if(index < 0 || index >= MAX_VALUES || (ref.text[0] != '$' && ref.text[0] != '#')){
+        return fail(out, s->line, "bad operand for", s->word[0]);
+    }
+    s->kind = ref.text[0];
+    s->index = index;
+    if(definedAt[SLOT(s->kind, index)] < 0){
+        return fail(out, s->line, "undefined", ref);
+    }
+    return 0;
+}
+
+// Where a statement's first byte goes in GibCPUAssembly.image: RAM, or its bank after RAM
+static uint8_t *statementBytes(const Statement *s, GibCPUAssembly *out){
+    if(s->bank == HOME){
+        return out->image + s->addr;
+    }
+    return out->image + MAX_VALUES + s->bank * GIBCPU_BANK_SIZE + (s->addr - GIBCPU_BANK_WINDOW);
+}
+
+// Lay out and encode every statement the optimizer kept: RAM from address 0, each bank from the window.
+// A #location holds an instruction number, which becomes that statement's address the first time the
+// location is used; locations used only by removed instructions are still adjusted, so pointers kept in
+// them stay valid. Returns the bytes of RAM used.
+static size_t emitImage(Statement *statements, int count, GibCPUAssembly *out){
+    uint8_t *slotByte[2 * MAX_VALUES];
+    int slotAddr[2 * MAX_VALUES];
+    int keptAddr[MAX_STATEMENTS];
+    int bankAddr[GIBCPU_MAX_BANKS];
+    int addr = 0;
+    int memops = 0;
+    int kept = 0;
+    for(int b = 0; b < GIBCPU_MAX_BANKS; b++){
+        bankAddr[b] = GIBCPU_BANK_WINDOW;
+    }
+    for(int i = 0; i < count; i++){
+        Statement *s = &statements[i];
+        if(s->removed){
+            continue;
+        }
+        int *at = s->bank == HOME ? &addr : &bankAddr[s->bank];
+        s->addr = *at;
+        *at += s->size;
+        keptAddr[kept++] = s->addr;
+        memops += s->size - 1;
+        uint8_t *bytes = statementBytes(s, out);
+        if(s->bank == HOME){
+            for(int k = 0; k < s->size; k++){
+                out->line[s->addr + k] = s->line;
+            }
+        }
+        if(s->mnemonic){
+            bytes[0] = s->mnemonic->opcode | (s->a << 2) | s->b;
+        }
+        else if(s->kind == '.'){
+            memset(bytes, s->value, s->size);
+        }
+        else{
+            bytes[0] = s->value;
+            slotByte[SLOT(s->kind, s->index)] = bytes;
+            slotAddr[SLOT(s->kind, s->index)] = s->addr;
+            if(out->symbolCount < MAX_VALUES){
+                GibCPUSymbol *symbol = &out->symbols[out->symbolCount++];
+                snprintf(symbol->name, sizeof(symbol->name), "%.*s", (int)s->word[0].length, s->word[0].text);
+                symbol->addr = s->addr;
+            }
+        }
+    }
+
+    uint8_t locationAdjusted[MAX_VALUES] = {0};
+    for(int i = 0; i < count; i++){
+        Statement *s = &statements[i];
+        if(!s->mnemonic || s->mnemonic->format < FORMAT_B_REF){
+            continue;
+        }
+        int slot = SLOT(s->kind, s->index);
+        if(!s->removed){
+            statementBytes(s, out)[1] = slotAddr[slot];
+        }
+        if(s->kind == '#' && !locationAdjusted[s->index]){
+            int instruction = *slotByte[slot];
+            *slotByte[slot] = instruction < kept ? keptAddr[instruction] : instruction + memops;
+            locationAdjusted[s->index] = 1;
+        }
+    }
+    return addr;
+}
+
+/* OPTIMIZER */
+
+// Registers whose value is known to equal a $variable or #location in RAM, at one instruction
+typedef struct {
+    int16_t reg[4];                 // SLOT() of the RAM value held, or UNKNOWN
+    uint8_t reached;
+} Knowledge;
+
+// Statement a jmp / jmpz goes to, -1 if that cannot be known before running
+static int jumpTarget(const Statement *statements, int count, const int *definedAt, const Statement *s){
+    if(s->kind != '#'){
+        return -1;
+    }
+    int target = statements[definedAt[SLOT('#', s->index)]].value & 0xFF;
+    return target < count && statements[target].mnemonic ? target : -1;
+}
+
+// Statement occupying an address in the unoptimized layout, -1 past the end
+static int statementAt(const Statement *statements, int count, int addr){
+    for(int i = 0; i < count; i++){
+        if(addr >= statements[i].addr && addr < statements[i].addr + statements[i].size){
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Effect of one instruction on what the registers hold
+static void transfer(const Statement *s, Knowledge *k){
+    int slot = SLOT(s->kind, s->index);
+    switch(s->mnemonic->opcode){
+        case LOAD:
+            k->reg[s->b] = slot;
+            break;
+        case WRT:
+            if(k->reg[s->b] != slot){
+                for(int r = 0; r < 4; r++){
+                    k->reg[r] = k->reg[r] == slot ? UNKNOWN : k->reg[r];
+                }
+                k->reg[s->b] = slot;
+            }
+            break;
+        case WRTL:                  // could write any address
+            for(int r = 0; r < 4; r++){
+                k->reg[r] = UNKNOWN;
+            }
+            break;
+        case JMPZ:
+        case JMP:
+        case HALT:
+            break;
+        default:                    // ALU ops and loadl write rB
+            k->reg[s->b] = UNKNOWN;
+            break;
+    }
+}
+
+// Fold what a predecessor knows into an instruction. Returns 1 if that changed anything.
+static int merge(Knowledge *into, const Knowledge *from){
+    if(!into->reached){
+        *into = *from;
+        return 1;
+    }
+    int changed = 0;
+    for(int r = 0; r < 4; r++){
+        if(into->reg[r] != UNKNOWN && into->reg[r] != from->reg[r]){
+            into->reg[r] = UNKNOWN;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+// A store is dead when the same slot is written again further down the straight-line code with nothing
+// in between that could read it: no load, mul or popc of it, no loadl or bsum, no branch and no pinned statement
+static int deadStore(const Statement *statements, int count, const uint8_t *pinned, int i){
+    int slot = SLOT(statements[i].kind, statements[i].index);
+    for(int j = i + 1; j < count && statements[j].mnemonic; j++){
+        const Statement *s = &statements[j];
+        if(s->removed){
+            continue;
+        }
+        if(pinned[j]){
+            return 0;
+        }
+        switch(s->mnemonic->opcode){
+            case LOAD:
+            case MUL:
+            case POPC:
+                if(SLOT(s->kind, s->index) == slot){
+                    return 0;
+                }
+                break;
+            case WRT:
+                if(SLOT(s->kind, s->index) == slot){
+                    return 1;
+                }
+                break;
+            case LOADL:
+            case BSUM:
+            case JMPZ:
+            case JMP:
+            case HALT:
+                return 0;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+// Give up on optimizing, saying why
+static void keepProgram(GibCPUAssembly *out, int line, const char *message){
+    snprintf(out->note, sizeof(out->note), "line %d: %s", line, message);
+}
+
+// Remove loads of a value a register already holds, stores of a value RAM already holds and stores
+// overwritten before anything reads them, then renumber #locations and move the directive addresses to
+// follow the code. Register contents are tracked across basic blocks by a forward dataflow pass over the
+// control flow graph. A program that writes a #location it jumps through computes code addresses at run
+// time, which moving code would break, so it is left alone with a note. The instruction at the print
+// address and the one before it are never removed, so the display sees the same passes. Assumes loadl,
+// wrtl and bsum only point into $variable / #location data, never at code or jump slots.
+static void optimize(Statement *statements, int count, const int *definedAt, GibCPUAssembly *out){
+    GibCPUImageInfo *info = &out->info;
+    if(info->bankCount){
+        keepProgram(out, 0, "banked program");
+        return;
+    }
+    int entry = statementAt(statements, count, info->entry);
+    if(entry < 0 || statements[entry].addr != info->entry || !statements[entry].mnemonic){
+        keepProgram(out, 0, "entry point is not an instruction");
+        return;
+    }
+
+    // moving code is only safe when every jump target is known before running
+    uint8_t jumpSlot[2 * MAX_VALUES] = {0};
+    for(int i = 0; i < count; i++){
+        const Statement *s = &statements[i];
+        if(!s->mnemonic){
+            continue;
+        }
+        uint8_t op = s->mnemonic->opcode;
+        if(op == TAS){
+            keepProgram(out, s->line, "synchronizes through tas");     // other cores read and write the RAM
+            return;
+        }
+        if((op == JMP || op == JMPZ) && jumpTarget(statements, count, definedAt, s) < 0){
+            keepProgram(out, s->line, "jump target not an instruction");
+            return;
+        }
+        if(op == JMP || op == JMPZ){
+            jumpSlot[SLOT(s->kind, s->index)] = 1;
+        }
+        if(op != JMP && op != HALT && (i + 1 == count || !statements[i + 1].mnemonic)){
+            keepProgram(out, s->line, "runs on into data");
+            return;
+        }
+    }
+    for(int i = 0; i < count; i++){
+        const Statement *s = &statements[i];
+        if(s->mnemonic && s->mnemonic->opcode == WRT && jumpSlot[SLOT(s->kind, s->index)]){
+            keepProgram(out, s->line, "writes a jump #location");
+            return;
+        }
+    }
+
+    uint8_t pinned[MAX_VALUES] = {0};
+    int printAddr = info->flags & GIBCPU_IMAGE_HAS_PRINT_ADDR ? info->printAddr : GIBCPU_DEFAULT_PRINT_ADDR;
+    int print = statementAt(statements, count, printAddr);
+    if(print >= 0){
+        pinned[print] = 1;
+        pinned[print > 0 ? print - 1 : 0] = 1;
+    }
+
+    // forward dataflow to a fixed point
+    Knowledge known[MAX_VALUES];
+    memset(known, 0, sizeof(known));
+    int work[MAX_VALUES];
+    uint8_t queued[MAX_VALUES] = {0};
+    int pending = 0;
+    Knowledge nothing = {{UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN}, 1};
+    for(int i = 0; i < count; i++){
+        int start = i == entry || (i > 0 && !statements[i - 1].mnemonic);
+        if(statements[i].mnemonic && start){
+            known[i] = nothing;
+            work[pending++] = i;
+            queued[i] = 1;
+        }
+    }
+    while(pending){
+        int i = work[--pending];
+        queued[i] = 0;
+        const Statement *s = &statements[i];
+        Knowledge after = known[i];
+        transfer(s, &after);
+        int next[2];
+        int successors = 0;
+        uint8_t op = s->mnemonic->opcode;
+        if(op == JMP || op == JMPZ){
+            int target = jumpTarget(statements, count, definedAt, s);
+            if(target >= 0){
+                next[successors++] = target;
+            }
+        }
+        if(op != JMP && op != HALT){
+            next[successors++] = i + 1;
+        }
+        for(int k = 0; k < successors; k++){
+            if(merge(&known[next[k]], &after) && !queued[next[k]]){
+                work[pending++] = next[k];
+                queued[next[k]] = 1;
+            }
+        }
+    }
+
+    for(int i = 0; i < count; i++){
+        Statement *s = &statements[i];
+        if(!s->mnemonic || pinned[i] || !known[i].reached){
+            continue;
+        }
+        uint8_t op = s->mnemonic->opcode;
+        if((op == LOAD || op == WRT) && known[i].reg[s->b] == SLOT(s->kind, s->index)){
+            s->removed = 1;
+        }
+    }
+    for(int i = 0; i < count; i++){
+        Statement *s = &statements[i];
+        if(s->mnemonic && s->mnemonic->opcode == WRT && !s->removed && !pinned[i] && known[i].reached &&
+           deadStore(statements, count, pinned, i)){
+            s->removed = 1;
+        }
+    }
+
+    // renumber: instruction numbers in #locations, addresses in the directives
+    int newIndex[MAX_VALUES + 1];
+    uint8_t newAddr[MAX_VALUES];
+    int kept = 0;
+    int addr = 0;
+    for(int i = 0; i < count; i++){
+        newIndex[i] = kept;
+        newAddr[i] = addr;
+        if(statements[i].removed){
+            out->removedLine[out->removed++] = statements[i].line;
+            out->cyclesSaved += cycleCost[statements[i].mnemonic->opcode >> 4];
+        }
+        else{
+            kept++;
+            addr += statements[i].size;
+        }
+    }
+    if(!out->removed){
+        return;
+    }
+    for(int i = 0; i < count; i++){
+        Statement *s = &statements[i];
+        if(s->kind == '#' && !s->mnemonic){
+            int instruction = s->value & 0xFF;
+            s->value = instruction < count ? newIndex[instruction] : instruction - (count - kept);
+        }
+    }
+    int oldLength = statements[count - 1].addr + statements[count - 1].size;
+    int printMoved = print >= 0 ? newAddr[print] + (printAddr - statements[print].addr) : printAddr;
+    if(printMoved != printAddr){
+        info->printAddr = printMoved;
+        info->flags |= GIBCPU_IMAGE_HAS_PRINT_ADDR;
+    }
+    int displayStart = info->flags & GIBCPU_IMAGE_HAS_DISPLAY ? info->displayStart : GIBCPU_DEFAULT_DISPLAY_START;
+    int display = displayStart < oldLength ? statementAt(statements, count, displayStart) : -1;
+    if(display >= 0 && newAddr[display] + (displayStart - statements[display].addr) != displayStart){
+        info->displayStart = newAddr[display] + (displayStart - statements[display].addr);
+        info->flags |= GIBCPU_IMAGE_HAS_DISPLAY;
+    }
+    info->entry = newAddr[entry];
+}
+
+static int assemble(const char *source, size_t length, int optimized, GibCPUAssembly *out){
+    pthread_once(&mnemonicTableOnce, buildMnemonicTable);
+    memset(out, 0, sizeof(GibCPUAssembly));
+    Statement *statements = calloc(MAX_STATEMENTS, sizeof(Statement));
+    if(!statements){
+        snprintf(out->error, sizeof(out->error), "out of memory");
+        return 1;
+    }
+    int count = tokenize(source, length, statements, out);
+    if(count < 0){
+        free(statements);
+        return 1;
+    }
+
+    // first pass: values, opcodes, registers and the unoptimized addresses. definedAt[] is the statement
+    // defining each $variable / #location.
+    int definedAt[2 * MAX_VALUES];
+    memset(definedAt, 0xFF, sizeof(definedAt));
+    // with banks, RAM ends below the bank register and every bank fills the window
+    int addr = 0;
+    int bankAddr[GIBCPU_MAX_BANKS];
+    for(int b = 0; b < GIBCPU_MAX_BANKS; b++){
+        bankAddr[b] = GIBCPU_BANK_WINDOW;
+    }
+    int homeSize = out->info.bankCount ? GIBCPU_BANK_SELECT : MAX_VALUES;
+    int failed = 0;
+    for(int i = 0; i < count && !failed; i++){
+        Statement *s = &statements[i];
+        if(resolveStatement(s, out)){
+            failed = 1;
+            break;
+        }
+        int *at = s->bank == HOME ? &addr : &bankAddr[s->bank];
+        if(s->bank != HOME && *at + s->size > MAX_VALUES){
+            failed = fail(out, s->line, "bank is full at", s->word[0]);
+            break;
+        }
+        if(s->bank == HOME && *at + s->size > homeSize){
+            failed = fail(out, s->line, out->info.bankCount ? "RAM runs into the bank register at" :
+                          "program does not fit in RAM at", s->word[0]);
+            break;
+        }
+        s->addr = *at;
+        *at += s->size;
+        if(s->mnemonic){
+            failed = readRegisters(s, out);
+        }
+        else{
+            definedAt[SLOT(s->kind, s->index)] = i;
+        }
+    }
+
+    // second pass: operands
+    for(int i = 0; i < count && !failed; i++){
+        Statement *s = &statements[i];
+        if(s->mnemonic && s->mnemonic->format >= FORMAT_B_REF){
+            failed = readOperand(s, definedAt, out);
+        }
+    }
+
+    if(!failed && optimized && count){
+        optimize(statements, count, definedAt, out);
+    }
+    out->length = failed ? 0 : emitImage(statements, count, out);
+    free(statements);
+    return failed;
+}
+
+int gibcpuAssemble(const char *source, size_t length, GibCPUAssembly *out){
+    return assemble(source, length, 0, out);
+}
+
+int gibcpuAssembleOptimized(const char *source, size_t length, GibCPUAssembly *out){
+    return assemble(source, length, 1, out);
+}
+
+size_t gibcpuLoadAssembly(GibCPU *cpu, const GibCPUAssembly *assembly){
+    return loadImageInfo(cpu, assembly->image, assembly->length, &assembly->info);
+}
+
+// Symbol map for the profiler: "line ADDR LINE SOURCE" for every RAM address an instruction or value occupies
+// (the operand byte of a two-byte instruction maps to the same line), then "symbol NAME ADDR" for every
+// $variable and #location
+int gibcpuWriteSymbolMap(const char *filename, const char *source, size_t length, const GibCPUAssembly *assembly){
+    FILE *file = fopen(filename, "w");
+    if(!file){
+        perror("Error opening file");
+        return 1;
+    }
+
+    fprintf(file, "# address, assembly line and source of every byte in the image, then the symbol addresses\n");
+    size_t pos = 0;
+    int line = 1;
+    for(size_t addr = 0; addr < assembly->length; addr++){
+        while(line < assembly->line[addr] && pos < length){     // lines only move forward with addresses
+            if(source[pos++] == '\n'){
+                line++;
+            }
+        }
+        fprintf(file, "line %zu %d", addr, assembly->line[addr]);
+        size_t end = pos;
+        while(end < length && source[end] != '\n'){
+            end++;
+        }
+        int words = 0;
+        for(size_t p = pos; p < end && words < MAX_WORDS;){     // the words assembled, single spaced
+            while(p < end && isspace((unsigned char)source[p])){
+                p++;
+            }
+            size_t start = p;
+            while(p < end && !isspace((unsigned char)source[p])){
+                p++;
+            }
+            if(p > start){
+                fprintf(file, " %.*s", (int)(p - start), source + start);
+                words++;
+            }
+        }
+        fputc('\n', file);
+    }
+    for(int i = 0; i < assembly->symbolCount; i++){
+        fprintf(file, "symbol %s %u\n", assembly->symbols[i].name, assembly->symbols[i].addr);
+    }
+
+    return fclose(file) != 0;
+}
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+/* SIMD BATCH ENGINE */
+
+// Lanes per group: one AVX2 register of bytes, or one AVX-512 register when the compiler targets AVX512BW
+#if defined(__AVX512BW__)
+#define BATCH_LANES 64
+#else
+#define BATCH_LANES 32
+#endif
+
+// Without -march the lane kernel is built once per vector extension and the host's best one is picked when the
+// library loads (GCC ifuncs), so the default build runs on AVX2 or AVX-512 where the host has them
+#if defined(__x86_64__) && defined(__linux__) && !defined(__AVX2__) && !defined(__clang__)
+#define BATCH_TARGETS __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define BATCH_TARGETS
+#endif
+
+typedef uint8_t LaneBytes __attribute__((vector_size(BATCH_LANES)));
+typedef int8_t LaneMask __attribute__((vector_size(BATCH_LANES)));
+typedef int64_t LaneCounters __attribute__((vector_size(BATCH_LANES * 8)));
+
+// Struct-of-arrays state for BATCH_LANES machines: ram[addr] holds that byte of every lane
+typedef struct {
+    LaneBytes ram[MAX_VALUES];
+    LaneBytes reg[4];
+    LaneBytes count;
+    LaneBytes printAddr;
+    uint8_t printAt[MAX_VALUES];    // nonzero where some lane has its print address
+    LaneMask halted;                // all ones once a lane has halted
+    LaneMask done;                  // all ones once a lane has halted or used its budget
+    LaneCounters cycles;
+    LaneCounters loops;
+} LaneGroup;
+
+// Lane helpers are macros so that vector values are never passed by value without AVX enabled (-Wpsabi)
+#define laneSelect(m, x, y) (((x) & (LaneBytes)(m)) | ((y) & ~(LaneBytes)(m)))
+
+// Add value to acc in the lanes selected by m
+#define laneAdd(acc, m, value) (*(acc) += __builtin_convertvector((m), LaneCounters) & (int64_t)(value))
+
+// True if every lane of m is set, tested a machine word at a time
+static inline int laneAll(const LaneMask *m){
+    uint64_t words[BATCH_LANES / 8];
+    memcpy(words, m, sizeof(words));
+    uint64_t all = ~(uint64_t)0;
+    for(int i = 0; i < BATCH_LANES / 8; i++){
+        all &= words[i];
+    }
+    return all == ~(uint64_t)0;
+}
+
+// Executes the instruction at pc for every lane that sits at pc with the same command and operand bytes.
+// The ALU switch is scalar on the shared command, the work inside each case is a byte vector operation.
+// Returns the most posEdges it added to any lane.
+static inline __attribute__((always_inline)) int batchStep(LaneGroup *g, uint8_t pc, const LaneMask *atPcLanes){
+    LaneMask atPc = *atPcLanes;
+    int lead = 0;
+    while(!atPc[lead]){
+        lead++;
+    }
+    uint8_t cmd = g->ram[pc][lead];
+    uint8_t operand = g->ram[(uint8_t)(pc + 1)][lead];
+    uint8_t op = cmd >> 4;
+    uint8_t a = (cmd & 0b1100) >> 2;
+    uint8_t b = cmd & 0b11;
+    LaneMask m = atPc & (g->ram[pc] == cmd);
+    if(op >= 8 && op != 12 && op != 13){                // two-byte instructions also need the same operand
+        m &= (g->ram[(uint8_t)(pc + 1)] == operand);
+    }
+    // lanes whose program counter increments land on their print address, past this byte and past the next,
+    // only worked out when some lane of the group prints there
+    int hit = g->printAt[(uint8_t)(pc + 1)] | g->printAt[(uint8_t)(pc + 2)];
+    LaneMask first = {0};
+    LaneMask second = {0};
+    if(hit){
+        first = m & (g->printAddr == (uint8_t)(pc + 1));
+        second = m & (g->printAddr == (uint8_t)(pc + 2));
+    }
+    LaneBytes rb = g->reg[b];
+    LaneBytes ra = g->reg[a];
+    int charged = cycleCost[op];
+    laneAdd(&g->cycles, m, cycleCost[op]);
+
+    switch(cmd & 0b11110000){
+        case AND:
+            g->reg[b] = laneSelect(m, rb & ra, rb);
+            break;
+        case OR:
+            g->reg[b] = laneSelect(m, rb | ra, rb);
+            break;
+        case XOR:
+            g->reg[b] = laneSelect(m, rb ^ ra, rb);
+            break;
+        case ADD:
+            g->reg[b] = laneSelect(m, rb + ra, rb);
+            break;
+        case SUB:
+            g->reg[b] = laneSelect(m, rb - ra, rb);
+            break;
+        case NOTB:
+            g->reg[b] = laneSelect(m, ~rb, rb);
+            break;
+        case SHIFTB:
+            g->reg[b] = laneSelect(m, rb >> 1, rb);
+            break;
+        case LSHIFTB:
+            g->reg[b] = laneSelect(m, rb << 1, rb);
+            break;
+        case LOAD:
+            g->reg[b] = laneSelect(m, g->ram[operand], rb);
+            if(hit){
+                laneAdd(&g->loops, first, 2);
+                laneAdd(&g->loops, second, 1);
+            }
+            g->count = laneSelect(m, g->count + 2, g->count);
+            return charged;
+        case WRT:
+            g->ram[operand] = laneSelect(m, rb, g->ram[operand]);
+            if(hit){
+                laneAdd(&g->loops, first, 2);
+                laneAdd(&g->loops, second, 1);
+            }
+            g->count = laneSelect(m, g->count + 2, g->count);
+            return charged;
+        case TAS:                                       // lanes never wait for a bus
+            switch(cmd & 0b11111100){
+                case TAS:
+                    g->reg[b] = laneSelect(m, g->ram[operand], rb);
+                    g->ram[operand] = laneSelect(m, (LaneBytes){0} + 1, g->ram[operand]);
+                    break;
+                case MUL:
+                    laneAdd(&g->cycles, m, MUL_COST - cycleCost[op]);
+                    charged = MUL_COST;
+                    g->reg[b] = laneSelect(m, rb * g->ram[operand], rb);
+                    break;
+                case POPC:
+                {
+                    LaneBytes x = g->ram[operand];
+                    x = x - ((x >> 1) & 0x55);
+                    x = (x & 0x33) + ((x >> 2) & 0x33);
+                    g->reg[b] = laneSelect(m, (x + (x >> 4)) & 0x0F, rb);
+                    break;
+                }
+                case BSUM:                              // per-lane blocks, summed one lane at a time
+                {
+                    LaneBytes sums = rb;
+                    for(int l = 0; l < BATCH_LANES; l++){
+                        if(m[l]){
+                            uint8_t length = g->ram[operand][l];
+                            uint8_t sum = 0;
+                            for(int i = 0; i < length; i++){
+                                sum += g->ram[(uint8_t)(rb[l] + i)][l];
+                            }
+                            sums[l] = sum;
+                            g->cycles[l] += BSUM_BYTE_COST * length;
+                            if(cycleCost[op] + BSUM_BYTE_COST * length > charged){
+                                charged = cycleCost[op] + BSUM_BYTE_COST * length;
+                            }
+                        }
+                    }
+                    g->reg[b] = sums;
+                    break;
+                }
+            }
+            if(hit){
+                laneAdd(&g->loops, first, 2);
+                laneAdd(&g->loops, second, 1);
+            }
+            g->count = laneSelect(m, g->count + 2, g->count);
+            return charged;
+        case JMPZ:
+        {
+            LaneMask taken = m & (rb == 0);
+            LaneMask notTaken = m & ~taken;
+            laneAdd(&g->cycles, taken, JMPZ_TAKEN_COST - cycleCost[op]);
+            if(hit){
+                laneAdd(&g->loops, first, 1);
+                laneAdd(&g->loops, first & notTaken, 1);
+                laneAdd(&g->loops, second & notTaken, 1);
+            }
+            g->count = laneSelect(taken, g->ram[operand], laneSelect(notTaken, g->count + 2, g->count));
+            return charged;
+        }
+        case JMP:
+            if(hit){
+                laneAdd(&g->loops, first, 1);
+            }
+            g->count = laneSelect(m, g->ram[operand], g->count);
+            return charged;
+        case LOADL:                                     // per-lane addresses, gathered one lane at a time
+        {
+            LaneBytes gathered;
+            for(int l = 0; l < BATCH_LANES; l++){
+                gathered[l] = g->ram[ra[l]][l];
+            }
+            g->reg[b] = laneSelect(m, gathered, rb);
+            break;
+        }
+        case WRTL:
+            for(int l = 0; l < BATCH_LANES; l++){
+                if(m[l]){
+                    g->ram[ra[l]][l] = rb[l];
+                }
+            }
+            break;
+        case HALT:
+            if(hit){
+                laneAdd(&g->loops, first, 1);
+            }
+            g->count = laneSelect(m, g->ram[(uint8_t)(pc + 1)], g->count);
+            g->halted |= m;
+            g->done |= m;
+            return charged;
+    }
+    // one-byte instructions
+    if(hit){
+        laneAdd(&g->loops, first, 1);
+    }
+    g->count = laneSelect(m, g->count + 1, g->count);
+    return charged;
+}
+
+// Runs every lane of the group to HALT, or to the first instruction boundary at or past budget posEdges like
+// gibcpuRun(). Lanes that have diverged from the lowest live program counter are masked off and catch up when
+// the group reaches their address. The lanes are only compared with the budget once the posEdges charged so
+// far, an upper bound on every lane's count, could have reached it.
+BATCH_TARGETS static void runBatchGroup(LaneGroup *g, int64_t budget){
+    int lead = 0;
+    int64_t charged = 0;
+    for(;;){
+        if(charged >= budget){
+            g->done |= __builtin_convertvector(g->cycles >= budget, LaneMask);
+        }
+        while(lead < BATCH_LANES && g->done[lead]){
+            lead++;
+        }
+        if(lead == BATCH_LANES){
+            return;
+        }
+        uint8_t pc = g->count[lead];
+        LaneMask atPc = (g->count == pc) & ~g->done;
+        LaneMask settled = atPc | g->done;
+        if(!laneAll(&settled)){                // diverged, run the lowest address first
+            for(int l = lead; l < BATCH_LANES; l++){
+                uint8_t c = g->count[l] | (uint8_t)g->done[l];
+                pc = c < pc ? c : pc;
+            }
+            atPc = (g->count == pc) & ~g->done;
+        }
+        charged += batchStep(g, pc, &atPc);
+    }
+}
+
+// Runs each image in its own lane, BATCH_LANES machines per group
+int gibcpuRunBatch(uint8_t (*images)[GIBCPU_MEMORY_SIZE], const GibCPUImageInfo *infos, int imageCount,
+                   uint64_t budget, uint64_t *cycles, uint64_t *loops, int *halted){
+    for(int i = 0; infos && i < imageCount; i++){
+        if(infos[i].flags & GIBCPU_IMAGE_HAS_BANKS){
+            return 1;
+        }
+    }
+    LaneGroup *g = aligned_alloc(64, sizeof(LaneGroup));
+    if(!g){
+        return 1;
+    }
+    for(int base = 0; base < imageCount; base += BATCH_LANES){
+        memset(g, 0, sizeof(LaneGroup));
+        for(int l = 0; l < BATCH_LANES; l++){
+            if(base + l >= imageCount){
+                g->halted[l] = -1;
+                g->done[l] = -1;
+                continue;
+            }
+            for(int i = 0; i < MAX_VALUES; i++){
+                g->ram[i][l] = images[base + l][i];
+            }
+            const GibCPUImageInfo *info = infos ? &infos[base + l] : NULL;
+            g->count[l] = info ? info->entry : 0;
+            g->printAddr[l] = info && (info->flags & GIBCPU_IMAGE_HAS_PRINT_ADDR) ? info->printAddr
+                                                                                : GIBCPU_DEFAULT_PRINT_ADDR;
+            g->printAt[g->printAddr[l]] = 1;
+        }
+        runBatchGroup(g, budget < INT64_MAX ? (int64_t)budget : INT64_MAX);
+        for(int l = 0; l < BATCH_LANES && base + l < imageCount; l++){
+            cycles[base + l] = (uint64_t)g->cycles[l];
+            loops[base + l] = (uint64_t)g->loops[l];
+            halted[base + l] = g->halted[l] != 0;
+        }
+    }
+    free(g);
+    return 0;
+}
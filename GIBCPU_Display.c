@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "GIBCPU_Internal.h"
+
+/* ASYNCHRONOUS DISPLAY */
+
+#define DISPLAY_RING_FRAMES 64      // power of two
+#define DISPLAY_IDLE_NS 1000000     // renderer poll interval while the ring is empty
+#define DISPLAY_MAX_CELLS (GIBCPU_MEMORY_SIZE + GIBCPU_EXTENDED_SIZE)
+
+#define CELL_ON "\u2593"       // Dark shaded block
+#define CELL_OFF "\u2591"      // Light shaded block
+
+// Single-producer single-consumer ring of display region copies. The emulator thread only writes head,
+// the renderer only writes tail, so neither side ever takes a lock.
+struct GibCPUDisplay {
+    GibCPUDisplayConfig config;
+    int cells;
+    uint8_t frames[DISPLAY_RING_FRAMES][DISPLAY_MAX_CELLS];
+    _Alignas(64) atomic_size_t head;    // frames pushed
+    _Alignas(64) atomic_size_t tail;    // frames taken by the renderer
+    atomic_int stopping;
+    atomic_uint_fast64_t dropped;
+    uint8_t shown[DISPLAY_MAX_CELLS];   // what the terminal shows now, for delta rendering
+    int drawn;                          // a full frame has been drawn
+    char *text;                         // output buffer, one fwrite per frame
+    pthread_t renderer;
+};
+
+static size_t appendCell(char *out, uint8_t value){
+    const char *cell = value == 1 ? CELL_ON : CELL_OFF;
+    memcpy(out, cell, 3);
+    return 3;
+}
+
+// Whole frame in the original printGrid() layout
+static size_t renderFull(GibCPUDisplay *d, const uint8_t *frame, char *out){
+    size_t n = 0;
+    n += sprintf(out + n, "-----------------------------\n");
+    for(int i = 0; i < d->cells; i++){
+        n += appendCell(out + n, frame[i]);
+        if((i + 1) % d->config.width == 0){     // New line after every row
+            out[n++] = '\n';
+        }
+    }
+    return n;
+}
+
+// Only the cells that changed since the last frame. The cursor rests on the line below the grid, so each
+// cell is reached by moving up to its row and across to its column, then back down.
+static size_t renderDelta(GibCPUDisplay *d, const uint8_t *frame, char *out){
+    if(!d->drawn){
+        d->drawn = 1;
+        memcpy(d->shown, frame, d->cells);
+        return renderFull(d, frame, out);
+    }
+    size_t n = 0;
+    for(int i = 0; i < d->cells; i++){
+        if(frame[i] == d->shown[i]){
+            continue;
+        }
+        int up = d->config.height - i / d->config.width;
+        n += sprintf(out + n, "\x1b[%dA\x1b[%dG", up, i % d->config.width + 1);
+        n += appendCell(out + n, frame[i]);
+        n += sprintf(out + n, "\x1b[%dB\r", up);
+        d->shown[i] = frame[i];
+    }
+    return n;
+}
+
+static void drawFrame(GibCPUDisplay *d, const uint8_t *frame){
+    size_t n = d->config.delta ? renderDelta(d, frame, d->text) : renderFull(d, frame, d->text);
+    if(n){
+        fwrite(d->text, 1, n, d->config.out);
+        fflush(d->config.out);
+    }
+}
+
+static void sleepNanoseconds(long ns){
+    struct timespec t = {ns / 1000000000L, ns % 1000000000L};
+    nanosleep(&t, NULL);
+}
+
+// Renderer thread. Unthrottled it draws every frame in order; with a frame rate it draws the newest frame
+// once per tick and skips the rest.
+static void *renderMain(void *arg){
+    GibCPUDisplay *d = arg;
+    long tick = d->config.fps > 0 ? 1000000000L / d->config.fps : 0;
+    for(;;){
+        size_t head = atomic_load_explicit(&d->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&d->tail, memory_order_relaxed);
+        if(head == tail){
+            if(atomic_load_explicit(&d->stopping, memory_order_acquire) &&
+               head == atomic_load_explicit(&d->head, memory_order_acquire)){
+                return NULL;
+            }
+            sleepNanoseconds(DISPLAY_IDLE_NS);
+            continue;
+        }
+        if(tick && head - tail > 1){
+            atomic_fetch_add_explicit(&d->dropped, head - 1 - tail, memory_order_relaxed);
+            tail = head - 1;
+        }
+        drawFrame(d, d->frames[tail % DISPLAY_RING_FRAMES]);
+        atomic_store_explicit(&d->tail, tail + 1, memory_order_release);
+        if(tick){
+            sleepNanoseconds(tick);
+        }
+    }
+}
+
+GibCPUDisplay *gibcpuDisplayCreate(const GibCPUDisplayConfig *config){
+    int cells = config->width * config->height;
+    if(cells == 0 || config->start + cells > DISPLAY_MAX_CELLS || !config->out){
+        return NULL;
+    }
+    GibCPUDisplay *d = aligned_alloc(64, sizeof(GibCPUDisplay));
+    if(!d){
+        return NULL;
+    }
+    memset(d, 0, sizeof(GibCPUDisplay));
+    d->config = *config;
+    d->cells = cells;
+    d->text = malloc(64 + cells * 24);      // a full frame, or one cursor move sequence per cell
+    atomic_init(&d->head, 0);
+    atomic_init(&d->tail, 0);
+    atomic_init(&d->stopping, 0);
+    atomic_init(&d->dropped, 0);
+    if(!d->text || pthread_create(&d->renderer, NULL, renderMain, d)){
+        free(d->text);
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Display hook: copy the display region into the ring and return to the emulator straight away
+void gibcpuDisplayHook(GibCPU *cpu, void *user){
+    GibCPUDisplay *d = user;
+    size_t head = atomic_load_explicit(&d->head, memory_order_relaxed);
+    while(head - atomic_load_explicit(&d->tail, memory_order_acquire) == DISPLAY_RING_FRAMES){
+        if(d->config.fps > 0){                  // throttled: the renderer would skip this frame anyway
+            atomic_fetch_add_explicit(&d->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        sched_yield();                          // every frame is drawn, wait for the renderer to catch up
+    }
+    gibcpuReadExtended(cpu, d->config.start, d->frames[head % DISPLAY_RING_FRAMES], d->cells);
+    atomic_store_explicit(&d->head, head + 1, memory_order_release);
+}
+
+void gibcpuDisplayDestroy(GibCPUDisplay *display){
+    if(!display){
+        return;
+    }
+    atomic_store_explicit(&display->stopping, 1, memory_order_release);
+    pthread_join(display->renderer, NULL);
+    free(display->text);
+    free(display);
+}
+
+uint64_t gibcpuDisplayDropped(const GibCPUDisplay *display){
+    return atomic_load((atomic_uint_fast64_t *)&display->dropped);
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMAGE_MMAP 1
+#else
+#define IMAGE_MMAP 0
+#endif
+
+#define IMAGE_MAGIC "GIBR"
+
+/* FILE IO FUNCTIONS */
+
+// Function to convert a binary string to a uint8_t value
+static uint8_t binaryStringToUint8(const char *binaryString) {
+    uint8_t value = 0;
+    for (int i = 0; i < BINARY_STRING_LENGTH; i++) {
+        value <<= 1;
+        if (binaryString[i] == '1') {
+            value |= 1;
+        }
+    }
+    return value;
+}
+
+// Legacy RAM.txt import: every line of exactly 8 characters is one byte
+static size_t parseTextImage(const char *text, size_t size, uint8_t *array, size_t maxValues) {
+    size_t count = 0;
+    size_t start = 0;
+    while (count < maxValues && start < size) {
+        size_t end = start;
+        while (end < size && text[end] != '\n') {
+            end++;
+        }
+        size_t length = end - start;
+        if (length > 0 && text[end - 1] == '\r') {
+            length--;
+        }
+        if (length == BINARY_STRING_LENGTH) {
+            array[count++] = binaryStringToUint8(text + start);
+        }
+        start = end + 1;
+    }
+    return count;
+}
+
+// Binary image: check the header and copy the RAM bytes, then any banks, straight out of the mapping
+static size_t parseBinaryImage(const uint8_t *data, size_t size, uint8_t *array, size_t maxValues, GibCPUImageInfo *info) {
+    int version = data[4];
+    size_t headerSize = data[5];
+    size_t length = data[6] | (data[7] << 8);
+    int banked = version >= 2 && (data[9] & GIBCPU_IMAGE_HAS_BANKS);
+    int bankCount = banked ? data[14] : 0;
+    size_t bankBytes = bankCount * GIBCPU_BANK_SIZE;
+    if (version < 1 || version > GIBCPU_IMAGE_VERSION || headerSize < GIBCPU_IMAGE_HEADER_SIZE || length > MAX_VALUES ||
+        headerSize + length + bankBytes > size) {
+        return 0;
+    }
+    if (banked && (bankCount == 0 || bankCount > GIBCPU_MAX_BANKS || length > GIBCPU_BANK_WINDOW)) {
+        return 0;
+    }
+    if (info) {
+        info->entry = data[8];
+        info->flags = data[9] & (banked ? 0xFF : ~GIBCPU_IMAGE_HAS_BANKS);
+        info->printAddr = data[10];
+        info->displayStart = data[11] | (version >= 2 ? data[15] << 8 : 0);
+        info->displayWidth = data[12];
+        info->displayHeight = data[13];
+        info->bankCount = bankCount;
+    }
+    if (length > maxValues) {
+        length = maxValues;
+    }
+    memcpy(array, data + headerSize, length);
+    if (bankBytes && maxValues >= MAX_VALUES + bankBytes) {
+        memcpy(array + MAX_VALUES, data + headerSize + data[6] + (data[7] << 8), bankBytes);
+    }
+    return length;
+}
+
+// Legacy RAM.txt starts with a line of eight 0s and 1s
+static int isTextImage(const uint8_t *data, size_t size) {
+    size_t length = 0;
+    while (length < size && (data[length] == '0' || data[length] == '1')) {
+        length++;
+    }
+    return length == BINARY_STRING_LENGTH && (length == size || data[length] == '\n' || data[length] == '\r');
+}
+
+// Assembly source, assembled in memory
+static size_t parseSourceImage(const uint8_t *data, size_t size, uint8_t *array, size_t maxValues, GibCPUImageInfo *info) {
+    GibCPUAssembly *assembly = malloc(sizeof(GibCPUAssembly));
+    if (!assembly) {
+        return 0;
+    }
+    size_t length = 0;
+    if (gibcpuAssemble((const char *)data, size, assembly)) {
+        fprintf(stderr, "Assembly error on line %d: %s\n", assembly->errorLine, assembly->error);
+    }
+    else {
+        length = assembly->length < maxValues ? assembly->length : maxValues;
+        memcpy(array, assembly->image, length);
+        size_t bankBytes = assembly->info.bankCount * GIBCPU_BANK_SIZE;
+        if (bankBytes && maxValues >= MAX_VALUES + bankBytes) {
+            memcpy(array + MAX_VALUES, assembly->image + MAX_VALUES, bankBytes);
+        }
+        if (info) {
+            *info = assembly->info;
+        }
+    }
+    free(assembly);
+    return length;
+}
+
+static size_t parseImage(const uint8_t *data, size_t size, uint8_t *array, size_t maxValues, GibCPUImageInfo *info) {
+    if (info) {
+        memset(info, 0, sizeof(GibCPUImageInfo));
+    }
+    if (size >= GIBCPU_IMAGE_HEADER_SIZE && !memcmp(data, IMAGE_MAGIC, 4)) {
+        return parseBinaryImage(data, size, array, maxValues, info);
+    }
+    if (isTextImage(data, size)) {
+        return parseTextImage((const char *)data, size, array, maxValues);
+    }
+    return parseSourceImage(data, size, array, maxValues, info);
+}
+
+// Function to load an image file, binary, legacy text or assembly source, into an array
+size_t gibcpuReadImageFile(const char *filename, uint8_t *array, size_t maxValues, GibCPUImageInfo *info) {
+    size_t count = 0;
+#if IMAGE_MMAP
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            count = parseImage(data, st.st_size, array, maxValues, info);
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+#else
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening file");
+        return 0;
+    }
+    // the longest legacy file is 256 lines of "01010101\r\n", assembly sources are read up to 64KB
+    static _Thread_local uint8_t data[1 << 16];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    count = parseImage(data, size, array, maxValues, info);
+#endif
+    return count; // Return the number of values loaded into the array
+}
+
+size_t loadImageInfo(GibCPU *cpu, const uint8_t *image, size_t length, const GibCPUImageInfo *info) {
+    if (info->flags & GIBCPU_IMAGE_HAS_PRINT_ADDR) {
+        gibcpuSetDisplay(cpu, info->printAddr, cpu->displayHook, cpu->displayUser);
+    }
+    size_t loaded = loadImageAt(cpu, image, length, info->entry);
+    if (info->flags & GIBCPU_IMAGE_HAS_BANKS) {
+        loadBanks(cpu, image + MAX_VALUES, info->bankCount);
+    }
+    return loaded;
+}
+
+size_t gibcpuLoadImageFile(GibCPU *cpu, const char *filename, GibCPUImageInfo *info) {
+    uint8_t image[MAX_VALUES + GIBCPU_EXTENDED_SIZE] = {0};
+    GibCPUImageInfo header;
+    size_t length = gibcpuReadImageFile(filename, image, sizeof(image), &header);
+    if (!length) {
+        return 0;
+    }
+    loadImageInfo(cpu, image, length, &header);
+    if (info) {
+        *info = header;
+    }
+    return length;
+}
+
+int gibcpuWriteImageFile(const char *filename, const uint8_t *image, size_t length, const GibCPUImageInfo *info) {
+    if (length > MAX_VALUES) {
+        length = MAX_VALUES;
+    }
+    // only banks and extended display addresses need version 2
+    int banked = info && (info->flags & GIBCPU_IMAGE_HAS_BANKS);
+    int extended = banked || (info && info->displayStart > 0xFF);
+    uint8_t header[GIBCPU_IMAGE_HEADER_SIZE] = {0};
+    memcpy(header, IMAGE_MAGIC, 4);
+    header[4] = extended ? 2 : 1;
+    header[5] = GIBCPU_IMAGE_HEADER_SIZE;
+    header[6] = length & 0xFF;
+    header[7] = length >> 8;
+    if (info) {
+        header[8] = info->entry;
+        header[9] = info->flags;
+        header[10] = info->printAddr;
+        header[11] = info->displayStart & 0xFF;
+        header[12] = info->displayWidth;
+        header[13] = info->displayHeight;
+    }
+    if (extended) {
+        header[14] = banked ? info->bankCount : 0;
+        header[15] = info->displayStart >> 8;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror("Error opening file");
+        return 1;
+    }
+    int failed = fwrite(header, 1, sizeof(header), file) != sizeof(header);
+    failed |= fwrite(image, 1, length, file) != length;
+    if (banked) {
+        size_t bankBytes = info->bankCount * GIBCPU_BANK_SIZE;
+        failed |= fwrite(image + MAX_VALUES, 1, bankBytes, file) != bankBytes;
+    }
+    failed |= fclose(file) != 0;
+    return failed;
+}
@@ -0,0 +1,343 @@
+#ifndef GIBCPU_INTERNAL_H
+#define GIBCPU_INTERNAL_H
+
+// Context layout and helpers shared by the library's translation units. Not part of the public API.
+
+#include "GIBCPU.h"
+
+#define MAX_VALUES GIBCPU_MEMORY_SIZE
+#define BINARY_STRING_LENGTH 8
+
+#define AND     0
+#define OR      16
+#define XOR     32
+#define ADD     48
+#define SUB     64
+#define NOTB    80
+#define SHIFTB  96
+#define LSHIFTB 112
+#define LOAD    128
+#define WRT     144
+#define JMPZ    160
+#define JMP     176
+#define LOADL   192
+#define WRTL    208
+#define TAS     224             // with register A 0, A 1-3 select a coprocessor instruction
+#define HALT    240
+
+// Coprocessor instructions: opcode 14 with register A 1-3, as commands with register B 0
+#define MUL     228             // rB = rB * $x
+#define POPC    232             // rB = bits set in $x
+#define BSUM    236             // rB = sum of the $x bytes from address rB
+
+#define JMPZ_TAKEN_COST 8
+#define MUL_COST 16             // the multiplier takes two bits of $x per posEdge
+#define BSUM_BYTE_COST 2        // posEdges BSUM adds per byte summed
+#define MEMCTRL_STATES 27       // memCtrl() states 0-26
+
+// posEdges each instruction takes in the cycle-level model, indexed by opcode (command >> 4)
+extern const uint8_t cycleCost[16];
+
+/* MICROCODE (GIBCPU_Microcode.c)
+ *
+ * memCtrl() runs a microcode ROM built from one table of rules. Each posEdge it looks up the microinstruction
+ * for its state, the command class and the condition bits and runs its micro-ops in order. A state waiting for
+ * acknowledges starts with UOP_WAIT_* micro-ops, which end the posEdge in the same state until they are in. */
+
+enum {
+    UOP_END,                // after the last micro-op of a microinstruction
+    UOP_FETCH,              // command = ramDataOut, latched before the lookup
+    UOP_WAIT_COUNT,         // stay in the state until the acknowledge is in
+    UOP_WAIT_INC,
+    UOP_WAIT_REG,
+    UOP_WAIT_RAM,
+    UOP_HALT,
+    UOP_CLR_COUNT,          // drop an acknowledged request
+    UOP_CLR_INC,
+    UOP_CLR_REG,
+    UOP_CLR_RAM,
+    UOP_BOOKMARK,           // bookmark = count
+    UOP_MDATA,              // Mdata = ramDataOut
+    UOP_COUNT_REGA,         // memCtrlCount = ...
+    UOP_COUNT_DATA,
+    UOP_COUNT_BOOKMARK,
+    UOP_COUNT_MDATA,
+    UOP_COUNT_REGB,
+    UOP_REG_MDATA,          // memCtrlReg = ...
+    UOP_REG_ACC,
+    UOP_REG_POPC,
+    UOP_RAM_REGB,           // memCtrlRAM = ...
+    UOP_RAM_ONE,
+    UOP_ACC_CLEAR,          // coprocessor
+    UOP_LEFT_FOUR,
+    UOP_LEFT_MDATA,
+    UOP_MUL_STEP,           // two bits of Mdata into coprocAcc, coprocLeft--
+    UOP_ACC_ADD,            // coprocAcc += ramDataOut, coprocLeft--, memCtrlCount++
+    UOP_SET_COUNT,          // raise a request for the module to acknowledge on a later posEdge
+    UOP_INC,
+    UOP_SET_REG,
+    UOP_SET_RAM,
+    UOP_DO_COUNT,           // collapsed microcode: carry the request out on this posEdge
+    UOP_DO_INC,
+    UOP_DO_REG,
+    UOP_DO_RAM,
+    UOPS
+};
+
+// Acknowledges a state waits for
+#define ACK_COUNT 0x01      // countSet
+#define ACK_INC 0x02        // countIncremented
+#define ACK_REG 0x04        // regSet
+#define ACK_RAM 0x08        // RAMSet
+
+// Condition bits of the lookup key
+#define COND_ZERO 0x01      // regB == 0
+#define COND_DONE 0x02      // coprocLeft == 0
+#define COND_LAST 0x04      // coprocLeft == 1
+
+#define MICROCODE_VARIANTS 2
+#define MICRO_CLASSES 12    // ALU, LOAD, WRT, JMPZ, JMP, LOADL, WRTL, TAS, MUL, POPC, BSUM, HALT
+#define MICRO_CONDITIONS 8
+#define MICRO_KEYS (MICRO_CLASSES * MICRO_CONDITIONS)
+#define MICRO_MAX_OPS 8
+#define MICRO_MAX 256         // distinct microinstructions in a ROM, indexed by a byte
+
+typedef struct {
+    uint8_t next;           // state after this posEdge
+    uint8_t length;
+    uint8_t ops[MICRO_MAX_OPS + 1];     // up to UOP_END
+} MicroInstruction;
+
+typedef struct {
+    uint8_t drives[MEMCTRL_STATES];     // MODULE_* bits reading the signals the state may drive
+    uint8_t tests[MEMCTRL_STATES];      // COND_* bits its microinstruction depends on
+    uint8_t entry[MEMCTRL_STATES][MICRO_KEYS];  // microinstruction by state, class * MICRO_CONDITIONS + condition
+    MicroInstruction micro[MICRO_MAX];
+    int count;
+} MicroRom;
+
+// ROMs by GibCPUMicrocode and the class of each command, built once by microcodeInit()
+extern MicroRom microcodeRoms[MICROCODE_VARIANTS];
+extern uint8_t microClass[MAX_VALUES];
+void microcodeInit(void);
+
+// Bytes an instruction takes, by opcode: LOAD, WRT, JMPZ, JMP, TAS and HALT carry an operand
+static inline uint8_t instructionLength(uint8_t op){
+    return (op >= 8 && op != 12 && op != 13) ? 2 : 1;
+}
+
+// Predecoded form of one RAM address used by the threaded engine
+typedef struct {
+    uint8_t kind;           // handler index, 0 = not decoded yet, past the opcodes for a superinstruction
+    uint8_t a;              // register A field
+    uint8_t b;              // register B field
+    uint8_t operand;        // second byte of two-byte instructions
+    uint8_t next;           // address after the instruction when it does not jump
+    uint8_t printsBefore;   // print address hits before the instruction takes effect
+    uint8_t printsAfter;    // print address hits after it takes effect
+    uint8_t superBack;      // bytes back to the start of the farthest superinstruction decoded over this byte
+} Decoded;
+
+// Modules of the cycle-level model as bits of GibCPU.pending. A module is only re-evaluated on a posEdge
+// once a signal on its sensitivity list has changed since it last ran; memCtrl() runs on every posEdge.
+#define MODULE_REGBANK      0x01    // setReg, regSet, command, memCtrlReg, ALUout
+#define MODULE_REGPATHSET   0x02    // command, reg0-3
+#define MODULE_ALU          0x04    // command, regA, regB
+#define MODULE_PROGCOUNTER  0x08    // setCount, countSet, memCtrlCount, incrementCount, countIncremented
+#define MODULE_RAM          0x10    // setRAM, RAMSet, memCtrlRAM, count, RAM
+#define MODULE_ALL          0x1F    // after anything outside the modules changed the machine state
+
+typedef struct GibJit GibJit;
+typedef struct GibCheckpoints GibCheckpoints;
+typedef struct GibMemo GibMemo;
+typedef struct GibTrace GibTrace;
+
+struct GibCPU {
+    // hot state, touched on every posEdge or instruction: exactly the first cache line
+    uint8_t reg[4];             // reg0-reg3
+    uint8_t count;
+    uint8_t state;
+    uint8_t command;
+    uint8_t programHalt;
+    uint8_t regA;
+    uint8_t regB;
+    uint8_t ALUout;
+    uint8_t ramDataOut;
+    uint8_t memCtrlRAM;
+    uint8_t setRAM;
+    uint8_t RAMSet;
+    uint8_t memCtrlCount;
+    uint8_t setCount;
+    uint8_t countSet;
+    uint8_t incrementCount;
+    uint8_t countIncremented;
+    uint8_t memCtrlReg;
+    uint8_t setReg;
+    uint8_t regSet;
+    uint8_t Mdata;
+    uint8_t bookmark;
+    uint8_t coprocAcc;          // coprocessor accumulator
+    uint8_t coprocLeft;         // multiplier steps or BSUM bytes still to go
+    uint8_t printAddr;
+    uint8_t engine;
+    uint8_t microcode;          // GibCPUMicrocode memCtrl() runs
+    uint8_t pending;            // MODULE_* bits to re-evaluate on the next posEdge
+    uint8_t busWait;            // stopped in front of a TAS until the bus arbiter grants it the bus
+    uint64_t posEdgeCounter;
+    uint64_t loopCounter;
+    GibCPUDisplayHook displayHook;
+    void *displayUser;
+
+    _Alignas(64) uint8_t ram[MAX_VALUES];
+
+    // code caches, only touched on dispatch misses and RAM writes
+    _Alignas(64) uint8_t jitCovered[MAX_VALUES];   // translated blocks containing each address
+    Decoded decoded[MAX_VALUES];
+    GibJit *jit;
+
+    uint8_t entry;              // program counter at power-on, from the image header
+    uint8_t fault;
+
+    GibCheckpoints *checkpoints;
+    uint64_t nextCheckpoint;    // posEdgeCounter at which the next checkpoint is due, UINT64_MAX when off
+    GibMemo *memo;
+    GibTrace *trace;
+
+    GibCPUProfile *profile;
+    uint8_t profilePc;          // instruction in flight, charged for each posEdge while profiling
+    uint8_t profileOp;
+    uint8_t profilePrevOp;      // the instruction before it
+    uint8_t profileRun;         // instructions that ran back to back up to profileOp, counted to 2
+
+    GibCPUSystem *system;       // multi-core system this context is a core of, NULL when alone
+    uint8_t busGranted;         // set by the arbiter while it runs that TAS
+
+    uint8_t bankCount;          // 0 without banks
+    uint8_t bankMapped;         // bank shown in the window; its copy in banks[] is stale until it is unmapped
+    uint8_t banks[GIBCPU_MAX_BANKS][GIBCPU_BANK_SIZE];
+};
+
+// Opcode 14 with register A 0
+static inline int isTas(uint8_t cmd){
+    return (cmd & 0b11111100) == TAS;
+}
+
+// What a coprocessor instruction with register B value rb and $x value x leaves in rB, for the
+// instruction-level engines. BSUM reads its block from ram.
+static inline uint8_t coprocResult(const uint8_t *ram, uint8_t cmd, uint8_t rb, uint8_t x){
+    uint8_t sum = 0;
+    switch(cmd & 0b11111100){
+        case MUL:
+            return rb * x;
+        case POPC:
+            return __builtin_popcount(x);
+        default:
+            for(int i = 0; i < x; i++){
+                sum += ram[(uint8_t)(rb + i)];
+            }
+            return sum;
+    }
+}
+
+// A core of a multi-core system stops in front of a TAS, on the instruction boundary, until the bus arbiter
+// grants it the bus at the end of the epoch (GIBCPU_System.c). Returns 1 if the engine has to stop there.
+static inline int tasWaitsForBus(GibCPU *cpu){
+    if(cpu->system && !cpu->busGranted){
+        cpu->busWait = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Run the cycle-level model until memCtrl() is back in state 0, i.e. one whole instruction
+void stepInstructionCycles(GibCPU *cpu);
+
+// One posEdge of the cycle-level model, out of line for the profiler
+void stepPosEdge(GibCPU *cpu);
+
+// Copy an image into RAM and power on at entry
+size_t loadImageAt(GibCPU *cpu, const uint8_t *image, size_t length, uint8_t entry);
+
+// loadImageAt() with the entry point and print address from an image header, and the banks that follow
+// the RAM bytes at image + MAX_VALUES when the header has them
+size_t loadImageInfo(GibCPU *cpu, const uint8_t *image, size_t length, const GibCPUImageInfo *info);
+
+// Copy the window back to its bank and map the bank selected by ram[GIBCPU_BANK_SELECT]
+void switchBank(GibCPU *cpu);
+
+// Turn banking on with bankCount banks and map the selected one, after the RAM bytes are loaded
+void loadBanks(GibCPU *cpu, const uint8_t *banks, int bankCount);
+
+// Instruction-level engine, also used to replay and to run between memo visits
+void runFast(GibCPU *cpu, uint64_t limit, int stopAt);
+
+// JIT engine (GIBCPU_JIT.c). runJit() returns 0 if the host cannot run translated code.
+int jitAvailable(void);
+int runJit(GibCPU *cpu, uint64_t limit);
+void jitInvalidate(GibCPU *cpu, uint8_t addr);
+void jitFlush(GibCPU *cpu);
+void jitDestroy(GibCPU *cpu);
+
+// Checkpoint ring (GIBCPU_Snapshot.c). checkpointsReset() drops every checkpoint and takes a fresh one.
+void checkpointTake(GibCPU *cpu);
+void checkpointsReset(GibCPU *cpu);
+void checkpointsDestroy(GibCPU *cpu);
+
+// State memoization (GIBCPU_Memo.c). memoClear() forgets the recorded history whenever the machine is
+// moved off its own trajectory (writes from outside, loads, restores).
+void runMemo(GibCPU *cpu, uint64_t limit);
+void memoClear(GibCPU *cpu);
+void memoDestroy(GibCPU *cpu);
+
+// Profiler (GIBCPU_Profile.c): one posEdge of the cycle-level model with its cost recorded
+void profilePosEdge(GibCPU *cpu);
+
+// Execution trace (GIBCPU_Trace.c). traceInstruction() records the instruction that just ended with command
+// cmd, traceWrite() a RAM write on the way, and traceDiscontinuity() has the next boundary write a keyframe
+// when the machine was moved off its own trajectory. traceSync() writes a keyframe due now if it can.
+void runTraced(GibCPU *cpu, uint64_t limit);
+void traceInstruction(GibCPU *cpu, uint8_t cmd);
+void traceWrite(GibCPU *cpu, uint8_t addr);
+void traceDiscontinuity(GibCPU *cpu);
+void traceSync(GibCPU *cpu);
+
+// Snapshot helper (GIBCPU_Snapshot.c)
+uint64_t snapshotCycles(const GibCPUSnapshot *snapshot);
+
+// Drops the predecoded entries that read a byte (the instruction at addr, the one whose operand it is and
+// superinstructions covering it) and any translated block containing it
+static inline void invalidateCode(GibCPU *cpu, uint8_t addr){
+    cpu->decoded[addr].kind = 0;
+    cpu->decoded[(uint8_t)(addr - 1)].kind = 0;
+    for(int i = 2; i <= cpu->decoded[addr].superBack; i++){
+        cpu->decoded[(uint8_t)(addr - i)].kind = 0;
+    }
+    if(cpu->jitCovered[addr]){
+        jitInvalidate(cpu, addr);
+    }
+}
+
+// Called on every RAM write the program makes: invalidates code reading the byte, switches banks when
+// it is the bank register and records it while tracing
+static inline void ramWritten(GibCPU *cpu, uint8_t addr){
+    invalidateCode(cpu, addr);
+    if(addr == GIBCPU_BANK_SELECT && cpu->bankCount){
+        switchBank(cpu);
+    }
+    if(cpu->trace){
+        traceWrite(cpu, addr);
+    }
+}
+
+// Mirrors the print hook in progCounter() for the instruction-level engines
+static inline uint8_t countIncrement(GibCPU *cpu, uint8_t next){
+    if(next == cpu->printAddr){
+        cpu->loopCounter++;
+        if(cpu->displayHook){
+            cpu->displayHook(cpu, cpu->displayUser);
+        }
+    }
+    return next;
+}
+
+#endif
@@ -0,0 +1,577 @@
+#if defined(__linux__)
+#define _GNU_SOURCE         // memfd_create()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "GIBCPU_Internal.h"
+
+/* X86-64 JIT ENGINE */
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Host register numbers used by the translated code
+#define HOST_RAX 0
+#define HOST_RCX 1
+#define HOST_RBX 3
+#define HOST_RBP 5
+#define HOST_R12 12
+#define HOST_R13 13
+#define HOST_R14 14
+#define HOST_R15 15
+
+#define JIT_CODE_SIZE (256 * 1024)
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_WRITE_EXIT 0x100         // set in the exit value when a write hit translated code, address in bits 16-23
+#define JIT_MAX_SLICE (1 << 30)      // posEdges granted per jitEnter, so the budget fits the 32-bit accumulator
+
+// Guest reg0-reg3 live in r12, r13, r14 and rbx while translated code runs, r15 holds ram and rbp the GibJit
+static const uint8_t guestHostReg[4] = {HOST_R12, HOST_R13, HOST_R14, HOST_RBX};
+
+typedef struct {
+    uint8_t live;
+    uint8_t length;                 // bytes of guest code covered, starting at the block address
+} JitBlock;
+
+struct GibJit {
+    void *entry[MAX_VALUES];        // native entry per guest address, exitStub until translated
+    int32_t cycles;                 // minus the posEdges left in this slice; blocks exit once it reaches 0
+    uint8_t *code;                  // the code buffer mapped read/write, where blocks are emitted
+    uint8_t *exec;                  // the same pages mapped read/execute, where they run
+    uint8_t *codeEnd;               // first free byte, in the writable view
+    uint8_t *codeBlocks;            // where block code starts, after the enter/exit stubs
+    void *exitStub;                 // in the executable view, like enter and entry[]
+    uint32_t (*enter)(uint32_t pc);
+    JitBlock blocks[MAX_VALUES];
+};
+
+// Where a byte of the writable view runs
+static inline uint8_t *jitExecAddress(GibJit *j, uint8_t *p){
+    return j->exec + (p - j->code);
+}
+
+static inline void emit8(GibJit *j, uint8_t byte){
+    *j->codeEnd++ = byte;
+}
+
+static inline void emit32(GibJit *j, uint32_t value){
+    memcpy(j->codeEnd, &value, 4);
+    j->codeEnd += 4;
+}
+
+static inline void emit64(GibJit *j, uint64_t value){
+    memcpy(j->codeEnd, &value, 8);
+    j->codeEnd += 8;
+}
+
+// REX prefix, always emitted so that bl and r12b-r15b can be used as byte registers
+static inline void emitRex(GibJit *j, int w, int reg, int index, int base){
+    emit8(j, 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+}
+
+static inline void emitModRM(GibJit *j, int mod, int reg, int rm){
+    emit8(j, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// mov reg64, imm64
+static void emitMovImm64(GibJit *j, int reg, uint64_t value){
+    emitRex(j, 1, 0, 0, reg);
+    emit8(j, 0xB8 | (reg & 7));
+    emit64(j, value);
+}
+
+// <op> dst8, src8 with op one of the "r/m8, r8" ALU opcodes
+static void emitAluRegReg(GibJit *j, uint8_t opcode, int dst, int src){
+    emitRex(j, 0, src, 0, dst);
+    emit8(j, opcode);
+    emitModRM(j, 3, src, dst);
+}
+
+// Group opcodes on a byte register: not (F6 /2), shr 1 (D0 /5), shl 1 (D0 /4)
+static void emitGroupReg(GibJit *j, uint8_t opcode, int ext, int reg){
+    emitRex(j, 0, 0, 0, reg);
+    emit8(j, opcode);
+    emitModRM(j, 3, ext, reg);
+}
+
+// movzx dst32, byte [r15 + disp32]
+static void emitLoadRamConst(GibJit *j, int dst, uint8_t addr){
+    emitRex(j, 0, dst, 0, HOST_R15);
+    emit8(j, 0x0F);
+    emit8(j, 0xB6);
+    emitModRM(j, 2, dst, HOST_R15);
+    emit32(j, addr);
+}
+
+// mov byte [r15 + disp32], src8
+static void emitStoreRamConst(GibJit *j, uint8_t addr, int src){
+    emitRex(j, 0, src, 0, HOST_R15);
+    emit8(j, 0x88);
+    emitModRM(j, 2, src, HOST_R15);
+    emit32(j, addr);
+}
+
+// movzx dst32, byte [r15 + index]
+static void emitLoadRamIndexed(GibJit *j, int dst, int index){
+    emitRex(j, 0, dst, index, HOST_R15);
+    emit8(j, 0x0F);
+    emit8(j, 0xB6);
+    emitModRM(j, 0, dst, 4);
+    emitModRM(j, 0, index, HOST_R15);
+}
+
+// mov byte [r15 + index], src8
+static void emitStoreRamIndexed(GibJit *j, int index, int src){
+    emitRex(j, 0, src, index, HOST_R15);
+    emit8(j, 0x88);
+    emitModRM(j, 0, src, 4);
+    emitModRM(j, 0, index, HOST_R15);
+}
+
+// mov eax, imm32
+static void emitMovEax(GibJit *j, uint32_t value){
+    emit8(j, 0xB8);
+    emit32(j, value);
+}
+
+static void emitJmpExit(GibJit *j){
+    emit8(j, 0xE9);
+    emit32(j, (uint32_t)((uint8_t *)j->exitStub - jitExecAddress(j, j->codeEnd + 4)));
+}
+
+// add dword [rbp + offsetof(cycles)], imm32
+static void emitAddCycles(GibJit *j, uint32_t cycles){
+    emit8(j, 0x81);
+    emitModRM(j, 2, 0, HOST_RBP);
+    emit32(j, offsetof(GibJit, cycles));
+    emit32(j, cycles);
+}
+
+// Account for the block's posEdges, leave once the slice is used up, otherwise continue at the guest
+// address in eax through jmp qword [rbp + rax*8 + offsetof(entry)]
+static void emitChain(GibJit *j, uint32_t cycles){
+    emitAddCycles(j, cycles);
+    emit8(j, 0x0F);                                 // jns exitStub
+    emit8(j, 0x89);
+    emit32(j, (uint32_t)((uint8_t *)j->exitStub - jitExecAddress(j, j->codeEnd + 4)));
+    emit8(j, 0xFF);
+    emitModRM(j, 2, 4, 4);
+    emit8(j, (3 << 6) | (HOST_RAX << 3) | HOST_RBP);
+    emit32(j, offsetof(GibJit, entry));
+}
+
+// After a store: if the written byte belongs to a translated block, or is the bank register of a banked
+// machine, leave through the exit stub with JIT_WRITE_EXIT so ramWritten() runs before execution continues
+// at next. index < 0 means a constant address.
+static void emitWriteCheck(GibCPU *cpu, int index, uint8_t addr, uint8_t next, uint32_t cycles){
+    GibJit *j = cpu->jit;
+    if(index < 0 && cpu->bankCount && addr == GIBCPU_BANK_SELECT){     // always leave to switch banks
+        emitMovEax(j, next | JIT_WRITE_EXIT | ((uint32_t)addr << 16));
+        emitAddCycles(j, cycles);
+        emitJmpExit(j);
+        return;
+    }
+    emitMovImm64(j, HOST_RCX, (uint64_t)(uintptr_t)cpu->jitCovered);
+    uint8_t *bankPatch = NULL;
+    if(index >= 0 && cpu->bankCount){
+        emitRex(j, 0, 0, 0, index);                 // cmp index8, GIBCPU_BANK_SELECT
+        emit8(j, 0x80);
+        emitModRM(j, 3, 7, index);
+        emit8(j, GIBCPU_BANK_SELECT);
+        emit8(j, 0x74);                             // je to the exit path
+        bankPatch = j->codeEnd;
+        emit8(j, 0);
+    }
+    if(index < 0){
+        emitRex(j, 0, 0, 0, HOST_RCX);
+        emit8(j, 0x80);                             // cmp byte [rcx + disp32], 0
+        emitModRM(j, 2, 7, HOST_RCX);
+        emit32(j, addr);
+    }
+    else{
+        emitRex(j, 0, 0, index, HOST_RCX);
+        emit8(j, 0x80);                             // cmp byte [rcx + index], 0
+        emitModRM(j, 0, 7, 4);
+        emitModRM(j, 0, index, HOST_RCX);
+    }
+    emit8(j, 0);
+    emit8(j, 0x74);                                 // je over the exit path
+    uint8_t *patch = j->codeEnd;
+    emit8(j, 0);
+    if(bankPatch){
+        *bankPatch = (uint8_t)(j->codeEnd - (bankPatch + 1));
+    }
+    if(index < 0){
+        emitMovEax(j, next | JIT_WRITE_EXIT | ((uint32_t)addr << 16));
+    }
+    else{
+        emitRex(j, 0, HOST_RAX, 0, index);          // movzx eax, index8
+        emit8(j, 0x0F);
+        emit8(j, 0xB6);
+        emitModRM(j, 3, HOST_RAX, index);
+        emit8(j, 0xC1);                             // shl eax, 16
+        emitModRM(j, 3, 4, HOST_RAX);
+        emit8(j, 16);
+        emit8(j, 0x0D);                             // or eax, imm32
+        emit32(j, next | JIT_WRITE_EXIT);
+    }
+    emitAddCycles(j, cycles);
+    emitJmpExit(j);
+    *patch = (uint8_t)(j->codeEnd - (patch + 1));
+}
+
+// An unnamed shared memory file for the code buffer
+static int jitCodeFile(void){
+#if defined(__linux__)
+    return memfd_create("gibcpu-jit", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/gibcpu-jit-%ld-%p", (long)getpid(), (void *)name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0){
+        shm_unlink(name);
+    }
+    return fd;
+#endif
+}
+
+// Map the code buffer twice, writable for the emitter and executable for the host, so that no page is ever
+// both: translating or invalidating a block never needs an mprotect() on the way
+static int jitMapCode(GibJit *j){
+    int fd = jitCodeFile();
+    if(fd < 0){
+        return 0;
+    }
+    void *code = MAP_FAILED;
+    void *exec = MAP_FAILED;
+    if(!ftruncate(fd, JIT_CODE_SIZE)){
+        code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        exec = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(code == MAP_FAILED || exec == MAP_FAILED){
+        if(code != MAP_FAILED){
+            munmap(code, JIT_CODE_SIZE);
+        }
+        if(exec != MAP_FAILED){
+            munmap(exec, JIT_CODE_SIZE);
+        }
+        return 0;
+    }
+    j->code = code;
+    j->exec = exec;
+    return 1;
+}
+
+// Set up the context's code buffer with the enter trampoline and the shared exit stub
+static int jitInit(GibCPU *cpu){
+    if(cpu->jit){
+        return 1;
+    }
+    GibJit *j = calloc(1, sizeof(GibJit));
+    if(!j){
+        return 0;
+    }
+    if(!jitMapCode(j)){
+        free(j);
+        return 0;
+    }
+    j->codeEnd = j->code;
+
+    // exit stub: eax already holds the exit value, write the guest registers back and return it
+    j->exitStub = jitExecAddress(j, j->codeEnd);
+    emitMovImm64(j, HOST_RCX, (uint64_t)(uintptr_t)cpu->reg);
+    for(int i = 0; i < 4; i++){
+        emitRex(j, 0, guestHostReg[i], 0, HOST_RCX);    // mov byte [rcx + i], reg8
+        emit8(j, 0x88);
+        emitModRM(j, 1, guestHostReg[i], HOST_RCX);
+        emit8(j, i);
+    }
+    emitRex(j, 0, 0, 0, HOST_R15);                  // pop r15, r14, r13, r12, rbp, rbx
+    emit8(j, 0x5F);
+    emitRex(j, 0, 0, 0, HOST_R14);
+    emit8(j, 0x5E);
+    emitRex(j, 0, 0, 0, HOST_R13);
+    emit8(j, 0x5D);
+    emitRex(j, 0, 0, 0, HOST_R12);
+    emit8(j, 0x5C);
+    emit8(j, 0x5D);
+    emit8(j, 0x5B);
+    emit8(j, 0xC3);                                 // ret
+
+    // enter trampoline: uint32_t enter(uint32_t pc)
+    j->enter = (uint32_t (*)(uint32_t))(void *)jitExecAddress(j, j->codeEnd);
+    emit8(j, 0x53);                                 // push rbx, rbp, r12, r13, r14, r15
+    emit8(j, 0x55);
+    emitRex(j, 0, 0, 0, HOST_R12);
+    emit8(j, 0x54);
+    emitRex(j, 0, 0, 0, HOST_R13);
+    emit8(j, 0x55);
+    emitRex(j, 0, 0, 0, HOST_R14);
+    emit8(j, 0x56);
+    emitRex(j, 0, 0, 0, HOST_R15);
+    emit8(j, 0x57);
+    emitMovImm64(j, HOST_R15, (uint64_t)(uintptr_t)cpu->ram);
+    emitMovImm64(j, HOST_RBP, (uint64_t)(uintptr_t)j);
+    emitMovImm64(j, HOST_RCX, (uint64_t)(uintptr_t)cpu->reg);
+    for(int i = 0; i < 4; i++){
+        emitRex(j, 0, guestHostReg[i], 0, HOST_RCX);    // movzx reg32, byte [rcx + i]
+        emit8(j, 0x0F);
+        emit8(j, 0xB6);
+        emitModRM(j, 1, guestHostReg[i], HOST_RCX);
+        emit8(j, i);
+    }
+    emit8(j, 0x89);                                 // mov eax, edi
+    emitModRM(j, 3, 7, HOST_RAX);
+    emit8(j, 0xFF);                                 // jmp qword [rbp + rax*8 + offsetof(entry)]
+    emitModRM(j, 2, 4, 4);
+    emit8(j, (3 << 6) | (HOST_RAX << 3) | HOST_RBP);
+    emit32(j, offsetof(GibJit, entry));
+
+    j->codeBlocks = j->codeEnd;
+    for(int i = 0; i < MAX_VALUES; i++){
+        j->entry[i] = j->exitStub;
+    }
+    cpu->jit = j;
+    return 1;
+}
+
+int jitAvailable(void){
+    return 1;
+}
+
+// Drop every translated block and reuse the code buffer
+void jitFlush(GibCPU *cpu){
+    GibJit *j = cpu->jit;
+    memset(cpu->jitCovered, 0, MAX_VALUES);
+    if(!j){
+        return;
+    }
+    for(int i = 0; i < MAX_VALUES; i++){
+        j->entry[i] = j->exitStub;
+        j->blocks[i].live = 0;
+    }
+    j->codeEnd = j->codeBlocks;
+}
+
+void jitDestroy(GibCPU *cpu){
+    if(cpu->jit){
+        munmap(cpu->jit->code, JIT_CODE_SIZE);
+        munmap(cpu->jit->exec, JIT_CODE_SIZE);
+        free(cpu->jit);
+        cpu->jit = NULL;
+    }
+}
+
+// Drop every translated block whose guest bytes include addr
+void jitInvalidate(GibCPU *cpu, uint8_t addr){
+    GibJit *j = cpu->jit;
+    for(int start = 0; start < MAX_VALUES; start++){
+        JitBlock *b = &j->blocks[start];
+        if(b->live && (uint8_t)(addr - start) < b->length){
+            b->live = 0;
+            j->entry[start] = j->exitStub;
+            for(int i = 0; i < b->length; i++){
+                cpu->jitCovered[(uint8_t)(start + i)]--;
+            }
+        }
+    }
+}
+
+// The JIT leaves HALT, TAS and anything that hits the print address to memCtrl(), and the coprocessor to
+// runFast()
+static int jitCanTranslate(GibCPU *cpu, uint8_t pc){
+    uint8_t op = cpu->ram[pc] & 0b11110000;
+    if(op == HALT || op == TAS){
+        return 0;
+    }
+    if((uint8_t)(pc + 1) == cpu->printAddr){
+        return 0;
+    }
+    if((op == LOAD || op == WRT || op == JMPZ) && (uint8_t)(pc + 2) == cpu->printAddr){
+        return 0;
+    }
+    return 1;
+}
+
+// Translate the basic block starting at start. Returns 0 if its first instruction cannot be translated.
+static int jitTranslate(GibCPU *cpu, uint8_t start){
+    GibJit *j = cpu->jit;
+    if(!jitCanTranslate(cpu, start)){
+        return 0;
+    }
+    if(j->codeEnd + JIT_MAX_BLOCK_INSTRUCTIONS * 96 > j->code + JIT_CODE_SIZE){
+        jitFlush(cpu);
+    }
+
+    void *entry = jitExecAddress(j, j->codeEnd);
+    uint8_t pc = start;
+    uint32_t cycles = 0;
+    int ended = 0;
+    for(int n = 0; n < JIT_MAX_BLOCK_INSTRUCTIONS && !ended; n++){
+        if(n > 0 && (!jitCanTranslate(cpu, pc) || pc == start)){
+            break;
+        }
+        uint8_t cmd = cpu->ram[pc];
+        uint8_t operand = cpu->ram[(uint8_t)(pc + 1)];
+        int a = guestHostReg[(cmd & 0b1100) >> 2];
+        int b = guestHostReg[cmd & 0b11];
+        uint8_t next = pc + 1;
+
+        switch(cmd & 0b11110000){
+            case AND:
+                emitAluRegReg(j, 0x20, b, a);
+                break;
+            case OR:
+                emitAluRegReg(j, 0x08, b, a);
+                break;
+            case XOR:
+                emitAluRegReg(j, 0x30, b, a);
+                break;
+            case ADD:
+                emitAluRegReg(j, 0x00, b, a);
+                break;
+            case SUB:
+                emitAluRegReg(j, 0x28, b, a);
+                break;
+            case NOTB:
+                emitGroupReg(j, 0xF6, 2, b);
+                break;
+            case SHIFTB:
+                emitGroupReg(j, 0xD0, 5, b);
+                break;
+            case LSHIFTB:
+                emitGroupReg(j, 0xD0, 4, b);
+                break;
+            case LOAD:
+                emitLoadRamConst(j, b, operand);
+                next = pc + 2;
+                break;
+            case WRT:
+                emitStoreRamConst(j, operand, b);
+                next = pc + 2;
+                emitWriteCheck(cpu, -1, operand, next, cycles + cycleCost[cmd >> 4]);
+                break;
+            case LOADL:
+                emitLoadRamIndexed(j, b, a);
+                break;
+            case WRTL:
+                emitStoreRamIndexed(j, a, b);
+                emitWriteCheck(cpu, a, 0, next, cycles + cycleCost[cmd >> 4]);
+                break;
+            case JMPZ:
+            {
+                next = pc + 2;
+                emitRex(j, 0, b, 0, b);             // test b8, b8
+                emit8(j, 0x84);
+                emitModRM(j, 3, b, b);
+                emit8(j, 0x75);                     // jnz over the taken path
+                uint8_t *patch = j->codeEnd;
+                emit8(j, 0);
+                emitLoadRamConst(j, HOST_RAX, operand);
+                emitChain(j, cycles + JMPZ_TAKEN_COST);
+                *patch = (uint8_t)(j->codeEnd - (patch + 1));
+                emitMovEax(j, next);
+                emitChain(j, cycles + cycleCost[cmd >> 4]);
+                ended = 1;
+                break;
+            }
+            case JMP:
+                next = pc + 2;
+                emitLoadRamConst(j, HOST_RAX, operand);
+                emitChain(j, cycles + cycleCost[cmd >> 4]);
+                ended = 1;
+                break;
+            default:
+                break;
+        }
+        cycles += cycleCost[cmd >> 4];
+        pc = next;
+    }
+    if(!ended){                                     // fell off the end of the block
+        emitMovEax(j, pc);
+        emitChain(j, cycles);
+    }
+
+    JitBlock *block = &j->blocks[start];
+    block->live = 1;
+    block->length = pc - start;
+    for(int i = 0; i < block->length; i++){
+        cpu->jitCovered[(uint8_t)(start + i)]++;
+    }
+    j->entry[start] = entry;
+    return 1;
+}
+
+// Runs translated blocks, chaining between them natively, and hands anything the JIT leaves out
+// to the cycle-level model one instruction at a time. Stops at HALT or at the first block exit past limit.
+int runJit(GibCPU *cpu, uint64_t limit){
+    if(!jitInit(cpu)){
+        return 0;
+    }
+    GibJit *j = cpu->jit;
+
+    uint8_t pc = cpu->count;
+    while(!cpu->programHalt && cpu->posEdgeCounter < limit){
+        if(j->entry[pc] == j->exitStub && !jitTranslate(cpu, pc)){
+            if(isTas(cpu->ram[pc]) && tasWaitsForBus(cpu)){
+                break;
+            }
+            cpu->count = pc;
+            if((cpu->ram[pc] & 0b11110000) == TAS && !isTas(cpu->ram[pc])){
+                runFast(cpu, cpu->posEdgeCounter + 1, MAX_VALUES);     // the coprocessor, one instruction
+            }
+            else{
+                stepInstructionCycles(cpu);
+            }
+            pc = cpu->count;
+            continue;
+        }
+        uint64_t slice = limit - cpu->posEdgeCounter;
+        if(slice > JIT_MAX_SLICE){
+            slice = JIT_MAX_SLICE;
+        }
+        j->cycles = -(int32_t)slice;
+        uint32_t exit = j->enter(pc);
+        cpu->posEdgeCounter += (uint64_t)((int64_t)j->cycles + (int64_t)slice);
+        pc = exit & 0xFF;
+        if(exit & JIT_WRITE_EXIT){
+            ramWritten(cpu, exit >> 16);
+        }
+    }
+    cpu->count = pc;
+    return 1;
+}
+
+#else
+
+int jitAvailable(void){
+    return 0;
+}
+
+int runJit(GibCPU *cpu, uint64_t limit){
+    (void)cpu;
+    (void)limit;
+    return 0;
+}
+
+void jitInvalidate(GibCPU *cpu, uint8_t addr){
+    (void)cpu;
+    (void)addr;
+}
+
+void jitFlush(GibCPU *cpu){
+    memset(cpu->jitCovered, 0, MAX_VALUES);
+}
+
+void jitDestroy(GibCPU *cpu){
+    (void)cpu;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+
+#include "GIBCPU_Internal.h"
+
+/* WORK-STEALING BATCH RUNNER */
+
+typedef struct {
+    const char *path;
+    int status;             // 0 = not run, 1 = halted, 2 = out of cycle budget, 3 = image not loaded
+    uint64_t cycles;
+    uint64_t loops;
+    uint64_t digest;        // FNV-1a of the final RAM
+} Job;
+
+// Per-worker deque of job indices. The owner takes from the bottom, thieves take from the top.
+typedef struct {
+    pthread_mutex_t lock;
+    int *jobs;
+    int top;
+    int bottom;
+} JobDeque;
+
+typedef struct {
+    Job *jobs;
+    JobDeque *deques;
+    int workerCount;
+    uint64_t budget;
+} JobPool;
+
+typedef struct {
+    JobPool *pool;
+    int id;
+    int failed;             // set when the worker could not create its context and ran no jobs
+} Worker;
+
+static uint64_t fnv1a(const uint8_t *data, size_t length){
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < length; i++){
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Pops from the bottom of the worker's own deque, then tries to steal from the top of the others
+static int nextJob(JobPool *pool, int id){
+    int job = -1;
+    JobDeque *own = &pool->deques[id];
+    pthread_mutex_lock(&own->lock);
+    if(own->bottom > own->top){
+        job = own->jobs[--own->bottom];
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for(int i = 1; job < 0 && i < pool->workerCount; i++){
+        JobDeque *victim = &pool->deques[(id + i) % pool->workerCount];
+        pthread_mutex_lock(&victim->lock);
+        if(victim->bottom > victim->top){
+            job = victim->jobs[victim->top++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+// Runs one job on the worker's context, which is reloaded for every image
+static void runJob(GibCPU *cpu, Job *job, uint64_t budget){
+    gibcpuSetDisplay(cpu, GIBCPU_DEFAULT_PRINT_ADDR, NULL, NULL);      // undo the previous image's print address
+    if(!gibcpuLoadImageFile(cpu, job->path, NULL)){
+        job->status = 3;
+        return;
+    }
+    job->status = gibcpuRun(cpu, budget) ? 1 : 2;
+    job->cycles = cpu->posEdgeCounter;
+    job->loops = cpu->loopCounter;
+    job->digest = fnv1a(cpu->ram, MAX_VALUES);
+}
+
+static void *workerMain(void *arg){
+    Worker *w = arg;
+    GibCPU *cpu = gibcpuCreate();
+    int job;
+    if(!cpu){                       // the other workers steal this one's slice
+        w->failed = 1;
+        return NULL;
+    }
+    gibcpuSetEngine(cpu, GIBCPU_ENGINE_FAST);
+    while((job = nextJob(w->pool, w->id)) >= 0){
+        runJob(cpu, &w->pool->jobs[job], w->pool->budget);
+    }
+    gibcpuDestroy(cpu);
+    return NULL;
+}
+
+static void freePaths(char **paths, int n){
+    for(int i = 0; paths && i < n; i++){
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+// Appends path, which is NULL if it could not be allocated, growing the list as needed. Returns 0 if out of memory.
+static int addPath(char ***paths, int *capacity, int n, char *path){
+    if(!path){
+        return 0;
+    }
+    if(n == *capacity){
+        char **grown = realloc(*paths, *capacity * 2 * sizeof(char *));
+        if(!grown){
+            free(path);
+            return 0;
+        }
+        *paths = grown;
+        *capacity *= 2;
+    }
+    (*paths)[n] = path;
+    return 1;
+}
+
+// Collects RAM image paths from a directory, or from a manifest with one path per line. Returns the path
+// count, or -1 with nothing left allocated.
+static int collectJobs(const char *source, char ***paths){
+    int capacity = 64;
+    int n = 0;
+    int collected = 1;
+    *paths = malloc(capacity * sizeof(char *));
+    if(!*paths){
+        perror("Error collecting jobs");
+        return -1;
+    }
+
+    DIR *dir = opendir(source);
+    if(dir){
+        struct dirent *entry;
+        while(collected && (entry = readdir(dir))){
+            if(entry->d_name[0] == '.'){
+                continue;
+            }
+            size_t length = strlen(source) + strlen(entry->d_name) + 2;
+            char *path = malloc(length);
+            if(path){
+                snprintf(path, length, "%s/%s", source, entry->d_name);
+            }
+            collected = addPath(paths, &capacity, n, path);
+            n += collected;
+        }
+        closedir(dir);
+    }
+    else{
+        FILE *manifest = fopen(source, "r");
+        if(!manifest){
+            perror("Error opening job source");
+            free(*paths);
+            *paths = NULL;
+            return -1;
+        }
+        char line[4096];
+        while(collected && fgets(line, sizeof(line), manifest)){
+            line[strcspn(line, "\r\n")] = 0;
+            if(line[0] == 0 || line[0] == '#'){
+                continue;
+            }
+            collected = addPath(paths, &capacity, n, strdup(line));
+            n += collected;
+        }
+        fclose(manifest);
+    }
+    if(!collected){
+        perror("Error collecting jobs");
+        freePaths(*paths, n);
+        *paths = NULL;
+        return -1;
+    }
+    return n;
+}
+
+static int comparePaths(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Writes one line per job to outFile. Returns 1 if the file could not be written or a job was never run.
+static int writeResults(const char *outFile, const Job *jobs, int jobCount){
+    FILE *out = fopen(outFile, "w");
+    if(!out){
+        perror("Error opening output file");
+        return 1;
+    }
+    const char *statusNames[] = {"notrun", "halted", "budget", "error"};
+    int halted = 0;
+    int notRun = 0;
+    fprintf(out, "# image\tstatus\tcycles\tloops\tram_fnv1a64\n");
+    for(int i = 0; i < jobCount; i++){
+        const Job *job = &jobs[i];
+        fprintf(out, "%s\t%s\t%llu\t%llu\t%016llx\n", job->path, statusNames[job->status],
+                (unsigned long long)job->cycles, (unsigned long long)job->loops, (unsigned long long)job->digest);
+        halted += (job->status == 1);
+        notRun += (job->status == 0);
+    }
+    if(fclose(out)){
+        perror("Error writing output file");
+        return 1;
+    }
+    printf("%d of %d images halted, results written to %s\n", halted, jobCount, outFile);
+    if(notRun){
+        printf("%d images were not run\n", notRun);
+    }
+    return notRun != 0;
+}
+
+// Runs every image from source across threadCount workers and writes one line per image
+int gibcpuRunJobs(const char *source, const char *outFile, int threadCount, uint64_t budget){
+    char **paths;
+    int jobCount = collectJobs(source, &paths);
+    if(jobCount < 0){
+        return 1;
+    }
+    qsort(paths, jobCount, sizeof(char *), comparePaths);
+    if(threadCount < 1){
+        threadCount = 1;
+    }
+
+    JobPool pool;
+    pool.jobs = calloc(jobCount ? jobCount : 1, sizeof(Job));
+    pool.deques = calloc(threadCount, sizeof(JobDeque));
+    pool.workerCount = threadCount;
+    pool.budget = budget;
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    Worker *workers = calloc(threadCount, sizeof(Worker));
+    int ready = pool.jobs && pool.deques && threads && workers;
+    for(int i = 0; ready && i < jobCount; i++){
+        pool.jobs[i].path = paths[i];
+    }
+    // deal out contiguous slices, stealing evens out whatever imbalance remains
+    int dealt = 0;
+    for(int w = 0; ready && w < threadCount; w++){
+        JobDeque *d = &pool.deques[w];
+        int first = (int)((long)jobCount * w / threadCount);
+        int last = (int)((long)jobCount * (w + 1) / threadCount);
+        d->jobs = malloc((last - first + 1) * sizeof(int));
+        if(!d->jobs){
+            ready = 0;
+            break;
+        }
+        pthread_mutex_init(&d->lock, NULL);
+        dealt++;
+        d->top = 0;
+        d->bottom = 0;
+        for(int i = last - 1; i >= first; i--){     // bottom of the deque is the front of the slice
+            d->jobs[d->bottom++] = i;
+        }
+    }
+    if(!ready){
+        perror("Error preparing jobs");
+    }
+
+    // workers that did start steal the slices of any that did not
+    int started = 0;
+    for(int w = 0; ready && w < threadCount; w++){
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        if(pthread_create(&threads[w], NULL, workerMain, &workers[w])){
+            break;
+        }
+        started++;
+    }
+    for(int w = 0; w < started; w++){
+        pthread_join(threads[w], NULL);
+    }
+    int failed = 0;
+    for(int w = 0; w < started; w++){
+        failed += workers[w].failed;
+    }
+    if(ready && started < threadCount){
+        printf("Started %d of %d worker threads\n", started, threadCount);
+    }
+    if(failed){
+        printf("%d of %d workers could not create a machine\n", failed, started);
+    }
+
+    int result = !ready || !started || writeResults(outFile, pool.jobs, jobCount);
+    for(int w = 0; w < dealt; w++){
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].jobs);
+    }
+    freePaths(paths, jobCount);
+    free(pool.jobs);
+    free(pool.deques);
+    free(threads);
+    free(workers);
+    return result;
+}
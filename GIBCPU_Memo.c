@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+/* STATE MEMOIZATION */
+
+// Machine state seen at the memo address, in visit order: the entry after each one is the next state
+// the machine reached there, and the difference in cycles and loops is what the stretch between them cost.
+// At an instruction boundary ram[] and reg[] are the whole state, the program counter is the memo address.
+typedef struct {
+    uint8_t ram[MAX_VALUES];
+    uint8_t reg[4];
+    uint64_t hash;
+    uint64_t cycles;
+    uint64_t loops;
+} MemoState;
+
+struct GibMemo {
+    uint8_t addr;
+    int capacity;
+    int count;
+    int slotMask;
+    int *slots;                 // open-addressed hash index into states, -1 = empty
+    MemoState *states;
+    uint64_t skipped;           // posEdges fast-forwarded so far
+};
+
+static uint64_t hashState(const GibCPU *cpu){
+    uint64_t hash = 14695981039346656037ULL;
+    for(int i = 0; i < MAX_VALUES; i++){
+        hash ^= cpu->ram[i];
+        hash *= 1099511628211ULL;
+    }
+    for(int i = 0; i < 4; i++){
+        hash ^= cpu->reg[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int sameState(const MemoState *state, const GibCPU *cpu){
+    return !memcmp(state->ram, cpu->ram, MAX_VALUES) && !memcmp(state->reg, cpu->reg, 4);
+}
+
+// Looks the current state up, recording it if it is new. Returns the index of the earlier visit or -1.
+static int memoVisit(GibMemo *m, GibCPU *cpu){
+    uint64_t hash = hashState(cpu);
+    int slot = (int)hash & m->slotMask;
+    while(m->slots[slot] >= 0){
+        MemoState *state = &m->states[m->slots[slot]];
+        if(state->hash == hash && sameState(state, cpu)){
+            return m->slots[slot];
+        }
+        slot = (slot + 1) & m->slotMask;
+    }
+    if(m->count == m->capacity){                    // table full, start the history over
+        memoClear(cpu);
+        return memoVisit(m, cpu);
+    }
+    MemoState *state = &m->states[m->count];
+    memcpy(state->ram, cpu->ram, MAX_VALUES);
+    memcpy(state->reg, cpu->reg, 4);
+    state->hash = hash;
+    state->cycles = cpu->posEdgeCounter;
+    state->loops = cpu->loopCounter;
+    m->slots[slot] = m->count++;
+    return -1;
+}
+
+// The machine is back in the state of visit first, so it repeats the same period until limit. Skip the whole
+// periods, then step through the recorded visits while they still end before limit.
+static void memoFastForward(GibMemo *m, GibCPU *cpu, int first, uint64_t limit){
+    MemoState *start = &m->states[first];
+    uint64_t period = cpu->posEdgeCounter - start->cycles;
+    uint64_t periodLoops = cpu->loopCounter - start->loops;
+    uint64_t periods = (limit - cpu->posEdgeCounter) / period;
+    cpu->posEdgeCounter += periods * period;
+    cpu->loopCounter += periods * periodLoops;
+    m->skipped += periods * period;
+
+    uint64_t base = cpu->posEdgeCounter - start->cycles;
+    uint64_t baseLoops = cpu->loopCounter - start->loops;
+    int last = first;
+    while(last + 1 < m->count && base + m->states[last + 1].cycles < limit){
+        last++;
+    }
+    if(last != first){
+        MemoState *state = &m->states[last];
+        m->skipped += state->cycles - start->cycles;
+        memcpy(cpu->ram, state->ram, MAX_VALUES);
+        memcpy(cpu->reg, state->reg, 4);
+        cpu->posEdgeCounter = base + state->cycles;
+        cpu->loopCounter = baseLoops + state->loops;
+        memset(cpu->decoded, 0, sizeof(cpu->decoded));
+        jitFlush(cpu);
+    }
+}
+
+// Runs on the fast engine, stopping at every visit to the memo address. Once a state repeats, the machine is
+// in a loop and the rest of the budget is fast-forwarded. The display hook is not called for skipped periods.
+void runMemo(GibCPU *cpu, uint64_t limit){
+    GibMemo *m = cpu->memo;
+    while(!cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+        if(cpu->count == m->addr){
+            int first = memoVisit(m, cpu);
+            if(first >= 0){
+                memoFastForward(m, cpu, first, limit);
+                memoClear(cpu);
+                runFast(cpu, limit, MAX_VALUES);
+                return;
+            }
+        }
+        runFast(cpu, limit, m->addr);
+    }
+}
+
+void memoClear(GibCPU *cpu){
+    GibMemo *m = cpu->memo;
+    if(!m || m->count == 0){
+        return;
+    }
+    m->count = 0;
+    memset(m->slots, 0xFF, (m->slotMask + 1) * sizeof(int));
+}
+
+void memoDestroy(GibCPU *cpu){
+    if(cpu->memo){
+        free(cpu->memo->slots);
+        free(cpu->memo->states);
+        free(cpu->memo);
+        cpu->memo = NULL;
+    }
+}
+
+int gibcpuEnableMemo(GibCPU *cpu, uint8_t addr, int capacity){
+    memoDestroy(cpu);
+    if(capacity <= 0){
+        return 0;
+    }
+    GibMemo *m = calloc(1, sizeof(GibMemo));
+    int slots = 1;
+    while(slots < capacity * 2){
+        slots *= 2;
+    }
+    if(m){
+        m->slots = malloc(slots * sizeof(int));
+        m->states = malloc(capacity * sizeof(MemoState));
+    }
+    if(!m || !m->slots || !m->states){
+        if(m){
+            free(m->slots);
+            free(m->states);
+        }
+        free(m);
+        return 1;
+    }
+    m->addr = addr;
+    m->capacity = capacity;
+    m->slotMask = slots - 1;
+    memset(m->slots, 0xFF, slots * sizeof(int));
+    cpu->memo = m;
+    return 0;
+}
+
+uint64_t gibcpuMemoSkipped(const GibCPU *cpu){
+    return cpu->memo ? cpu->memo->skipped : 0;
+}
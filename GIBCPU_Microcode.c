@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "GIBCPU_Internal.h"
+
+/* MICROCODE DESCRIPTION */
+
+// Command classes as bits of MicroRule.classes
+#define C_ALU   0x001
+#define C_LOAD  0x002
+#define C_WRT   0x004
+#define C_JMPZ  0x008
+#define C_JMP   0x010
+#define C_LOADL 0x020
+#define C_WRTL  0x040
+#define C_TAS   0x080
+#define C_MUL   0x100
+#define C_POPC  0x200
+#define C_BSUM  0x400
+#define C_HALT  0x800
+#define C_ANY   0xFFF
+
+// The first rule of a state matching the command class and the condition bits (value under mask) runs
+typedef struct {
+    uint8_t state;
+    uint8_t wait;           // ACK_* bits, the same for every rule of a state
+    uint16_t classes;
+    uint8_t condMask;
+    uint8_t condValue;
+    uint8_t next;
+    uint8_t ops[MICRO_MAX_OPS];
+    uint8_t length;
+} MicroRule;
+
+#define OPS(...) {__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__})
+
+// The control unit as designed: every request to the program counter, register bank or RAM is raised on one
+// posEdge and dropped once the module acknowledges it on a later one
+static const MicroRule rules[] = {
+    {0, 0, C_ALU, 0, 0, 1, OPS(UOP_FETCH)},                                 // get next ram data
+    {0, 0, C_ANY, 0, 0, 2, OPS(UOP_FETCH)},
+    {1, 0, C_ANY, 0, 0, 19, OPS(UOP_SET_REG)},                              // ALU op
+    {2, 0, C_LOADL | C_WRTL, 0, 0, 3, OPS(UOP_BOOKMARK)},
+    {2, 0, C_ANY, 0, 0, 4, OPS(UOP_BOOKMARK)},
+    {3, 0, C_ANY, 0, 0, 6, OPS(UOP_COUNT_REGA)},
+    {4, 0, C_ANY, 0, 0, 5, OPS(UOP_INC)},
+    {5, ACK_INC, C_ANY, 0, 0, 6, OPS(UOP_CLR_INC, UOP_COUNT_DATA)},
+    {6, 0, C_ANY, 0, 0, 7, OPS(UOP_SET_COUNT)},
+    {7, ACK_COUNT, C_LOAD | C_LOADL, 0, 0, 8, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_WRT | C_WRTL, 0, 0, 9, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_JMPZ, COND_ZERO, COND_ZERO, 15, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_JMPZ, 0, 0, 11, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_JMP, 0, 0, 15, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_HALT, 0, 0, 18, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_TAS, 0, 0, 21, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_MUL, 0, 0, 23, OPS(UOP_CLR_COUNT, UOP_MDATA, UOP_ACC_CLEAR, UOP_LEFT_FOUR)},
+    {7, ACK_COUNT, C_POPC, 0, 0, 24, OPS(UOP_CLR_COUNT, UOP_MDATA)},
+    {7, ACK_COUNT, C_BSUM, 0, 0, 25, OPS(UOP_CLR_COUNT, UOP_MDATA, UOP_ACC_CLEAR, UOP_LEFT_MDATA, UOP_COUNT_REGB)},
+    {8, 0, C_ANY, 0, 0, 20, OPS(UOP_REG_MDATA, UOP_SET_REG)},               // LOAD or LOADL
+    {9, 0, C_ANY, 0, 0, 10, OPS(UOP_RAM_REGB, UOP_SET_RAM)},                // WRT or WRTL
+    {10, ACK_RAM, C_ANY, 0, 0, 11, OPS(UOP_CLR_RAM)},
+    {11, 0, C_ANY, 0, 0, 12, OPS(UOP_COUNT_BOOKMARK, UOP_SET_COUNT)},       // return to bookmark
+    {12, ACK_COUNT, C_LOADL | C_WRTL, 0, 0, 17, OPS(UOP_CLR_COUNT, UOP_INC)},
+    {12, ACK_COUNT, C_ANY, 0, 0, 13, OPS(UOP_CLR_COUNT, UOP_INC)},          // increment past the second byte too
+    {13, ACK_INC, C_ANY, 0, 0, 14, OPS(UOP_CLR_INC)},
+    {14, 0, C_ANY, 0, 0, 17, OPS(UOP_INC)},
+    {15, 0, C_ANY, 0, 0, 16, OPS(UOP_COUNT_MDATA, UOP_SET_COUNT)},          // JMP or passing JMPZ
+    {16, ACK_COUNT, C_ANY, 0, 0, 0, OPS(UOP_CLR_COUNT)},
+    {17, ACK_INC, C_ANY, 0, 0, 0, OPS(UOP_CLR_INC)},
+    {18, 0, C_ANY, 0, 0, 18, OPS(UOP_HALT)},
+    {19, ACK_REG, C_ANY, 0, 0, 17, OPS(UOP_CLR_REG, UOP_INC)},
+    {20, ACK_REG, C_ANY, 0, 0, 11, OPS(UOP_CLR_REG)},
+    {21, 0, C_ANY, 0, 0, 22, OPS(UOP_REG_MDATA, UOP_SET_REG, UOP_RAM_ONE, UOP_SET_RAM)},   // TAS
+    {22, ACK_REG | ACK_RAM, C_ANY, 0, 0, 11, OPS(UOP_CLR_REG, UOP_CLR_RAM)},
+    {23, 0, C_ANY, COND_LAST, COND_LAST, 20, OPS(UOP_MUL_STEP, UOP_REG_ACC, UOP_SET_REG)}, // MUL
+    {23, 0, C_ANY, 0, 0, 23, OPS(UOP_MUL_STEP)},
+    {24, 0, C_ANY, 0, 0, 20, OPS(UOP_REG_POPC, UOP_SET_REG)},               // POPC
+    {25, 0, C_ANY, COND_DONE, COND_DONE, 20, OPS(UOP_REG_ACC, UOP_SET_REG)}, // BSUM
+    {25, 0, C_ANY, 0, 0, 26, OPS(UOP_SET_COUNT)},
+    {26, ACK_COUNT, C_ANY, 0, 0, 25, OPS(UOP_CLR_COUNT, UOP_ACC_ADD)}
+};
+
+/* ROM GENERATOR */
+
+MicroRom microcodeRoms[MICROCODE_VARIANTS];
+uint8_t microClass[MAX_VALUES];
+
+static pthread_once_t microcodeOnce = PTHREAD_ONCE_INIT;
+
+// Each request, its acknowledge, the micro-op waiting for that, the one that drops the request and the one that
+// carries it out at once
+static const uint8_t requests[][5] = {
+    {UOP_SET_COUNT, ACK_COUNT, UOP_WAIT_COUNT, UOP_CLR_COUNT, UOP_DO_COUNT},
+    {UOP_INC, ACK_INC, UOP_WAIT_INC, UOP_CLR_INC, UOP_DO_INC},
+    {UOP_SET_REG, ACK_REG, UOP_WAIT_REG, UOP_CLR_REG, UOP_DO_REG},
+    {UOP_SET_RAM, ACK_RAM, UOP_WAIT_RAM, UOP_CLR_RAM, UOP_DO_RAM}
+};
+
+// Modules reading what a micro-op drives: command, setReg / memCtrlReg, setCount / memCtrlCount /
+// incrementCount and setRAM / memCtrlRAM. Collapsed requests wake the modules they bypass themselves.
+static uint8_t opDrives(uint8_t op){
+    switch(op){
+        case UOP_FETCH:
+            return MODULE_REGBANK | MODULE_REGPATHSET | MODULE_ALU;
+        case UOP_CLR_COUNT:
+        case UOP_CLR_INC:
+        case UOP_COUNT_REGA:
+        case UOP_COUNT_DATA:
+        case UOP_COUNT_BOOKMARK:
+        case UOP_COUNT_MDATA:
+        case UOP_COUNT_REGB:
+        case UOP_ACC_ADD:
+        case UOP_SET_COUNT:
+        case UOP_INC:
+            return MODULE_PROGCOUNTER;
+        case UOP_CLR_REG:
+        case UOP_REG_MDATA:
+        case UOP_REG_ACC:
+        case UOP_REG_POPC:
+        case UOP_SET_REG:
+            return MODULE_REGBANK;
+        case UOP_CLR_RAM:
+        case UOP_RAM_REGB:
+        case UOP_RAM_ONE:
+        case UOP_SET_RAM:
+            return MODULE_RAM;
+        default:
+            return 0;
+    }
+}
+
+static int classOf(uint8_t cmd){
+    switch(cmd & 0b11110000){
+        case LOAD:
+            return 1;
+        case WRT:
+            return 2;
+        case JMPZ:
+            return 3;
+        case JMP:
+            return 4;
+        case LOADL:
+            return 5;
+        case WRTL:
+            return 6;
+        case TAS:
+            return 7 + ((cmd & 0b1100) >> 2);   // TAS, MUL, POPC, BSUM
+        case HALT:
+            return 11;
+        default:
+            return 0;
+    }
+}
+
+static const MicroRule *findRule(uint8_t state, int key){
+    int class = key / MICRO_CONDITIONS;
+    int cond = key % MICRO_CONDITIONS;
+    for(size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++){
+        const MicroRule *r = &rules[i];
+        if(r->state == state && (r->classes >> class & 1) && (cond & r->condMask) == r->condValue){
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static int hasOp(const MicroInstruction *u, uint8_t op){
+    return memchr(u->ops, op, u->length) != NULL;
+}
+
+// Collapsed microcode: while the microinstruction raises requests and the state it moves to does nothing but
+// wait for exactly their acknowledges first, carry the requests out on this posEdge and run that state's
+// micro-ops, minus dropping the requests, straight after. The condition bits come from the start of the
+// posEdge, so a state testing coprocLeft is only merged in when nothing before it changes coprocLeft (no
+// micro-op changes regB).
+static void collapse(MicroInstruction *u, int key){
+    for(;;){
+        uint8_t acks = 0;
+        for(int i = 0; i < 4; i++){
+            acks |= hasOp(u, requests[i][0]) ? requests[i][1] : 0;
+        }
+        const MicroRule *after = findRule(u->next, key);
+        if(!acks || !after || after->wait != acks || u->length + after->length > MICRO_MAX_OPS){
+            return;
+        }
+        if(after->condMask & (COND_DONE | COND_LAST) &&
+           (hasOp(u, UOP_LEFT_FOUR) || hasOp(u, UOP_LEFT_MDATA) || hasOp(u, UOP_MUL_STEP) || hasOp(u, UOP_ACC_ADD))){
+            return;
+        }
+        for(int i = 0; i < u->length; i++){
+            for(int j = 0; j < 4; j++){
+                u->ops[i] = u->ops[i] == requests[j][0] ? requests[j][4] : u->ops[i];
+            }
+        }
+        for(int i = 0; i < after->length; i++){
+            int dropped = 0;
+            for(int j = 0; j < 4; j++){
+                dropped |= after->ops[i] == requests[j][3] && (acks & requests[j][1]);
+            }
+            if(!dropped){
+                u->ops[u->length++] = after->ops[i];
+            }
+        }
+        u->next = after->next;
+    }
+}
+
+// Index of microinstruction u in the ROM, added if no identical one is there yet
+static uint8_t intern(MicroRom *rom, const MicroInstruction *u){
+    for(int i = 0; i < rom->count; i++){
+        if(!memcmp(&rom->micro[i], u, sizeof(MicroInstruction))){
+            return i;
+        }
+    }
+    if(rom->count == MICRO_MAX){
+        fprintf(stderr, "GIBCPU: more than %d distinct microinstructions\n", MICRO_MAX);
+        abort();
+    }
+    rom->micro[rom->count] = *u;
+    return rom->count++;
+}
+
+static void buildRom(MicroRom *rom, int collapsed){
+    memset(rom, 0, sizeof(MicroRom));
+    for(int state = 0; state < MEMCTRL_STATES; state++){
+        for(int key = 0; key < MICRO_KEYS; key++){
+            const MicroRule *r = findRule(state, key);
+            MicroInstruction u;
+            memset(&u, 0, sizeof(u));
+            u.next = state;                 // no rule: stay put, as memCtrl() did on an unexpected command
+            if(r){
+                u.next = r->next;
+                for(int j = 0; j < 4; j++){
+                    if(r->wait & requests[j][1]){
+                        u.ops[u.length++] = requests[j][2];
+                    }
+                }
+                memcpy(u.ops + u.length, r->ops, r->length);
+                u.length += r->length;
+                if(collapsed){
+                    collapse(&u, key);
+                }
+            }
+            for(int i = 0; i < u.length; i++){
+                rom->drives[state] |= opDrives(u.ops[i]);
+            }
+            rom->entry[state][key] = intern(rom, &u);
+        }
+        for(int key = 0; key < MICRO_KEYS; key++){     // so memCtrl() only works out the bits that matter
+            for(int bit = 1; bit < MICRO_CONDITIONS; bit <<= 1){
+                if(rom->entry[state][key] != rom->entry[state][key & ~bit]){
+                    rom->tests[state] |= bit;
+                }
+            }
+        }
+    }
+}
+
+static void buildMicrocode(void){
+    for(int cmd = 0; cmd < MAX_VALUES; cmd++){
+        microClass[cmd] = classOf(cmd);
+    }
+    buildRom(&microcodeRoms[GIBCPU_MICROCODE_HANDSHAKE], 0);
+    buildRom(&microcodeRoms[GIBCPU_MICROCODE_COLLAPSED], 1);
+}
+
+void microcodeInit(void){
+    pthread_once(&microcodeOnce, buildMicrocode);
+}
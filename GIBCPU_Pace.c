@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "GIBCPU_Internal.h"
+
+/* REAL-TIME PACING */
+
+#define PACE_DEFAULT_PERIOD 1e-3
+#define PACE_FIRST_MARGIN 100000    // nanoseconds spun before the OS has shown how late it wakes
+#define PACE_MAX_GROWTH 64          // batches grow to at most this many periods while the loop is behind
+#define PACE_SUB_BUCKETS 16         // lateness histogram: 16 buckets per power of two nanoseconds
+#define PACE_BUCKETS (PACE_SUB_BUCKETS + 60 * PACE_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t histogram[PACE_BUCKETS];   // batch lateness in nanoseconds, within 1/16 of the value
+    uint64_t margin;                    // nanoseconds before the due time to stop sleeping and spin
+} Pace;
+
+static uint64_t nowNs(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int bucketOf(uint64_t ns){
+    if(ns < PACE_SUB_BUCKETS){
+        return ns;
+    }
+    int octave = 63 - __builtin_clzll(ns);
+    int bucket = PACE_SUB_BUCKETS + (octave - 4) * PACE_SUB_BUCKETS + ((ns >> (octave - 4)) & (PACE_SUB_BUCKETS - 1));
+    return bucket < PACE_BUCKETS ? bucket : PACE_BUCKETS - 1;
+}
+
+// Middle of a bucket's range
+static double bucketValue(int bucket){
+    if(bucket < PACE_SUB_BUCKETS){
+        return bucket;
+    }
+    int octave = (bucket - PACE_SUB_BUCKETS) / PACE_SUB_BUCKETS + 4;
+    uint64_t low = (uint64_t)(PACE_SUB_BUCKETS + bucket % PACE_SUB_BUCKETS) << (octave - 4);
+    return low + ((uint64_t)1 << (octave - 4)) / 2.0;
+}
+
+// Lateness in seconds below which a share of the batches finished, no more than the largest seen
+static double percentile(const Pace *p, const GibCPUPaceStats *stats, double share){
+    uint64_t rank = (uint64_t)(share * stats->batches);
+    uint64_t seen = 0;
+    for(int i = 0; i < PACE_BUCKETS; i++){
+        seen += p->histogram[i];
+        if(seen > rank){
+            double value = bucketValue(i) / 1e9;
+            return value < stats->latenessMax ? value : stats->latenessMax;
+        }
+    }
+    return stats->latenessMax;
+}
+
+// Wait for the due time: sleep until the spin margin before it, then spin. The margin tracks how late the OS
+// usually wakes, quickly upwards and slowly back down, so a rare long oversleep costs a late batch rather than
+// spinning for a long time afterwards. It stays under maxMargin. Returns the time it got there.
+static uint64_t waitUntil(Pace *p, uint64_t due, int spin, uint64_t maxMargin, GibCPUPaceStats *stats){
+    uint64_t now = nowNs();
+    uint64_t wake = spin ? due - (p->margin < due ? p->margin : due) : due;
+    if(now < wake){
+        struct timespec t = {wake / 1000000000ULL, wake % 1000000000ULL};
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)){     // again if a signal woke it
+        }
+        now = nowNs();
+        uint64_t over = now - wake;
+        if(over > p->margin){
+            p->margin += (over - p->margin) / 4;
+        }
+        else{
+            p->margin -= (p->margin - over) / 64;
+        }
+        p->margin = p->margin < maxMargin ? p->margin : maxMargin;
+    }
+    if(spin && now < due){
+        uint64_t spinStart = now;
+        while(now < due){
+            now = nowNs();
+        }
+        stats->spinSeconds += (now - spinStart) / 1e9;
+    }
+    return now;
+}
+
+int gibcpuRunPaced(GibCPU *cpu, uint64_t budget, const GibCPUPaceConfig *config, GibCPUPaceStats *stats){
+    memset(stats, 0, sizeof(GibCPUPaceStats));
+    stats->config = *config;
+    if(stats->config.period <= 0){
+        stats->config.period = PACE_DEFAULT_PERIOD;
+    }
+    if(config->hz <= 0){
+        return gibcpuRun(cpu, budget);
+    }
+    Pace *p = calloc(1, sizeof(Pace));
+    if(!p){
+        return gibcpuRun(cpu, budget);
+    }
+    p->margin = PACE_FIRST_MARGIN;
+    if(p->margin > stats->config.period * 0.5e9){
+        p->margin = stats->config.period * 0.5e9;
+    }
+    uint64_t limit = cpu->posEdgeCounter + budget;
+    if(limit < cpu->posEdgeCounter){
+        limit = UINT64_MAX;
+    }
+
+    double hz = config->hz;
+    uint64_t baseBatch = hz * stats->config.period;
+    baseBatch = baseBatch ? baseBatch : 1;
+    uint64_t batch = baseBatch;
+    uint64_t first = cpu->posEdgeCounter;
+    uint64_t start = nowNs();
+    uint64_t now = start;
+    int halted = cpu->programHalt;
+    double latenessSum = 0;
+    stats->minBatch = UINT64_MAX;
+
+    while(!halted && cpu->posEdgeCounter < limit){
+        uint64_t before = cpu->posEdgeCounter;
+        uint64_t runStart = now;
+        halted = gibcpuRun(cpu, batch < limit - before ? batch : limit - before);
+        uint64_t ran = cpu->posEdgeCounter - before;
+        now = nowNs();
+        stats->runSeconds += (now - runStart) / 1e9;
+        if(!ran && !halted){
+            break;              // a multi-core system's core waiting for the bus, nothing to pace
+        }
+
+        // when the emulated clock at the end of the batch is due, with exact rounding from the start
+        uint64_t due = start + (uint64_t)((cpu->posEdgeCounter - first) / hz * 1e9);
+        uint64_t lateness;
+        if(now >= due){
+            lateness = now - due;
+            stats->lateBatches++;
+            if(batch < baseBatch * PACE_MAX_GROWTH){
+                batch *= 2;     // fewer wakeups leave more of each period for the machine
+            }
+        }
+        else{
+            now = waitUntil(p, due, config->spin, baseBatch / hz * 0.5e9, stats);
+            lateness = now - due;
+            if(batch > baseBatch){
+                batch /= 2;     // on time again: space the emulated clock finely again
+            }
+        }
+        p->histogram[bucketOf(lateness)]++;
+        latenessSum += lateness;
+        if(lateness > stats->latenessMax * 1e9){
+            stats->latenessMax = lateness / 1e9;
+        }
+        stats->batches++;
+        stats->minBatch = ran < stats->minBatch ? ran : stats->minBatch;
+        stats->maxBatch = ran > stats->maxBatch ? ran : stats->maxBatch;
+    }
+
+    stats->posEdges = cpu->posEdgeCounter - first;
+    stats->seconds = (now - start) / 1e9;
+    stats->rate = stats->seconds > 0 ? stats->posEdges / stats->seconds : 0.0;
+    if(stats->batches){
+        stats->latenessMean = latenessSum / stats->batches / 1e9;
+        stats->latenessP50 = percentile(p, stats, 0.5);
+        stats->latenessP90 = percentile(p, stats, 0.9);
+        stats->latenessP99 = percentile(p, stats, 0.99);
+        stats->latenessP999 = percentile(p, stats, 0.999);
+    }
+    else{
+        stats->minBatch = 0;
+    }
+    free(p);
+    return halted;
+}
+
+/* REPORT */
+
+void gibcpuPrintPace(const GibCPUPaceStats *stats, FILE *out){
+    double seconds = stats->seconds > 0 ? stats->seconds : 1.0;
+    fprintf(out, "\nPACING: %.0f posEdges/s target, %.3f ms batches, %s\n", stats->config.hz,
+            stats->config.period * 1e3, stats->config.spin ? "sleeping then spinning" : "sleeping only");
+    fprintf(out, "\n%-22s %16.1f posEdges/s  %+.1f ppm\n", "achieved", stats->rate,
+            stats->config.hz > 0 ? (stats->rate / stats->config.hz - 1) * 1e6 : 0.0);
+    fprintf(out, "%-22s %16llu  %llu late, %llu to %llu posEdges each\n", "batches",
+            (unsigned long long)stats->batches, (unsigned long long)stats->lateBatches,
+            (unsigned long long)stats->minBatch, (unsigned long long)stats->maxBatch);
+    fprintf(out, "%-22s %16.6f s  running %.1f%%, spinning %.1f%%\n", "wall clock", stats->seconds,
+            100.0 * stats->runSeconds / seconds, 100.0 * stats->spinSeconds / seconds);
+    fprintf(out, "\n%-22s %10s %10s %10s %10s %10s %10s\n", "lateness (us)", "p50", "p90", "p99", "p99.9",
+            "max", "mean");
+    fprintf(out, "%-22s %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", "", stats->latenessP50 * 1e6,
+            stats->latenessP90 * 1e6, stats->latenessP99 * 1e6, stats->latenessP999 * 1e6,
+            stats->latenessMax * 1e6, stats->latenessMean * 1e6);
+}
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+/* PIPELINE MODEL */
+
+#define PIPE_RING 8             // instructions in flight (fetch, decode, execute, writeback), rounded up
+#define PIPE_NO_REFILL GIBCPU_STALL_CAUSES
+#define MUL_EXECUTE 5           // read $x, then the multiplier's four steps of two bits
+#define TAS_EXECUTE 2           // read, then write 1 back
+
+static const char *stallNames[GIBCPU_STALL_CAUSES] = {
+    "pipeline fill",
+    "fetching second byte",
+    "RAM port held by execute",
+    "register not written back",
+    "TAS or coprocessor in execute",
+    "taken jump flush",
+    "self-modifying write flush"
+};
+
+// One instruction the machine executed, as the pipeline sees it
+typedef struct {
+    uint8_t pc;
+    uint8_t length;
+    uint8_t sources;            // bit per register read in decode
+    int8_t dest;                // register written back, -1 for none
+    uint16_t execute;           // posEdges in execute
+    uint16_t port;              // how many of those, from the first, use the RAM port
+    uint8_t jumped;
+    uint16_t writeFirst;        // RAM written in execute, none when writeFirst > writeLast
+    uint16_t writeLast;
+} PipeOp;
+
+// What a stage hands on at the end of a posEdge: an instruction or a bubble charged to a cause
+typedef struct {
+    int64_t op;                 // sequence number, -1 for a bubble
+    uint8_t cause;
+} PipeSlot;
+
+typedef struct {
+    GibCPU *cpu;
+    uint64_t limit;
+    const GibCPUPipelineConfig *config;
+    GibCPUPipelineStats *stats;
+
+    PipeOp ring[PIPE_RING];     // by sequence number
+    uint64_t executed;          // instructions run on the machine so far
+    uint64_t next;              // the next one fetch starts on, behind executed after a flush
+    int done;                   // halted or out of budget, nothing more to fetch
+
+    int64_t fetching;           // sequence number in fetch, -1 for none
+    int fetched;                // bytes of it read so far
+    int wrongPath;              // a taken jump is ahead, fetching the fall-through for nothing
+    int redirect;               // flushed this posEdge, fetch starts again on the next
+    uint8_t refill;             // cause of fetch bubbles until the next instruction is decoded
+
+    PipeSlot decode;
+    PipeSlot execute;
+    PipeSlot writeback;
+    int executeLeft;
+    int portLeft;
+} Pipeline;
+
+static PipeSlot bubble(uint8_t cause){
+    PipeSlot slot = {-1, cause};
+    return slot;
+}
+
+static PipeOp *pipeOp(Pipeline *p, int64_t op){
+    return &p->ring[op & (PIPE_RING - 1)];
+}
+
+// Classify the instruction at the program counter before it runs
+static void decodeOp(GibCPU *cpu, PipeOp *op){
+    uint8_t pc = cpu->count;
+    uint8_t cmd = cpu->ram[pc];
+    uint8_t operand = cpu->ram[(uint8_t)(pc + 1)];
+    uint8_t a = (cmd & 0b1100) >> 2;
+    uint8_t b = cmd & 0b11;
+
+    memset(op, 0, sizeof(PipeOp));
+    op->pc = pc;
+    op->length = instructionLength(cmd >> 4);
+    op->dest = -1;
+    op->execute = 1;
+    op->writeFirst = 1;
+    switch(cmd & 0b11110000){
+        case AND:
+        case OR:
+        case XOR:
+        case ADD:
+        case SUB:
+            op->sources = 1 << a | 1 << b;
+            op->dest = b;
+            break;
+        case NOTB:
+        case SHIFTB:
+        case LSHIFTB:
+            op->sources = 1 << b;
+            op->dest = b;
+            break;
+        case LOAD:
+            op->dest = b;
+            op->port = 1;
+            break;
+        case WRT:
+            op->sources = 1 << b;
+            op->port = 1;
+            op->writeFirst = op->writeLast = operand;
+            break;
+        case JMPZ:
+            op->sources = 1 << b;
+            op->jumped = cpu->reg[b] == 0;
+            op->port = op->jumped;          // the target is read from RAM only when taken
+            break;
+        case JMP:
+            op->jumped = 1;
+            op->port = 1;
+            break;
+        case LOADL:
+            op->sources = 1 << a;
+            op->dest = b;
+            op->port = 1;
+            break;
+        case WRTL:
+            op->sources = 1 << a | 1 << b;
+            op->port = 1;
+            op->writeFirst = op->writeLast = cpu->reg[a];
+            break;
+        case TAS:
+            op->dest = b;
+            op->port = 1;
+            if(isTas(cmd)){
+                op->execute = op->port = TAS_EXECUTE;
+                op->writeFirst = op->writeLast = operand;
+            }
+            else if((cmd & 0b11111100) == MUL){
+                op->sources = 1 << b;
+                op->execute = MUL_EXECUTE;
+            }
+            else if((cmd & 0b11111100) == BSUM){
+                op->sources = 1 << b;
+                op->execute = op->port = 1 + cpu->ram[operand];
+            }
+            break;
+        default:
+            break;
+    }
+    // a write to the bank register swaps the whole window
+    if(op->writeFirst == GIBCPU_BANK_SELECT && op->writeLast == GIBCPU_BANK_SELECT && cpu->bankCount){
+        op->writeFirst = GIBCPU_BANK_WINDOW;
+        op->writeLast = GIBCPU_MEMORY_SIZE - 1;
+    }
+}
+
+// Make sure instruction p->next exists, running it on the machine if it has not run yet. Returns 0 once
+// there is nothing more to fetch.
+static int nextOp(Pipeline *p){
+    GibCPU *cpu = p->cpu;
+    if(p->next < p->executed){
+        return 1;
+    }
+    if(p->done || cpu->programHalt || cpu->posEdgeCounter >= p->limit || cpu->busWait){
+        p->done = 1;
+        return 0;
+    }
+    uint64_t start = cpu->posEdgeCounter;
+    decodeOp(cpu, pipeOp(p, p->executed));
+    runFast(cpu, cpu->posEdgeCounter + 1, MAX_VALUES);
+    if(cpu->posEdgeCounter == start){       // a TAS waiting for the bus
+        p->done = 1;
+        return 0;
+    }
+    if(cpu->posEdgeCounter >= cpu->nextCheckpoint){
+        checkpointTake(cpu);
+    }
+    p->executed++;
+    return 1;
+}
+
+static int overlaps(const PipeOp *op, int bytes, const PipeOp *store){
+    for(int i = 0; i < bytes; i++){
+        uint8_t addr = op->pc + i;
+        if(addr >= store->writeFirst && addr <= store->writeLast){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// An instruction leaves execute: flush behind a taken jump or a write to bytes already fetched
+static void resolve(Pipeline *p, const PipeOp *op){
+    if(op->jumped){
+        p->decode = bubble(GIBCPU_STALL_JUMP);
+        p->wrongPath = 0;
+        p->redirect = 1;
+        p->refill = GIBCPU_STALL_JUMP;
+        p->stats->jumpFlushes++;
+        return;
+    }
+    if(op->writeFirst > op->writeLast){
+        return;
+    }
+    if(p->decode.op >= 0 && overlaps(pipeOp(p, p->decode.op), pipeOp(p, p->decode.op)->length, op)){
+        p->next = p->decode.op;
+        p->decode = bubble(GIBCPU_STALL_SELF_MODIFY);
+        p->fetching = -1;
+        p->wrongPath = 0;
+    }
+    else if(p->fetching >= 0 && overlaps(pipeOp(p, p->fetching), p->fetched, op)){
+        p->fetched = 0;
+    }
+    else{
+        return;
+    }
+    p->redirect = 1;
+    p->refill = GIBCPU_STALL_SELF_MODIFY;
+    p->stats->selfModifyFlushes++;
+}
+
+// One posEdge, writeback first so every stage sees the one behind it as it was at the start.
+// Returns 0 once the pipeline has drained.
+static int pipeStep(Pipeline *p){
+    GibCPUPipelineStats *stats = p->stats;
+    if(p->done && p->fetching < 0 && p->decode.op < 0 && p->execute.op < 0 && p->writeback.op < 0){
+        return 0;
+    }
+    stats->posEdges++;
+
+    if(p->writeback.op >= 0){
+        stats->instructions++;
+    }
+    else{
+        stats->stalls[p->writeback.cause]++;
+    }
+
+    // execute has the RAM port for as many posEdges as the instruction needs it
+    int portBusy = 0;
+    int executeDest = -1;
+    int executeHeld = 0;
+    if(p->execute.op >= 0){
+        PipeOp *op = pipeOp(p, p->execute.op);
+        executeDest = op->dest;
+        if(p->portLeft > 0){
+            portBusy = 1;
+            p->portLeft--;
+        }
+        if(--p->executeLeft > 0){
+            p->writeback = bubble(GIBCPU_STALL_EXECUTE);
+            executeHeld = 1;
+        }
+        else{
+            p->writeback = p->execute;
+            resolve(p, op);
+        }
+    }
+    else{
+        p->writeback = p->execute;
+    }
+
+    // decode reads registers in the second half of the posEdge writeback writes them in, so without
+    // forwarding only the instruction in execute is too close
+    int decodeHeld = executeHeld;
+    if(!decodeHeld){
+        if(p->decode.op >= 0 && !p->config->forwarding && executeDest >= 0 &&
+           (pipeOp(p, p->decode.op)->sources & 1 << executeDest)){
+            p->execute = bubble(GIBCPU_STALL_DATA);
+            decodeHeld = 1;
+        }
+        else{
+            p->execute = p->decode;
+            if(p->decode.op >= 0){
+                p->executeLeft = pipeOp(p, p->decode.op)->execute;
+                p->portLeft = pipeOp(p, p->decode.op)->port;
+            }
+        }
+    }
+
+    // fetch reads the next instruction a byte or two at a time, whenever execute leaves it the port
+    uint8_t cause = GIBCPU_STALL_FETCH;
+    if(p->redirect){
+        p->redirect = 0;
+        cause = p->refill;
+    }
+    else if(p->wrongPath){
+        cause = GIBCPU_STALL_JUMP;
+    }
+    else{
+        if(p->fetching < 0 && nextOp(p)){
+            p->fetching = p->next++;
+            p->fetched = 0;
+        }
+        if(p->fetching >= 0){
+            PipeOp *op = pipeOp(p, p->fetching);
+            if(p->fetched < op->length){
+                if(portBusy){
+                    cause = GIBCPU_STALL_PORT;
+                }
+                else{
+                    p->fetched += p->config->fetchBytes;
+                }
+            }
+            if(p->fetched >= op->length && !decodeHeld){
+                p->decode.op = p->fetching;
+                p->wrongPath = op->jumped;
+                p->fetching = -1;
+                p->refill = PIPE_NO_REFILL;
+                return 1;
+            }
+        }
+        if(p->refill != PIPE_NO_REFILL){
+            cause = p->refill;
+        }
+    }
+    if(!decodeHeld){
+        p->decode = bubble(cause);
+    }
+    return 1;
+}
+
+int gibcpuRunPipelined(GibCPU *cpu, uint64_t budget, const GibCPUPipelineConfig *config, GibCPUPipelineStats *stats){
+    uint64_t limit = cpu->posEdgeCounter + budget;
+    if(limit < cpu->posEdgeCounter){
+        limit = UINT64_MAX;
+    }
+    memset(stats, 0, sizeof(GibCPUPipelineStats));
+    stats->config = *config;
+    if(stats->config.fetchBytes < 1 || stats->config.fetchBytes > 2){
+        stats->config.fetchBytes = 1;
+    }
+
+    // the pipeline times whole instructions, so finish one gibcpuStep() left open first
+    cpu->pending = MODULE_ALL;
+    while(cpu->state != 0 && !cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait){
+        stepPosEdge(cpu);
+    }
+    uint64_t start = cpu->posEdgeCounter;
+
+    Pipeline *p = calloc(1, sizeof(Pipeline));
+    if(!p){
+        return cpu->programHalt;
+    }
+    p->cpu = cpu;
+    p->limit = limit;
+    p->config = &stats->config;
+    p->stats = stats;
+    p->fetching = -1;
+    p->refill = PIPE_NO_REFILL;
+    p->decode = p->execute = p->writeback = bubble(GIBCPU_STALL_FILL);
+    while(pipeStep(p)){
+    }
+    free(p);
+
+    stats->fsmPosEdges = cpu->posEdgeCounter - start;
+    return cpu->programHalt;
+}
+
+/* REPORT */
+
+static double share(uint64_t part, uint64_t total){
+    return total ? 100.0 * part / total : 0.0;
+}
+
+void gibcpuPrintPipeline(const GibCPUPipelineStats *stats, FILE *out){
+    double instructions = stats->instructions ? (double)stats->instructions : 1.0;
+    fprintf(out, "\nPIPELINE: 4 stages, %d-byte fetch, forwarding %s\n", stats->config.fetchBytes,
+            stats->config.forwarding ? "on" : "off");
+    fprintf(out, "\n%-30s %14llu\n", "instructions", (unsigned long long)stats->instructions);
+    fprintf(out, "%-30s %14llu  CPI %6.2f\n", "memCtrl() posEdges",
+            (unsigned long long)stats->fsmPosEdges, stats->fsmPosEdges / instructions);
+    fprintf(out, "%-30s %14llu  CPI %6.2f  %.2fx faster\n", "pipeline posEdges",
+            (unsigned long long)stats->posEdges, stats->posEdges / instructions,
+            stats->posEdges ? (double)stats->fsmPosEdges / stats->posEdges : 0.0);
+
+    fprintf(out, "\n%-30s %14s %10s %8s\n", "stall", "posEdges", "posEdges%", "per op");
+    for(int i = 0; i < GIBCPU_STALL_CAUSES; i++){
+        fprintf(out, "%-30s %14llu %9.2f%% %8.2f\n", stallNames[i], (unsigned long long)stats->stalls[i],
+                share(stats->stalls[i], stats->posEdges), stats->stalls[i] / instructions);
+    }
+    fprintf(out, "\n%llu taken jump flushes, %llu self-modifying write flushes\n",
+            (unsigned long long)stats->jumpFlushes, (unsigned long long)stats->selfModifyFlushes);
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "GIBCPU_Internal.h"
+
+/* PROFILER */
+
+#define PROFILE_HOT_LINES 20
+#define PROFILE_HOT_ADDRESSES 10
+#define PROFILE_HOT_SEQUENCES 10
+#define MAP_SOURCE_LENGTH 64
+#define MAP_SYMBOL_LENGTH 16
+
+static const char *opcodeNames[16] = {
+    "AND", "OR", "XOR", "ADD", "SUB", "NOTB", "SHIFTB", "LSHIFTB",
+    "LOAD", "WRT", "JMPZ", "JMP", "LOADL", "WRTL", "TAS/COP", "HALT"
+};
+
+// What memCtrl() is doing in each state
+static const char *stateNames[GIBCPU_PROFILE_STATES] = {
+    "fetch",
+    "ALU op",
+    "bookmark",
+    "LOADL/WRTL address",
+    "operand increment",
+    "operand handshake",
+    "set count",
+    "count handshake, dispatch",
+    "LOAD register",
+    "WRT RAM",
+    "RAM handshake",
+    "return to bookmark",
+    "bookmark handshake",
+    "increment handshake",
+    "second increment",
+    "jump",
+    "jump handshake",
+    "final increment handshake",
+    "halt",
+    "ALU register handshake",
+    "LOAD register handshake",
+    "TAS register and RAM",
+    "TAS handshake",
+    "MUL step",
+    "POPC",
+    "BSUM next byte",
+    "BSUM count handshake"
+};
+
+// New instruction at an instruction boundary: count it and the RAM it is about to touch
+static void instructionStart(GibCPU *cpu, GibCPUProfile *p){
+    uint8_t pc = cpu->count;
+    uint8_t cmd = cpu->ram[pc];
+    uint8_t operand = cpu->ram[(uint8_t)(pc + 1)];
+    uint8_t a = (cmd & 0b1100) >> 2;
+    uint8_t b = cmd & 0b11;
+
+    uint8_t op = cmd >> 4;
+    if(pc == (uint8_t)(cpu->profilePc + instructionLength(cpu->profileOp)) && cpu->profileRun){
+        p->opcodePairs[cpu->profileOp][op]++;
+        if(cpu->profileRun == 2){
+            p->opcodeTriples[cpu->profilePrevOp][cpu->profileOp][op]++;
+        }
+        cpu->profileRun = 2;
+    }
+    else{
+        cpu->profileRun = 1;
+    }
+    cpu->profilePrevOp = cpu->profileOp;
+    cpu->profilePc = pc;
+    cpu->profileOp = op;
+    p->opcodeCount[op]++;
+    p->pcCount[pc]++;
+    switch(cmd & 0b11110000){
+        case LOAD:
+            p->ramReads[operand]++;
+            break;
+        case LOADL:
+            p->ramReads[cpu->reg[a]]++;
+            break;
+        case WRT:
+            p->ramWrites[operand]++;
+            break;
+        case TAS:
+            p->ramReads[operand]++;
+            if(isTas(cmd)){
+                p->ramWrites[operand]++;
+            }
+            else if((cmd & 0b11111100) == BSUM){
+                for(int i = 0; i < cpu->ram[operand]; i++){
+                    p->ramReads[(uint8_t)(cpu->reg[b] + i)]++;
+                }
+            }
+            break;
+        case WRTL:
+            p->ramWrites[cpu->reg[a]]++;
+            break;
+        case JMPZ:
+            if(cpu->reg[b] == 0){
+                p->ramReads[operand]++;
+            }
+            break;
+        case JMP:
+            p->ramReads[operand]++;
+            break;
+        default:
+            break;
+    }
+}
+
+void profilePosEdge(GibCPU *cpu){
+    GibCPUProfile *p = cpu->profile;
+    if(cpu->state == 0){
+        instructionStart(cpu, p);
+    }
+    if(cpu->state < GIBCPU_PROFILE_STATES){
+        p->stateCycles[cpu->state]++;
+    }
+    p->opcodeCycles[cpu->profileOp]++;
+    p->pcCycles[cpu->profilePc]++;
+    stepPosEdge(cpu);
+}
+
+void gibcpuSetProfile(GibCPU *cpu, GibCPUProfile *profile){
+    cpu->profile = profile;
+    cpu->profilePc = cpu->count;
+    cpu->profileOp = cpu->ram[cpu->count] >> 4;
+    cpu->profileRun = 0;
+}
+
+/* SYMBOL MAP */
+
+// The Assembler's RAM.map: "line ADDR LINE SOURCE" for every address the program occupies and
+// "symbol NAME ADDR" for every $variable and #location
+typedef struct {
+    int line[MAX_VALUES];                           // assembly.txt line, 0 = unknown
+    char source[MAX_VALUES][MAP_SOURCE_LENGTH];
+    char symbol[MAX_VALUES][MAP_SYMBOL_LENGTH];
+} SymbolMap;
+
+static int readSymbolMap(const char *filename, SymbolMap *map){
+    memset(map, 0, sizeof(SymbolMap));
+    FILE *file = fopen(filename, "r");
+    if(!file){
+        return 1;
+    }
+    char text[128];
+    while(fgets(text, sizeof(text), file)){
+        text[strcspn(text, "\r\n")] = 0;
+        unsigned addr, line;
+        int used = 0;
+        char name[MAP_SYMBOL_LENGTH];
+        if(sscanf(text, "line %u %u %n", &addr, &line, &used) == 2 && used && addr < MAX_VALUES){
+            map->line[addr] = line;
+            snprintf(map->source[addr], MAP_SOURCE_LENGTH, "%s", text + used);
+        }
+        else if(sscanf(text, "symbol %15s %u", name, &addr) == 2 && addr < MAX_VALUES){
+            snprintf(map->symbol[addr], MAP_SYMBOL_LENGTH, "%s", name);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/* REPORT */
+
+static double percent(uint64_t part, uint64_t total){
+    return total ? 100.0 * part / total : 0.0;
+}
+
+// Addresses ordered by descending count, zero counts dropped. Returns how many are left.
+static int rankAddresses(const uint64_t *counts, int *order){
+    int n = 0;
+    for(int i = 0; i < MAX_VALUES; i++){
+        if(counts[i]){
+            int j = n++;
+            while(j > 0 && counts[order[j - 1]] < counts[i]){
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+    return n;
+}
+
+typedef struct {
+    uint64_t count;
+    uint8_t ops[3];
+    int length;
+} Sequence;
+
+// Insert a sequence into the n busiest so far, busiest first, keeping at most PROFILE_HOT_SEQUENCES. Returns the new n.
+static int rankSequence(Sequence *hot, int n, uint64_t count, const uint8_t *ops, int length){
+    if(!count || (n == PROFILE_HOT_SEQUENCES && hot[n - 1].count >= count)){
+        return n;
+    }
+    int j = n < PROFILE_HOT_SEQUENCES ? n++ : n - 1;
+    while(j > 0 && hot[j - 1].count < count){
+        hot[j] = hot[j - 1];
+        j--;
+    }
+    hot[j].count = count;
+    memcpy(hot[j].ops, ops, length);
+    hot[j].length = length;
+    return n;
+}
+
+// 16x16 grid of RAM, one character per address from ' ' (never touched) to '@' (the busiest address)
+static void printHeatmap(const char *title, const uint64_t *counts, FILE *out){
+    static const char ramp[] = " .:-=+*#%@";
+    uint64_t max = 0;
+    for(int i = 0; i < MAX_VALUES; i++){
+        max = counts[i] > max ? counts[i] : max;
+    }
+    fprintf(out, "\n%s heatmap (rows of 16 addresses, '@' = %llu)\n", title, (unsigned long long)max);
+    for(int row = 0; row < 16; row++){
+        fprintf(out, "%3d |", row * 16);
+        for(int col = 0; col < 16; col++){
+            uint64_t count = counts[row * 16 + col];
+            int level = count == 0 ? 0 : 1 + (int)(count * (sizeof(ramp) - 3) / max);
+            fputc(ramp[level], out);
+        }
+        fprintf(out, "|\n");
+    }
+}
+
+int gibcpuPrintProfile(const GibCPUProfile *profile, const char *mapFile, FILE *out){
+    SymbolMap *map = calloc(1, sizeof(SymbolMap));
+    if(!map){
+        return 1;
+    }
+    if(mapFile && readSymbolMap(mapFile, map)){
+        fprintf(out, "No symbol map in %s, reporting addresses only\n", mapFile);
+    }
+
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    for(int i = 0; i < 16; i++){
+        cycles += profile->opcodeCycles[i];
+        instructions += profile->opcodeCount[i];
+    }
+    fprintf(out, "\nPROFILE: %llu clock cycles over %llu instructions\n",
+            (unsigned long long)cycles, (unsigned long long)instructions);
+
+    fprintf(out, "\n%-8s %12s %14s %8s %8s\n", "opcode", "count", "cycles", "cycles%", "per op");
+    for(int i = 0; i < 16; i++){
+        if(profile->opcodeCount[i] || profile->opcodeCycles[i]){
+            fprintf(out, "%-8s %12llu %14llu %7.2f%% %8.2f\n", opcodeNames[i],
+                    (unsigned long long)profile->opcodeCount[i], (unsigned long long)profile->opcodeCycles[i],
+                    percent(profile->opcodeCycles[i], cycles),
+                    profile->opcodeCount[i] ? (double)profile->opcodeCycles[i] / profile->opcodeCount[i] : 0.0);
+        }
+    }
+
+    Sequence busiest[PROFILE_HOT_SEQUENCES];
+    int sequences = 0;
+    for(int i = 0; i < 16; i++){
+        for(int j = 0; j < 16; j++){
+            uint8_t ops[3] = {i, j, 0};
+            sequences = rankSequence(busiest, sequences, profile->opcodePairs[i][j], ops, 2);
+            for(int k = 0; k < 16; k++){
+                ops[2] = k;
+                sequences = rankSequence(busiest, sequences, profile->opcodeTriples[i][j][k], ops, 3);
+            }
+        }
+    }
+    fprintf(out, "\n%-24s %12s %8s\n", "back to back", "count", "instr%");
+    for(int i = 0; i < sequences; i++){
+        char names[32] = "";
+        for(int k = 0; k < busiest[i].length; k++){
+            strcat(names, opcodeNames[busiest[i].ops[k]]);
+            strcat(names, k + 1 < busiest[i].length ? " " : "");
+        }
+        fprintf(out, "%-24s %12llu %7.2f%%\n", names, (unsigned long long)busiest[i].count,
+                percent(busiest[i].count, instructions));
+    }
+
+    fprintf(out, "\n%-5s %-28s %14s %8s\n", "state", "memCtrl()", "cycles", "cycles%");
+    for(int i = 0; i < GIBCPU_PROFILE_STATES; i++){
+        if(profile->stateCycles[i]){
+            fprintf(out, "%-5d %-28s %14llu %7.2f%%\n", i, stateNames[i],
+                    (unsigned long long)profile->stateCycles[i], percent(profile->stateCycles[i], cycles));
+        }
+    }
+
+    int order[MAX_VALUES];
+    int hot = rankAddresses(profile->pcCycles, order);
+    fprintf(out, "\n%-4s %-5s %12s %14s %8s  %s\n", "addr", "line", "count", "cycles", "cycles%", "source");
+    for(int i = 0; i < hot && i < PROFILE_HOT_LINES; i++){
+        int addr = order[i];
+        fprintf(out, "%-4d %-5d %12llu %14llu %7.2f%%  %s\n", addr, map->line[addr],
+                (unsigned long long)profile->pcCount[addr], (unsigned long long)profile->pcCycles[addr],
+                percent(profile->pcCycles[addr], cycles), map->source[addr]);
+    }
+
+    printHeatmap("RAM read", profile->ramReads, out);
+    printHeatmap("RAM write", profile->ramWrites, out);
+
+    uint64_t accesses[MAX_VALUES];
+    for(int i = 0; i < MAX_VALUES; i++){
+        accesses[i] = profile->ramReads[i] + profile->ramWrites[i];
+    }
+    hot = rankAddresses(accesses, order);
+    fprintf(out, "\n%-4s %-10s %12s %12s\n", "addr", "symbol", "reads", "writes");
+    for(int i = 0; i < hot && i < PROFILE_HOT_ADDRESSES; i++){
+        int addr = order[i];
+        fprintf(out, "%-4d %-10s %12llu %12llu\n", addr, map->symbol[addr],
+                (unsigned long long)profile->ramReads[addr], (unsigned long long)profile->ramWrites[addr]);
+    }
+
+    free(map);
+    return 0;
+}
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "GIBCPU_Internal.h"
+
+/* PROGRAM SEARCH */
+
+#define SEARCH_CHUNK 1024           // candidates a worker takes or counts at a time
+#define SEARCH_MIGRATE 16           // chunks between looks at the shared best
+
+typedef struct {
+    uint32_t wrongBits;
+    uint32_t size;
+    uint64_t cycles;
+} Fitness;
+
+// A case ready to load: the image with its inputs applied and the addresses it scores
+typedef struct {
+    const GibCPUSearchCase *source;
+    uint8_t ram[MAX_VALUES];
+    uint8_t scored[MAX_VALUES];
+    int scoredCount;
+    uint32_t bits;                  // scored bits, all wrong when the case times out
+    int inputInCode;                // inputs land in the code range, so they go in again after the code
+} PreparedCase;
+
+typedef struct {
+    const GibCPUSearchConfig *config;
+    PreparedCase *cases;
+    uint64_t total;                 // candidates to enumerate, UINT64_MAX for no limit
+    double start;
+
+    pthread_mutex_t lock;           // guards best and bestFitness
+    GibCPUSearchResult best;
+    Fitness bestFitness;
+    atomic_uint_fast32_t bestWrong; // bestFitness.wrongBits, read without the lock for cut-offs
+
+    atomic_uint_fast64_t evaluated;
+    atomic_uint_fast64_t casesRun;
+    atomic_uint_fast64_t timeouts;
+    atomic_uint_fast64_t next;      // next candidate to enumerate
+    atomic_int stop;
+} Search;
+
+typedef struct {
+    Search *search;
+    int id;
+} SearchWorker;
+
+// Counters a worker adds to the shared ones once per chunk
+typedef struct {
+    uint64_t evaluated;
+    uint64_t casesRun;
+    uint64_t timeouts;
+} SearchCounts;
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t nextRandom(uint64_t *state){      // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static int compareFitness(const Fitness *a, const Fitness *b){
+    if(a->wrongBits != b->wrongBits){
+        return a->wrongBits < b->wrongBits ? -1 : 1;
+    }
+    if(a->size != b->size){
+        return a->size < b->size ? -1 : 1;
+    }
+    return (a->cycles > b->cycles) - (a->cycles < b->cycles);
+}
+
+static uint32_t codeSize(const uint8_t *code, int length){
+    while(length > 0 && code[length - 1] == 0){
+        length--;
+    }
+    return length;
+}
+
+static void prepareCases(Search *s){
+    const GibCPUSearchConfig *config = s->config;
+    for(int c = 0; c < config->caseCount; c++){
+        const GibCPUSearchCase *source = &config->cases[c];
+        PreparedCase *p = &s->cases[c];
+        p->source = source;
+        p->scoredCount = 0;
+        p->bits = 0;
+        p->inputInCode = 0;
+        for(int addr = 0; addr < MAX_VALUES; addr++){
+            p->ram[addr] = (config->image[addr] & ~source->inputMask[addr]) | (source->input[addr] & source->inputMask[addr]);
+            if(source->expectedMask[addr]){
+                p->scored[p->scoredCount++] = addr;
+                p->bits += __builtin_popcount(source->expectedMask[addr]);
+            }
+            if(source->inputMask[addr] && addr >= config->codeStart && addr < config->codeStart + config->codeLength){
+                p->inputInCode = 1;
+            }
+        }
+    }
+}
+
+// Runs the cases in order, giving up once the candidate has more than bound wrong bits. Returns 1 with the
+// full fitness, 0 if it was cut short.
+static int evaluate(Search *s, GibCPU *cpu, const uint8_t *code, uint32_t bound, Fitness *f, SearchCounts *counts){
+    const GibCPUSearchConfig *config = s->config;
+    uint8_t start = config->codeStart;
+    f->wrongBits = 0;
+    f->size = codeSize(code, config->codeLength);
+    f->cycles = 0;
+    counts->evaluated++;
+    for(int c = 0; c < config->caseCount; c++){
+        const PreparedCase *p = &s->cases[c];
+        memcpy(cpu->ram, p->ram, MAX_VALUES);
+        memcpy(cpu->ram + start, code, config->codeLength);
+        if(p->inputInCode){
+            for(int addr = start; addr < start + config->codeLength; addr++){
+                uint8_t mask = p->source->inputMask[addr];
+                cpu->ram[addr] = (cpu->ram[addr] & ~mask) | (p->source->input[addr] & mask);
+            }
+        }
+        cpu->entry = config->entry;
+        gibcpuReset(cpu);
+        runFast(cpu, config->cycleCap, MAX_VALUES);
+        counts->casesRun++;
+        f->cycles += cpu->posEdgeCounter;
+        if(!cpu->programHalt){
+            counts->timeouts++;
+            f->wrongBits += p->bits;
+        }
+        else{
+            for(int i = 0; i < p->scoredCount; i++){
+                uint8_t addr = p->scored[i];
+                f->wrongBits += __builtin_popcount((cpu->ram[addr] ^ p->source->expected[addr]) &
+                                                   p->source->expectedMask[addr]);
+            }
+        }
+        if(f->wrongBits > bound){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Makes the candidate the shared best if it beats it
+static void publish(Search *s, const uint8_t *code, const Fitness *f){
+    const GibCPUSearchConfig *config = s->config;
+    pthread_mutex_lock(&s->lock);
+    if(compareFitness(f, &s->bestFitness) < 0){
+        s->bestFitness = *f;
+        atomic_store_explicit(&s->bestWrong, f->wrongBits, memory_order_relaxed);
+        memcpy(s->best.image + config->codeStart, code, config->codeLength);
+        s->best.wrongBits = f->wrongBits;
+        s->best.size = f->size;
+        s->best.cycles = f->cycles;
+        s->best.evaluated = atomic_load_explicit(&s->evaluated, memory_order_relaxed);
+        s->best.seconds = now() - s->start;
+        if(config->improved){
+            config->improved(&s->best, config->user);
+        }
+        if(config->stopAtSolution && f->wrongBits == 0){
+            atomic_store(&s->stop, 1);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Adds a worker's counts to the shared ones. Returns 1 once the search is over.
+static int flushCounts(Search *s, SearchCounts *counts){
+    const GibCPUSearchConfig *config = s->config;
+    uint64_t evaluated = atomic_fetch_add(&s->evaluated, counts->evaluated) + counts->evaluated;
+    atomic_fetch_add(&s->casesRun, counts->casesRun);
+    atomic_fetch_add(&s->timeouts, counts->timeouts);
+    memset(counts, 0, sizeof(*counts));
+    if((config->candidates && evaluated >= config->candidates) ||
+       (config->seconds > 0 && now() - s->start >= config->seconds)){
+        atomic_store(&s->stop, 1);
+    }
+    return atomic_load(&s->stop);
+}
+
+// One to three byte changes, bit flips, inserts and deletes, mostly within the code written so far
+static void mutate(uint8_t *code, int length, uint64_t *rng){
+    int changes = 1 + nextRandom(rng) % 3;
+    for(int k = 0; k < changes; k++){
+        uint64_t r = nextRandom(rng);
+        int span = codeSize(code, length) + 4;
+        span = span < length ? span : length;
+        int at = (r >> 8) % span;
+        uint8_t value = r >> 32;
+        switch(r % 8){
+            case 0:                 // any byte
+                code[at] = value;
+                break;
+            case 1:
+                code[at] ^= 1 << (value & 7);
+                break;
+            case 2:                 // another opcode on the same registers
+                code[at] = (value & 0xF0) | (code[at] & 0x0F);
+                break;
+            case 3:                 // other registers for the same opcode
+                code[at] = (code[at] & 0xF0) | (value & 0x0F);
+                break;
+            case 4:                 // insert, the last byte falls off
+                memmove(code + at + 1, code + at, length - at - 1);
+                code[at] = value;
+                break;
+            case 5:                 // delete
+                memmove(code + at, code + at + 1, length - at - 1);
+                code[length - 1] = 0;
+                break;
+            case 6:
+                code[at] = 0;
+                break;
+            default:                // nudge an address operand
+                code[at] += (value & 1) ? 1 : -1;
+                break;
+        }
+    }
+}
+
+static void runMutate(Search *s, SearchWorker *w, GibCPU *cpu){
+    const GibCPUSearchConfig *config = s->config;
+    int length = config->codeLength;
+    uint8_t parent[MAX_VALUES];
+    uint8_t child[MAX_VALUES];
+    Fitness parentFitness;
+    Fitness f;
+    SearchCounts counts = {0};
+    uint64_t rng = config->seed * 0x9E3779B97F4A7C15ULL + w->id * 0xD1B54A32D192ED03ULL + 1;
+
+    pthread_mutex_lock(&s->lock);
+    memcpy(parent, s->best.image + config->codeStart, length);
+    parentFitness = s->bestFitness;
+    pthread_mutex_unlock(&s->lock);
+
+    for(int chunk = 1; ; chunk++){
+        for(int i = 0; i < SEARCH_CHUNK; i++){
+            memcpy(child, parent, length);
+            mutate(child, length, &rng);
+            if(!evaluate(s, cpu, child, parentFitness.wrongBits, &f, &counts)){
+                continue;
+            }
+            // only wrong bits count here, so the parent drifts freely in size and cycles across a plateau
+            memcpy(parent, child, length);
+            parentFitness = f;
+            if(f.wrongBits <= atomic_load_explicit(&s->bestWrong, memory_order_relaxed)){
+                publish(s, child, &f);
+            }
+        }
+        if(flushCounts(s, &counts)){
+            return;
+        }
+        if(chunk % SEARCH_MIGRATE == 0){
+            pthread_mutex_lock(&s->lock);
+            if(compareFitness(&s->bestFitness, &parentFitness) < 0){
+                memcpy(parent, s->best.image + config->codeStart, length);
+                parentFitness = s->bestFitness;
+            }
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+}
+
+static void runEnumerate(Search *s, GibCPU *cpu){
+    const GibCPUSearchConfig *config = s->config;
+    uint8_t code[MAX_VALUES];
+    Fitness f;
+    SearchCounts counts = {0};
+    memset(code, 0, sizeof(code));
+    for(;;){
+        uint64_t first = atomic_fetch_add(&s->next, SEARCH_CHUNK);
+        if(first >= s->total){
+            flushCounts(s, &counts);
+            return;
+        }
+        uint64_t last = s->total - first < SEARCH_CHUNK ? s->total : first + SEARCH_CHUNK;
+        for(uint64_t n = first; n < last; n++){
+            uint64_t digits = n;
+            for(int i = 0; i < config->codeLength && i < 8; i++){
+                code[i] = digits & 0xFF;
+                digits >>= 8;
+            }
+            uint32_t bound = atomic_load_explicit(&s->bestWrong, memory_order_relaxed);
+            if(evaluate(s, cpu, code, bound, &f, &counts)){
+                publish(s, code, &f);
+            }
+        }
+        if(flushCounts(s, &counts)){
+            return;
+        }
+    }
+}
+
+static void *searchMain(void *arg){
+    SearchWorker *w = arg;
+    GibCPU *cpu = gibcpuCreate();
+    if(!cpu){
+        return NULL;
+    }
+    if(w->search->config->mode == GIBCPU_SEARCH_ENUMERATE){
+        runEnumerate(w->search, cpu);
+    }
+    else{
+        runMutate(w->search, w, cpu);
+    }
+    gibcpuDestroy(cpu);
+    return NULL;
+}
+
+int gibcpuSearch(const GibCPUSearchConfig *config, GibCPUSearchResult *result){
+    if(!config->cases || config->caseCount < 1 || config->caseCount > GIBCPU_SEARCH_MAX_CASES ||
+       config->codeLength < 1 || config->codeStart + config->codeLength > MAX_VALUES){
+        return 1;
+    }
+    int threadCount = config->threads < 1 ? 1 : config->threads;
+
+    Search s;
+    memset(&s, 0, sizeof(s));
+    s.config = config;
+    s.cases = malloc(config->caseCount * sizeof(PreparedCase));
+    GibCPU *cpu = gibcpuCreate();
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    SearchWorker *workers = malloc(threadCount * sizeof(SearchWorker));
+    if(!s.cases || !cpu || !threads || !workers){
+        free(s.cases);
+        gibcpuDestroy(cpu);
+        free(threads);
+        free(workers);
+        return 1;
+    }
+    prepareCases(&s);
+    s.total = UINT64_MAX;
+    if(config->mode == GIBCPU_SEARCH_ENUMERATE && config->codeLength < 8){
+        s.total = 1ULL << (8 * config->codeLength);
+    }
+    if(config->candidates && config->candidates < s.total){
+        s.total = config->candidates;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    s.start = now();
+
+    // the image as given is the first candidate, and where mutation starts
+    SearchCounts counts = {0};
+    memcpy(s.best.image, config->image, MAX_VALUES);
+    evaluate(&s, cpu, config->image + config->codeStart, UINT32_MAX, &s.bestFitness, &counts);
+    s.best.wrongBits = s.bestFitness.wrongBits;
+    s.best.size = s.bestFitness.size;
+    s.best.cycles = s.bestFitness.cycles;
+    atomic_store(&s.bestWrong, s.bestFitness.wrongBits);
+    gibcpuDestroy(cpu);
+    if(config->improved){
+        config->improved(&s.best, config->user);
+    }
+    flushCounts(&s, &counts);
+    if(config->stopAtSolution && s.bestFitness.wrongBits == 0){
+        atomic_store(&s.stop, 1);
+    }
+
+    int started = 0;
+    for(int w = 0; w < threadCount && !atomic_load(&s.stop); w++){
+        workers[w].search = &s;
+        workers[w].id = w;
+        if(pthread_create(&threads[w], NULL, searchMain, &workers[w])){
+            break;
+        }
+        started++;
+    }
+    for(int w = 0; w < started; w++){
+        pthread_join(threads[w], NULL);
+    }
+
+    *result = s.best;
+    result->evaluated = atomic_load(&s.evaluated);
+    result->casesRun = atomic_load(&s.casesRun);
+    result->timeouts = atomic_load(&s.timeouts);
+    result->seconds = now() - s.start;
+
+    pthread_mutex_destroy(&s.lock);
+    free(s.cases);
+    free(threads);
+    free(workers);
+    return started || atomic_load(&s.stop) ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "GIBCPU_Internal.h"
+
+// Snapshot layout: the latches up to printAddr, the fault, both counters little-endian, the bank count and
+// mapped bank, then RAM and every bank
+#define SNAPSHOT_LATCHES 0
+#define SNAPSHOT_FAULT 31
+#define SNAPSHOT_CYCLES 32
+#define SNAPSHOT_LOOPS 40
+#define SNAPSHOT_BANK_COUNT 48
+#define SNAPSHOT_BANK_MAPPED 49
+#define SNAPSHOT_RAM 64
+#define SNAPSHOT_BANKS (SNAPSHOT_RAM + MAX_VALUES)
+
+#define SNAPSHOT_MAGIC "GIBSNAP2"
+#define SNAPSHOT_MAGIC_UNBANKED "GIBSNAP1"     // older files: no banks, RAM is the last byte
+#define SNAPSHOT_UNBANKED_SIZE SNAPSHOT_BANKS
+
+_Static_assert(offsetof(GibCPU, printAddr) <= SNAPSHOT_FAULT, "latches must fit ahead of the snapshot fault byte");
+_Static_assert(SNAPSHOT_BANKS + GIBCPU_EXTENDED_SIZE == GIBCPU_SNAPSHOT_SIZE, "snapshot must end with the banks");
+
+/* SNAPSHOTS */
+
+static void storeU64(uint8_t *out, uint64_t value){
+    for(int i = 0; i < 8; i++){
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t loadU64(const uint8_t *in){
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++){
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+void gibcpuSnapshot(const GibCPU *cpu, GibCPUSnapshot *snapshot){
+    memset(snapshot->data, 0, SNAPSHOT_RAM);
+    memcpy(snapshot->data + SNAPSHOT_LATCHES, cpu, offsetof(GibCPU, printAddr));
+    snapshot->data[SNAPSHOT_FAULT] = cpu->fault;
+    storeU64(snapshot->data + SNAPSHOT_CYCLES, cpu->posEdgeCounter);
+    storeU64(snapshot->data + SNAPSHOT_LOOPS, cpu->loopCounter);
+    snapshot->data[SNAPSHOT_BANK_COUNT] = cpu->bankCount;
+    snapshot->data[SNAPSHOT_BANK_MAPPED] = cpu->bankMapped;
+    memcpy(snapshot->data + SNAPSHOT_RAM, cpu->ram, MAX_VALUES);
+    memcpy(snapshot->data + SNAPSHOT_BANKS, cpu->banks, GIBCPU_EXTENDED_SIZE);
+}
+
+uint64_t snapshotCycles(const GibCPUSnapshot *snapshot){
+    return loadU64(snapshot->data + SNAPSHOT_CYCLES);
+}
+
+// Load the machine state without touching the checkpoint ring
+static void restoreState(GibCPU *cpu, const GibCPUSnapshot *snapshot){
+    memcpy(cpu, snapshot->data + SNAPSHOT_LATCHES, offsetof(GibCPU, printAddr));
+    cpu->fault = snapshot->data[SNAPSHOT_FAULT];
+    cpu->pending = MODULE_ALL;
+    cpu->posEdgeCounter = loadU64(snapshot->data + SNAPSHOT_CYCLES);
+    cpu->loopCounter = loadU64(snapshot->data + SNAPSHOT_LOOPS);
+    cpu->bankCount = snapshot->data[SNAPSHOT_BANK_COUNT] <= GIBCPU_MAX_BANKS ? snapshot->data[SNAPSHOT_BANK_COUNT] : 0;
+    cpu->bankMapped = cpu->bankCount ? snapshot->data[SNAPSHOT_BANK_MAPPED] % cpu->bankCount : 0;
+    memcpy(cpu->ram, snapshot->data + SNAPSHOT_RAM, MAX_VALUES);
+    memcpy(cpu->banks, snapshot->data + SNAPSHOT_BANKS, GIBCPU_EXTENDED_SIZE);
+    memset(cpu->decoded, 0, sizeof(cpu->decoded));
+    jitFlush(cpu);
+    memoClear(cpu);
+    if(cpu->trace){
+        traceDiscontinuity(cpu);
+    }
+}
+
+void gibcpuRestore(GibCPU *cpu, const GibCPUSnapshot *snapshot){
+    restoreState(cpu, snapshot);
+    checkpointsReset(cpu);
+}
+
+int gibcpuSaveSnapshot(const GibCPU *cpu, const char *filename){
+    GibCPUSnapshot snapshot;
+    gibcpuSnapshot(cpu, &snapshot);
+
+    FILE *file = fopen(filename, "wb");
+    if(!file){
+        perror("Error opening snapshot file");
+        return 1;
+    }
+    int failed = fwrite(SNAPSHOT_MAGIC, 1, 8, file) != 8;
+    failed |= fwrite(snapshot.data, 1, GIBCPU_SNAPSHOT_SIZE, file) != GIBCPU_SNAPSHOT_SIZE;
+    failed |= fclose(file) != 0;
+    return failed;
+}
+
+int gibcpuLoadSnapshot(GibCPU *cpu, const char *filename){
+    FILE *file = fopen(filename, "rb");
+    if(!file){
+        perror("Error opening snapshot file");
+        return 1;
+    }
+    char magic[8];
+    GibCPUSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    int failed = fread(magic, 1, 8, file) != 8;
+    size_t size = !failed && !memcmp(magic, SNAPSHOT_MAGIC_UNBANKED, 8) ? SNAPSHOT_UNBANKED_SIZE : GIBCPU_SNAPSHOT_SIZE;
+    failed = failed || (size == GIBCPU_SNAPSHOT_SIZE && memcmp(magic, SNAPSHOT_MAGIC, 8));
+    failed = failed || fread(snapshot.data, 1, size, file) != size;
+    fclose(file);
+    if(failed){
+        printf("%s is not a GIBCPU snapshot\n", filename);
+        return 1;
+    }
+    gibcpuRestore(cpu, &snapshot);
+    return 0;
+}
+
+/* CHECKPOINT RING */
+
+// Consecutive checkpoints differ in a few RAM bytes, the registers and the counters, so only the newest is
+// kept whole. Every older one stores its XOR against the next newer checkpoint, run-length encoded, and is
+// rebuilt by walking back from the newest. Dropping the oldest never invalidates the others.
+typedef struct {
+    uint64_t cycle;
+    uint8_t *delta;             // (zero run, literal count, literals...) pairs, empty for the newest
+    uint16_t length;
+    uint16_t allocated;
+} Checkpoint;
+
+struct GibCheckpoints {
+    uint64_t interval;
+    int capacity;
+    int first;                  // ring index of the oldest checkpoint
+    int count;
+    GibCPUSnapshot newest;
+    Checkpoint *ring;
+};
+
+// Worst case is alternating zero and non-zero bytes: 2 bytes of header per literal
+#define DELTA_MAX_LENGTH (GIBCPU_SNAPSHOT_SIZE * 3 / 2 + 2)
+
+// posEdges of the longest instruction, a BSUM over 255 bytes, which a fast replay may overshoot its budget by
+#define REPLAY_MARGIN (cycleCost[TAS >> 4] + BSUM_BYTE_COST * 255)
+
+static size_t encodeDelta(const GibCPUSnapshot *a, const GibCPUSnapshot *b, uint8_t *out){
+    size_t length = 0;
+    int i = 0;
+    while(i < GIBCPU_SNAPSHOT_SIZE){
+        int zeros = 0;
+        while(i < GIBCPU_SNAPSHOT_SIZE && zeros < 255 && a->data[i] == b->data[i]){
+            zeros++;
+            i++;
+        }
+        size_t header = length;
+        int literals = 0;
+        length += 2;
+        while(i < GIBCPU_SNAPSHOT_SIZE && literals < 255 && a->data[i] != b->data[i]){
+            out[length++] = a->data[i] ^ b->data[i];
+            literals++;
+            i++;
+        }
+        if(literals == 0 && i == GIBCPU_SNAPSHOT_SIZE){    // trailing run of equal bytes needs no pair
+            length -= 2;
+            break;
+        }
+        out[header] = zeros;
+        out[header + 1] = literals;
+    }
+    return length;
+}
+
+static void applyDelta(GibCPUSnapshot *snapshot, const uint8_t *delta, size_t length){
+    size_t p = 0;
+    int i = 0;
+    while(p < length){
+        i += delta[p];
+        int literals = delta[p + 1];
+        p += 2;
+        for(int k = 0; k < literals; k++){
+            snapshot->data[i++] ^= delta[p++];
+        }
+    }
+}
+
+static Checkpoint *checkpointAt(GibCheckpoints *c, int index){
+    return &c->ring[(c->first + index) % c->capacity];
+}
+
+void checkpointTake(GibCPU *cpu){
+    GibCheckpoints *c = cpu->checkpoints;
+    GibCPUSnapshot current;
+    gibcpuSnapshot(cpu, &current);
+
+    if(c->count > 0){
+        // the current newest becomes a delta against the state being added
+        uint8_t delta[DELTA_MAX_LENGTH];
+        Checkpoint *previous = checkpointAt(c, c->count - 1);
+        size_t length = encodeDelta(&c->newest, &current, delta);
+        if(length > previous->allocated){
+            uint8_t *grown = realloc(previous->delta, length);
+            if(!grown){                                 // out of memory, history restarts here
+                c->count = 0;
+            }
+            else{
+                previous->delta = grown;
+                previous->allocated = length;
+            }
+        }
+        if(c->count > 0){
+            memcpy(previous->delta, delta, length);
+            previous->length = length;
+        }
+    }
+    if(c->count == c->capacity){
+        c->first = (c->first + 1) % c->capacity;
+        c->count--;
+    }
+
+    Checkpoint *added = checkpointAt(c, c->count++);
+    added->cycle = cpu->posEdgeCounter;
+    added->length = 0;
+    c->newest = current;
+    cpu->nextCheckpoint = (cpu->posEdgeCounter / c->interval + 1) * c->interval;
+}
+
+void checkpointsReset(GibCPU *cpu){
+    if(!cpu->checkpoints){
+        return;
+    }
+    cpu->checkpoints->first = 0;
+    cpu->checkpoints->count = 0;
+    checkpointTake(cpu);
+}
+
+void checkpointsDestroy(GibCPU *cpu){
+    GibCheckpoints *c = cpu->checkpoints;
+    if(!c){
+        return;
+    }
+    for(int i = 0; i < c->capacity; i++){
+        free(c->ring[i].delta);
+    }
+    free(c->ring);
+    free(c);
+    cpu->checkpoints = NULL;
+    cpu->nextCheckpoint = UINT64_MAX;
+}
+
+int gibcpuEnableCheckpoints(GibCPU *cpu, uint64_t interval, int capacity){
+    checkpointsDestroy(cpu);
+    if(interval == 0){
+        return 0;
+    }
+    if(capacity < 1){
+        return 1;
+    }
+    GibCheckpoints *c = calloc(1, sizeof(GibCheckpoints));
+    if(!c){
+        return 1;
+    }
+    c->ring = calloc(capacity, sizeof(Checkpoint));
+    if(!c->ring){
+        free(c);
+        return 1;
+    }
+    c->interval = interval;
+    c->capacity = capacity;
+    cpu->checkpoints = c;
+    checkpointTake(cpu);
+    return 0;
+}
+
+int gibcpuCheckpointCount(const GibCPU *cpu){
+    return cpu->checkpoints ? cpu->checkpoints->count : 0;
+}
+
+uint64_t gibcpuCheckpointCycle(const GibCPU *cpu, int index){
+    if(index < 0 || index >= gibcpuCheckpointCount(cpu)){
+        return 0;
+    }
+    return checkpointAt(cpu->checkpoints, index)->cycle;
+}
+
+int gibcpuRestoreCheckpoint(GibCPU *cpu, int index){
+    GibCheckpoints *c = cpu->checkpoints;
+    if(index < 0 || index >= gibcpuCheckpointCount(cpu)){
+        return 1;
+    }
+    for(int i = c->count - 2; i >= index; i--){
+        Checkpoint *older = checkpointAt(c, i);
+        applyDelta(&c->newest, older->delta, older->length);
+    }
+    c->count = index + 1;
+    checkpointAt(c, index)->length = 0;
+    restoreState(cpu, &c->newest);
+    cpu->nextCheckpoint = (cpu->posEdgeCounter / c->interval + 1) * c->interval;
+    return 0;
+}
+
+int gibcpuRewind(GibCPU *cpu, uint64_t cycle){
+    int index = gibcpuCheckpointCount(cpu) - 1;
+    while(index >= 0 && gibcpuCheckpointCycle(cpu, index) > cycle){
+        index--;
+    }
+    if(index < 0){
+        return 1;
+    }
+    gibcpuRestoreCheckpoint(cpu, index);
+
+    // replay on the fast engine to within the longest instruction of the target, since it stops at the first
+    // instruction boundary at or past its budget, then posEdge by posEdge
+    GibCPUDisplayHook hook = cpu->displayHook;
+    uint8_t engine = cpu->engine;
+    cpu->displayHook = NULL;
+    cpu->engine = GIBCPU_ENGINE_FAST;
+    if(cycle - cpu->posEdgeCounter > REPLAY_MARGIN){
+        gibcpuRun(cpu, cycle - cpu->posEdgeCounter - REPLAY_MARGIN);
+    }
+    int overshot = cpu->posEdgeCounter > cycle;
+    if(!overshot){
+        gibcpuStep(cpu, cycle - cpu->posEdgeCounter);
+    }
+    cpu->displayHook = hook;
+    cpu->engine = engine;
+    return overshot;
+}
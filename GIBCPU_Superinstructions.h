@@ -0,0 +1,25 @@
+#ifndef GIBCPU_SUPERINSTRUCTIONS_H
+#define GIBCPU_SUPERINSTRUCTIONS_H
+
+// Superinstructions of the threaded engine, generated by "make superinstructions" from a profile of the
+// bench corpus: each one runs back-to-back instructions with these opcodes in one dispatch. Listed by
+// dispatches saved per instruction of a workload, summed over the workloads:
+// game_of_life alu banked game_of_life_coproc memory multiply multiply_coproc spinlock
+
+#define GIBCPU_SUPER_TRIPLES(X) \
+    X(LOAD, SUB, JMPZ)       /* 0.607 */ \
+    X(ADD, WRTL, SUB)        /* 0.469 */ \
+    X(LOADL, ADD, WRTL)      /* 0.469 */ \
+    X(LOAD, ADD, WRT)        /* 0.430 */ \
+    X(LOAD, LOAD, SUB)       /* 0.379 */ \
+    X(WRT, LOAD, SUB)        /* 0.329 */
+
+#define GIBCPU_SUPER_PAIRS(X) \
+    X(SUB, JMPZ)             /* 0.563 */ \
+    X(LOAD, SUB)             /* 0.561 */ \
+    X(LOADL, ADD)            /* 0.394 */ \
+    X(WRT, LOAD)             /* 0.324 */ \
+    X(LOAD, LOAD)            /* 0.322 */ \
+    X(LOAD, ADD)             /* 0.302 */
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "GIBCPU_Internal.h"
+
+/* MULTI-CORE SYSTEM */
+
+struct GibCPUSystem {
+    GibCPU *cores[GIBCPU_MAX_CORES];
+    int coreCount;
+    uint32_t epoch;
+    uint32_t busCost;
+    uint64_t cycles;                    // end of the last epoch run
+    uint64_t epochEnd;                  // end of the epoch the cores are running
+    uint64_t epochs;
+    uint64_t busWait[GIBCPU_MAX_CORES];
+    uint8_t shared[MAX_VALUES];         // RAM as the bus sees it
+    uint8_t base[MAX_VALUES];           // what every core was handed at the last arbitration
+
+    // workers run the cores of one epoch between two generations of the controller
+    int threadCount;
+    pthread_t threads[GIBCPU_MAX_CORES];
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    uint64_t generation;
+    int running;                        // workers still busy with this generation
+    int quit;
+};
+
+typedef struct {
+    GibCPUSystem *system;
+    int id;
+} SystemWorker;
+
+// Charge core k posEdges spent waiting for the bus
+static void busStall(GibCPUSystem *s, int k, uint64_t cycles){
+    s->cores[k]->posEdgeCounter += cycles;
+    s->busWait[k] += cycles;
+}
+
+// Runs core k up to the end of the epoch, or up to a TAS it has to wait for, which stalls it to the epoch end
+static void runCore(GibCPUSystem *s, int k){
+    GibCPU *core = s->cores[k];
+    if(core->programHalt){
+        return;
+    }
+    if(!core->busWait && core->posEdgeCounter < s->epochEnd){
+        gibcpuRun(core, s->epochEnd - core->posEdgeCounter);
+        // the cycle-level model stops on any posEdge, arbitration needs an instruction boundary
+        while(core->state != 0 && !core->programHalt){
+            gibcpuStep(core, 1);
+        }
+    }
+    if(core->busWait && core->posEdgeCounter < s->epochEnd){
+        busStall(s, k, s->epochEnd - core->posEdgeCounter);
+    }
+}
+
+static void *workerMain(void *arg){
+    SystemWorker *worker = arg;
+    GibCPUSystem *s = worker->system;
+    int id = worker->id;
+    free(worker);
+
+    uint64_t seen = 0;
+    for(;;){
+        pthread_mutex_lock(&s->lock);
+        while(s->generation == seen && !s->quit){
+            pthread_cond_wait(&s->start, &s->lock);
+        }
+        seen = s->generation;
+        int quit = s->quit;
+        pthread_mutex_unlock(&s->lock);
+        if(quit){
+            return NULL;
+        }
+
+        for(int k = id; k < s->coreCount; k += s->threadCount){
+            runCore(s, k);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if(--s->running == 0){
+            pthread_cond_signal(&s->finished);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void runCores(GibCPUSystem *s){
+    if(!s->threadCount){
+        for(int k = 0; k < s->coreCount; k++){
+            runCore(s, k);
+        }
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->running = s->threadCount;
+    s->generation++;
+    pthread_cond_broadcast(&s->start);
+    while(s->running){
+        pthread_cond_wait(&s->finished, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Write the bytes of ram that differ into core, which drops whatever the caches hold for them
+static void syncCore(GibCPU *core, const uint8_t *ram){
+    for(int addr = 0; addr < MAX_VALUES; addr++){
+        if(core->ram[addr] != ram[addr]){
+            gibcpuWrite(core, addr, ram[addr]);
+        }
+    }
+}
+
+// Publish the bytes core wrote since it was handed base. Returns the number of bus transactions.
+static uint32_t writeBack(GibCPUSystem *s, const GibCPU *core, const uint8_t *base){
+    uint32_t written = 0;
+    for(int addr = 0; addr < MAX_VALUES; addr++){
+        if(core->ram[addr] != base[addr]){
+            s->shared[addr] = core->ram[addr];
+            written++;
+        }
+    }
+    return written;
+}
+
+// End of epoch, serial: write-backs, then the TAS grants, then every core gets the shared RAM. Cores are served
+// round-robin from a different core each epoch, and each one stalls for the transactions queued up to its own.
+static void arbitrate(GibCPUSystem *s){
+    int n = s->coreCount;
+    int first = s->epochs % n;
+    uint64_t transactions = 0;
+
+    for(int i = 0; i < n; i++){
+        int k = (first + i) % n;
+        uint32_t written = writeBack(s, s->cores[k], s->base);
+        if(written){
+            transactions += written;
+            if(!s->cores[k]->programHalt){
+                busStall(s, k, transactions * s->busCost);
+            }
+        }
+    }
+
+    for(int i = 0; i < n; i++){
+        int k = (first + i) % n;
+        GibCPU *core = s->cores[k];
+        if(!core->busWait){
+            continue;
+        }
+        syncCore(core, s->shared);
+        memcpy(s->base, s->shared, MAX_VALUES);
+        core->busWait = 0;
+        core->busGranted = 1;
+        stepInstructionCycles(core);
+        core->busGranted = 0;
+        writeBack(s, core, s->base);
+        transactions++;
+        busStall(s, k, transactions * s->busCost);
+    }
+
+    for(int k = 0; k < n; k++){
+        syncCore(s->cores[k], s->shared);
+    }
+    memcpy(s->base, s->shared, MAX_VALUES);
+}
+
+GibCPUSystem *gibcpuSystemCreate(const GibCPUSystemConfig *config){
+    if(config->cores < 1 || config->cores > GIBCPU_MAX_CORES){
+        return NULL;
+    }
+    GibCPUSystem *s = calloc(1, sizeof(GibCPUSystem));
+    if(!s){
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->finished, NULL);
+    s->coreCount = config->cores;
+    s->epoch = config->epoch ? config->epoch : GIBCPU_DEFAULT_EPOCH;
+    s->busCost = config->busCost;
+    for(int k = 0; k < s->coreCount; k++){
+        s->cores[k] = gibcpuCreate();
+        if(!s->cores[k]){
+            gibcpuSystemDestroy(s);
+            return NULL;
+        }
+        s->cores[k]->system = s;
+        s->cores[k]->reg[0] = k;
+        gibcpuSetEngine(s->cores[k], config->engine);
+    }
+
+    int threads = config->threads < s->coreCount ? config->threads : s->coreCount;
+    for(int w = 0; w < threads; w++){
+        SystemWorker *worker = malloc(sizeof(SystemWorker));
+        if(!worker){
+            gibcpuSystemDestroy(s);
+            return NULL;
+        }
+        worker->system = s;
+        worker->id = w;
+        if(pthread_create(&s->threads[w], NULL, workerMain, worker)){
+            free(worker);
+            gibcpuSystemDestroy(s);
+            return NULL;
+        }
+        s->threadCount++;       // workers only read it once the controller starts a generation
+    }
+    return s;
+}
+
+void gibcpuSystemDestroy(GibCPUSystem *s){
+    if(!s){
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    for(int w = 0; w < s->threadCount; w++){
+        pthread_join(s->threads[w], NULL);
+    }
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->finished);
+    pthread_mutex_destroy(&s->lock);
+    for(int k = 0; k < s->coreCount; k++){
+        gibcpuDestroy(s->cores[k]);
+    }
+    free(s);
+}
+
+size_t gibcpuSystemLoadImageFile(GibCPUSystem *s, const char *filename, GibCPUImageInfo *info){
+    GibCPU *first = s->cores[0];
+    GibCPUImageInfo header;
+    size_t length = gibcpuLoadImageFile(first, filename, &header);
+    if(!length || first->bankCount){
+        return 0;       // the bank register would have to be per core and the banks shared
+    }
+    for(int k = 0; k < s->coreCount; k++){
+        GibCPU *core = s->cores[k];
+        if(k){
+            gibcpuSetDisplay(core, first->printAddr, NULL, NULL);
+            loadImageAt(core, first->ram, MAX_VALUES, first->entry);
+        }
+        core->reg[0] = k;
+        s->busWait[k] = 0;
+    }
+    memcpy(s->shared, first->ram, MAX_VALUES);
+    memcpy(s->base, first->ram, MAX_VALUES);
+    s->cycles = 0;
+    s->epochs = 0;
+    if(info){
+        *info = header;
+    }
+    return length;
+}
+
+static int allHalted(const GibCPUSystem *s){
+    for(int k = 0; k < s->coreCount; k++){
+        if(!s->cores[k]->programHalt){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int gibcpuSystemRun(GibCPUSystem *s, uint64_t budget){
+    uint64_t stop = s->cycles + budget;
+    if(stop < s->cycles){
+        stop = UINT64_MAX;
+    }
+    while(!allHalted(s) && s->cycles < stop){
+        s->epochEnd = s->cycles + s->epoch;
+        runCores(s);
+        arbitrate(s);
+        s->cycles = s->epochEnd;
+        s->epochs++;
+    }
+    return allHalted(s);
+}
+
+GibCPU *gibcpuSystemCore(GibCPUSystem *s, int core){
+    return s->cores[core];
+}
+
+uint64_t gibcpuSystemCycles(const GibCPUSystem *s){
+    return s->cycles;
+}
+
+uint64_t gibcpuSystemBusWait(const GibCPUSystem *s, int core){
+    return s->busWait[core];
+}
+
+uint8_t gibcpuSystemRead(const GibCPUSystem *s, uint8_t addr){
+    return s->shared[addr];
+}
@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "GIBCPU_Internal.h"
+
+/* EXECUTION TRACE */
+
+// The emulator thread appends one record per instruction to a large buffer and hands full buffers to a
+// writer thread, which compresses each one into a block of the trace file. Every block opens with a
+// keyframe (a whole snapshot), so a replay decodes only the block holding the cycle it wants.
+//
+// File: "GIBTRACE", version, flags, 6 reserved bytes, then blocks of (raw length, stored length, cycle of
+// the opening keyframe) little-endian 32/32/64 bits followed by the stored bytes, compressed unless the
+// two lengths are equal.
+//
+// Record: a flags byte, an extra flags byte if TRACE_EXTRA is set, the command, the changed registers in
+// order, the program counter after a jump, a write count and (address, value) pairs, the loop counter delta
+// and the cycle delta as LEB128, and the fault. The cycle delta is left out when it is what tableCycles()
+// says, the program counter when it is the next instruction.
+#define TRACE_MAGIC "GIBTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_BLOCK_HEADER_SIZE 16
+#define TRACE_COMPRESSED 0x01
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_BUFFERS 4
+#define TRACE_MAX_WRITES 255
+#define TRACE_MAX_RECORD (8 + 4 + 1 + 1 + 2 * TRACE_MAX_WRITES + 10 + 10 + 1)
+#define TRACE_BUFFER_SLACK (4 * TRACE_MAX_RECORD + GIBCPU_SNAPSHOT_SIZE)
+
+#define TRACE_REGISTERS 0x0F    // one bit per changed register
+#define TRACE_JUMP 0x10
+#define TRACE_WRITES 0x20
+#define TRACE_LOOPS 0x40
+#define TRACE_EXTRA 0x80
+
+#define TRACE_CYCLES 0x01
+#define TRACE_HALT 0x02
+#define TRACE_FAULT 0x04
+#define TRACE_KEYFRAME 0x08     // a snapshot follows instead of an instruction
+#define TRACE_WRITES_ONLY 0x10  // writes from outside the program that did not fit in one record
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_BOUND(length) ((length) + (length) / 255 + 16)
+
+struct GibTrace {
+    FILE *file;
+    int compress;
+
+    // what a replay holds after the last record
+    uint8_t reg[4];
+    uint8_t pc;
+    uint8_t halted;
+    uint64_t cycles;
+    uint64_t loops;
+    int keyframeDue;
+    int writeCount;
+    uint8_t writes[TRACE_MAX_WRITES][2];
+
+    // the buffer being filled is buffers[produced % TRACE_BUFFERS]
+    uint8_t *out;
+    size_t length;
+    uint8_t *buffers[TRACE_BUFFERS];
+    size_t lengths[TRACE_BUFFERS];
+    uint64_t firstCycles[TRACE_BUFFERS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    uint64_t produced;
+    uint64_t consumed;
+    int stopping;
+    int failed;
+    pthread_t writer;
+    uint8_t *packed;
+    uint32_t *lzTable;
+};
+
+static void storeLittleEndian(uint8_t *out, uint64_t value, int bytes){
+    for(int i = 0; i < bytes; i++){
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t loadLittleEndian(const uint8_t *in, int bytes){
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++){
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+/* BLOCK COMPRESSION */
+
+// LZ4-style sequences: a token with the literal count in the high nibble and the match length minus
+// LZ_MIN_MATCH in the low one (15 means 255-valued extension bytes follow), the literals, then the 16-bit
+// match offset. The last sequence is literals only. Records of a loop repeat almost byte for byte, so the
+// greedy single-probe matcher is enough.
+static size_t lzLength(uint8_t *out, size_t o, size_t extra){
+    while(extra >= 255){
+        out[o++] = 255;
+        extra -= 255;
+    }
+    out[o++] = (uint8_t)extra;
+    return o;
+}
+
+static size_t lzSequence(uint8_t *out, size_t o, const uint8_t *literals, size_t count, size_t offset, size_t match){
+    size_t extra = match ? match - LZ_MIN_MATCH : 0;
+    out[o++] = (uint8_t)((count < 15 ? count : 15) << 4 | (extra < 15 ? extra : 15));
+    if(count >= 15){
+        o = lzLength(out, o, count - 15);
+    }
+    memcpy(out + o, literals, count);
+    o += count;
+    if(match){
+        out[o++] = offset & 0xFF;
+        out[o++] = offset >> 8;
+        if(extra >= 15){
+            o = lzLength(out, o, extra - 15);
+        }
+    }
+    return o;
+}
+
+static size_t lzCompress(const uint8_t *in, size_t length, uint8_t *out, uint32_t *table){
+    memset(table, 0, sizeof(uint32_t) << LZ_HASH_BITS);     // positions plus one, 0 for none
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t o = 0;
+    while(i + LZ_MIN_MATCH <= length){
+        uint32_t sequence;
+        memcpy(&sequence, in + i, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+        if(candidate && i - (candidate - 1) <= LZ_MAX_OFFSET && !memcmp(in + candidate - 1, in + i, LZ_MIN_MATCH)){
+            size_t from = candidate - 1;
+            size_t match = LZ_MIN_MATCH;
+            while(i + match < length && in[from + match] == in[i + match]){
+                match++;
+            }
+            o = lzSequence(out, o, in + anchor, i - anchor, i - from, match);
+            i += match;
+            anchor = i;
+        }
+        else{
+            i++;
+        }
+    }
+    return lzSequence(out, o, in + anchor, length - anchor, 0, 0);
+}
+
+// Returns 0 if the block is damaged
+static int lzReadLength(const uint8_t *in, size_t length, size_t *p, size_t *value){
+    uint8_t byte;
+    do{
+        if(*p >= length){
+            return 0;
+        }
+        byte = in[(*p)++];
+        *value += byte;
+    } while(byte == 255);
+    return 1;
+}
+
+static int lzDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t expected){
+    size_t p = 0;
+    size_t o = 0;
+    while(p < length){
+        uint8_t token = in[p++];
+        size_t count = token >> 4;
+        if(count == 15 && !lzReadLength(in, length, &p, &count)){
+            return 0;
+        }
+        if(count > length - p || count > expected - o){
+            return 0;
+        }
+        memcpy(out + o, in + p, count);
+        p += count;
+        o += count;
+        if(p == length){
+            break;
+        }
+        if(length - p < 2){
+            return 0;
+        }
+        size_t offset = in[p] | in[p + 1] << 8;
+        p += 2;
+        size_t match = token & 0x0F;
+        if(match == 15 && !lzReadLength(in, length, &p, &match)){
+            return 0;
+        }
+        match += LZ_MIN_MATCH;
+        if(offset == 0 || offset > o || match > expected - o){
+            return 0;
+        }
+        for(size_t k = 0; k < match; k++, o++){      // may overlap its own output
+            out[o] = out[o - offset];
+        }
+    }
+    return o == expected;
+}
+
+/* WRITER THREAD */
+
+static void writeBlock(GibTrace *t, const uint8_t *raw, size_t length, uint64_t firstCycle){
+    const uint8_t *stored = raw;
+    size_t storedLength = length;
+    if(t->compress){
+        size_t packed = lzCompress(raw, length, t->packed, t->lzTable);
+        if(packed < length){
+            stored = t->packed;
+            storedLength = packed;
+        }
+    }
+    uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+    storeLittleEndian(header, length, 4);
+    storeLittleEndian(header + 4, storedLength, 4);
+    storeLittleEndian(header + 8, firstCycle, 8);
+    if(fwrite(header, 1, sizeof(header), t->file) != sizeof(header) ||
+       fwrite(stored, 1, storedLength, t->file) != storedLength){
+        t->failed = 1;
+    }
+}
+
+static void *writerMain(void *arg){
+    GibTrace *t = arg;
+    pthread_mutex_lock(&t->lock);
+    for(;;){
+        while(t->consumed == t->produced && !t->stopping){
+            pthread_cond_wait(&t->filled, &t->lock);
+        }
+        if(t->consumed == t->produced){
+            break;
+        }
+        int index = t->consumed % TRACE_BUFFERS;
+        pthread_mutex_unlock(&t->lock);
+        writeBlock(t, t->buffers[index], t->lengths[index], t->firstCycles[index]);
+        pthread_mutex_lock(&t->lock);
+        t->consumed++;
+        pthread_cond_signal(&t->drained);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+// Queue the buffer being filled for the writer and move on to the next free one
+static void handOff(GibTrace *t){
+    pthread_mutex_lock(&t->lock);
+    t->lengths[t->produced % TRACE_BUFFERS] = t->length;
+    t->produced++;
+    pthread_cond_signal(&t->filled);
+    while(t->produced - t->consumed == TRACE_BUFFERS){
+        pthread_cond_wait(&t->drained, &t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+    t->out = t->buffers[t->produced % TRACE_BUFFERS];
+    t->length = 0;
+}
+
+/* RECORDING */
+
+static size_t putVarint(uint8_t *out, size_t o, uint64_t value){
+    while(value >= 0x80){
+        out[o++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[o++] = (uint8_t)value;
+    return o;
+}
+
+// Where a replay stands after the record just written
+static void traceShadow(GibTrace *t, const GibCPU *cpu){
+    memcpy(t->reg, cpu->reg, 4);
+    t->pc = cpu->count;
+    t->halted = cpu->programHalt;
+    t->cycles = cpu->posEdgeCounter;
+    t->loops = cpu->loopCounter;
+    t->writeCount = 0;
+}
+
+static void writeKeyframe(GibTrace *t, const GibCPU *cpu){
+    GibCPUSnapshot snapshot;
+    gibcpuSnapshot(cpu, &snapshot);
+    if(t->length == 0){
+        t->firstCycles[t->produced % TRACE_BUFFERS] = cpu->posEdgeCounter;
+    }
+    t->out[t->length++] = TRACE_EXTRA;
+    t->out[t->length++] = TRACE_KEYFRAME;
+    memcpy(t->out + t->length, snapshot.data, GIBCPU_SNAPSHOT_SIZE);
+    t->length += GIBCPU_SNAPSHOT_SIZE;
+    t->keyframeDue = 0;
+    traceShadow(t, cpu);
+}
+
+// Past the slack, the buffer goes to the writer and the next one opens with a keyframe
+static void endRecord(GibTrace *t, const GibCPU *cpu){
+    if(t->length > TRACE_BUFFER_SIZE - TRACE_BUFFER_SLACK){
+        handOff(t);
+        writeKeyframe(t, cpu);
+    }
+}
+
+static size_t putWrites(GibTrace *t, size_t o){
+    t->out[o++] = (uint8_t)t->writeCount;
+    memcpy(t->out + o, t->writes, 2 * t->writeCount);
+    return o + 2 * t->writeCount;
+}
+
+void traceWrite(GibCPU *cpu, uint8_t addr){
+    GibTrace *t = cpu->trace;
+    if(t->keyframeDue){
+        return;                 // the keyframe will hold it
+    }
+    if(t->writeCount == TRACE_MAX_WRITES){
+        if(t->length > TRACE_BUFFER_SIZE - TRACE_BUFFER_SLACK){
+            t->keyframeDue = 1;     // no room until the next boundary hands the buffer over
+            t->writeCount = 0;
+            return;
+        }
+        // a flood of writes from outside the program: let them go ahead of the instruction
+        size_t o = t->length;
+        t->out[o++] = TRACE_EXTRA | TRACE_WRITES;
+        t->out[o++] = TRACE_WRITES_ONLY;
+        t->length = putWrites(t, o);
+        t->writeCount = 0;
+    }
+    t->writes[t->writeCount][0] = addr;
+    t->writes[t->writeCount][1] = cpu->ram[addr];
+    t->writeCount++;
+}
+
+void traceSync(GibCPU *cpu){
+    GibTrace *t = cpu->trace;
+    if(t->keyframeDue && cpu->state == 0){
+        writeKeyframe(t, cpu);
+        endRecord(t, cpu);
+    }
+}
+
+void traceDiscontinuity(GibCPU *cpu){
+    cpu->trace->keyframeDue = 1;
+}
+
+// Cycle delta a record leaves out: the cost table's, JMPZ_TAKEN_COST for a taken JMPZ or MUL_COST. A BSUM
+// over any bytes depends on RAM, so its delta is written.
+static uint64_t tableCycles(uint8_t cmd, int jumped){
+    if((cmd & 0b11110000) == JMPZ && jumped){
+        return JMPZ_TAKEN_COST;
+    }
+    return (cmd & 0b11111100) == MUL ? MUL_COST : cycleCost[cmd >> 4];
+}
+
+// One record for the instruction that brought the machine to this boundary. Nothing is written if it did not
+// run (a TAS waiting for the bus).
+void traceInstruction(GibCPU *cpu, uint8_t cmd){
+    GibTrace *t = cpu->trace;
+    if(t->keyframeDue){
+        writeKeyframe(t, cpu);
+        endRecord(t, cpu);
+        return;
+    }
+    if(cpu->posEdgeCounter == t->cycles && cpu->count == t->pc && cpu->programHalt == t->halted){
+        return;
+    }
+    uint8_t *out = t->out;
+    size_t start = t->length;
+    size_t o = start + 2;
+    uint8_t flags = 0;
+    uint8_t extra = 0;
+
+    out[o++] = cmd;
+    for(int i = 0; i < 4; i++){
+        if(cpu->reg[i] != t->reg[i]){
+            flags |= 1 << i;
+            out[o++] = cpu->reg[i];
+        }
+    }
+    uint8_t op = cmd >> 4;
+    int jumped = cpu->count != (uint8_t)(t->pc + instructionLength(op));
+    if(jumped){
+        flags |= TRACE_JUMP;
+        out[o++] = cpu->count;
+    }
+    if(t->writeCount){
+        flags |= TRACE_WRITES;
+        o = putWrites(t, o);
+    }
+    if(cpu->loopCounter != t->loops){
+        flags |= TRACE_LOOPS;
+        o = putVarint(out, o, cpu->loopCounter - t->loops);
+    }
+    if(cpu->posEdgeCounter - t->cycles != tableCycles(cmd, jumped)){
+        extra |= TRACE_CYCLES;
+        o = putVarint(out, o, cpu->posEdgeCounter - t->cycles);
+    }
+    if(cpu->programHalt != t->halted){
+        extra |= TRACE_HALT;
+    }
+    if(cpu->fault){
+        extra |= TRACE_FAULT;
+        out[o++] = cpu->fault;
+    }
+
+    // flags go in front, the command slides down a byte when there are no extra flags
+    if(extra){
+        out[start] = flags | TRACE_EXTRA;
+        out[start + 1] = extra;
+    }
+    else{
+        out[start] = flags;
+        memmove(out + start + 1, out + start + 2, o - start - 2);
+        o--;
+    }
+    t->length = o;
+    traceShadow(t, cpu);
+    endRecord(t, cpu);
+}
+
+// gibcpuRun() while tracing. The cycle-level model records at every boundary it reaches, the other engines
+// hand over to the fast engine, which records each instruction itself.
+void runTraced(GibCPU *cpu, uint64_t limit){
+    int cycleLevel = cpu->profile || cpu->microcode || cpu->engine == GIBCPU_ENGINE_CYCLE;
+    traceSync(cpu);
+    // the fast engine starts from an instruction boundary, so finish one gibcpuStep() left open
+    while(!cpu->programHalt && cpu->posEdgeCounter < limit && !cpu->busWait && (cycleLevel || cpu->state != 0)){
+        if(cpu->profile){
+            profilePosEdge(cpu);
+        }
+        else{
+            stepPosEdge(cpu);
+        }
+        if(cpu->state == 0 || cpu->programHalt){
+            traceInstruction(cpu, cpu->command);
+        }
+    }
+    if(!cycleLevel && cpu->state == 0){
+        runFast(cpu, limit, MAX_VALUES);
+    }
+}
+
+static void traceFree(GibTrace *t){
+    for(int i = 0; i < TRACE_BUFFERS; i++){
+        free(t->buffers[i]);
+    }
+    free(t->packed);
+    free(t->lzTable);
+    free(t);
+}
+
+int gibcpuStartTrace(GibCPU *cpu, const char *filename, int compress){
+    gibcpuStopTrace(cpu);
+    GibTrace *t = calloc(1, sizeof(GibTrace));
+    if(!t){
+        return 1;
+    }
+    int allocated = 1;
+    for(int i = 0; i < TRACE_BUFFERS; i++){
+        t->buffers[i] = malloc(TRACE_BUFFER_SIZE);
+        allocated &= t->buffers[i] != NULL;
+    }
+    if(compress){
+        t->packed = malloc(LZ_BOUND(TRACE_BUFFER_SIZE));
+        t->lzTable = malloc(sizeof(uint32_t) << LZ_HASH_BITS);
+        allocated &= t->packed && t->lzTable;
+    }
+    if(!allocated){
+        traceFree(t);
+        return 1;
+    }
+    t->file = fopen(filename, "wb");
+    if(!t->file){
+        perror("Error opening trace file");
+        traceFree(t);
+        return 1;
+    }
+    uint8_t header[TRACE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_MAGIC, 8);
+    header[8] = TRACE_VERSION;
+    header[9] = compress ? TRACE_COMPRESSED : 0;
+    if(fwrite(header, 1, sizeof(header), t->file) != sizeof(header)){
+        fclose(t->file);
+        traceFree(t);
+        return 1;
+    }
+
+    t->compress = compress;
+    t->out = t->buffers[0];
+    t->keyframeDue = 1;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->filled, NULL);
+    pthread_cond_init(&t->drained, NULL);
+    if(pthread_create(&t->writer, NULL, writerMain, t)){
+        fclose(t->file);
+        traceFree(t);
+        return 1;
+    }
+    cpu->trace = t;
+    traceSync(cpu);
+    return 0;
+}
+
+int gibcpuStopTrace(GibCPU *cpu){
+    GibTrace *t = cpu->trace;
+    if(!t){
+        return 0;
+    }
+    traceSync(cpu);
+    if(t->writeCount){                      // writes from outside since the last instruction
+        size_t o = t->length;
+        t->out[o++] = TRACE_EXTRA | TRACE_WRITES;
+        t->out[o++] = TRACE_WRITES_ONLY;
+        t->length = putWrites(t, o);
+    }
+    if(t->length){
+        handOff(t);
+    }
+    pthread_mutex_lock(&t->lock);
+    t->stopping = 1;
+    pthread_cond_signal(&t->filled);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->writer, NULL);
+    pthread_cond_destroy(&t->filled);
+    pthread_cond_destroy(&t->drained);
+    pthread_mutex_destroy(&t->lock);
+
+    int failed = t->failed;
+    failed |= fclose(t->file) != 0;
+    cpu->trace = NULL;
+    traceFree(t);
+    return failed;
+}
+
+/* REPLAY */
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t p;
+    int damaged;
+} TraceReader;
+
+static uint8_t readByte(TraceReader *r){
+    if(r->p >= r->length){
+        r->damaged = 1;
+        return 0;
+    }
+    return r->data[r->p++];
+}
+
+static uint64_t readVarint(TraceReader *r){
+    uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        uint8_t byte = readByte(r);
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            break;
+        }
+    }
+    return value;
+}
+
+// Writes go through ramWritten() so the bank register switches banks as it did when recording
+static void replayWrites(TraceReader *r, GibCPU *cpu){
+    int count = readByte(r);
+    for(int i = 0; i < count && !r->damaged; i++){
+        uint8_t addr = readByte(r);
+        cpu->ram[addr] = readByte(r);
+        ramWritten(cpu, addr);
+    }
+}
+
+// Apply the records of one block up to the last instruction boundary at or before cycle. Returns 1 once a
+// record past cycle is reached, 0 at the end of the block, -1 if it is damaged.
+static int replayBlock(TraceReader *r, GibCPU *cpu, uint64_t cycle, int *started){
+    while(r->p < r->length){
+        uint8_t flags = readByte(r);
+        uint8_t extra = flags & TRACE_EXTRA ? readByte(r) : 0;
+        if(extra & TRACE_KEYFRAME){
+            if(r->length - r->p < GIBCPU_SNAPSHOT_SIZE){
+                return -1;
+            }
+            GibCPUSnapshot snapshot;
+            memcpy(snapshot.data, r->data + r->p, GIBCPU_SNAPSHOT_SIZE);
+            if(*started && snapshotCycles(&snapshot) > cycle){
+                return 1;
+            }
+            r->p += GIBCPU_SNAPSHOT_SIZE;
+            gibcpuRestore(cpu, &snapshot);
+            *started = 1;
+            continue;
+        }
+        if(extra & TRACE_WRITES_ONLY){
+            replayWrites(r, cpu);
+            continue;
+        }
+
+        // decode the whole record before deciding whether it still ends at or before cycle
+        size_t recordStart = r->p - (extra ? 2 : 1);
+        uint8_t cmd = readByte(r);
+        uint8_t reg[4];
+        memcpy(reg, cpu->reg, 4);
+        for(int i = 0; i < 4; i++){
+            if(flags & (1 << i)){
+                reg[i] = readByte(r);
+            }
+        }
+        uint8_t op = cmd >> 4;
+        uint8_t pc = flags & TRACE_JUMP ? readByte(r) : (uint8_t)(cpu->count + instructionLength(op));
+        size_t writes = r->p;
+        if(flags & TRACE_WRITES){
+            int count = readByte(r);
+            r->p += 2 * count;
+        }
+        uint64_t loops = flags & TRACE_LOOPS ? readVarint(r) : 0;
+        uint64_t cycles = tableCycles(cmd, flags & TRACE_JUMP);
+        if(extra & TRACE_CYCLES){
+            cycles = readVarint(r);
+        }
+        uint8_t fault = extra & TRACE_FAULT ? readByte(r) : 0;
+        if(r->damaged || r->p > r->length || !*started){
+            return -1;
+        }
+        if(cpu->posEdgeCounter + cycles > cycle){
+            r->p = recordStart;
+            return 1;
+        }
+
+        size_t end = r->p;
+        r->p = writes;
+        if(flags & TRACE_WRITES){
+            replayWrites(r, cpu);
+        }
+        r->p = end;
+        memcpy(cpu->reg, reg, 4);
+        cpu->count = pc;
+        cpu->command = cmd;
+        cpu->posEdgeCounter += cycles;
+        cpu->loopCounter += loops;
+        cpu->fault = fault;
+        if(extra & TRACE_HALT){
+            cpu->programHalt = 1;
+        }
+    }
+    return 0;
+}
+
+int gibcpuReplayTrace(GibCPU *cpu, const char *filename, uint64_t cycle){
+    FILE *file = fopen(filename, "rb");
+    if(!file){
+        perror("Error opening trace file");
+        return 1;
+    }
+    uint8_t header[TRACE_HEADER_SIZE];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_MAGIC, 8) ||
+       header[8] != TRACE_VERSION){
+        printf("%s is not a GIBCPU trace\n", filename);
+        fclose(file);
+        return 1;
+    }
+
+    // the last block opening at or before cycle holds it
+    long chosen = -1;
+    uint8_t block[TRACE_BLOCK_HEADER_SIZE];
+    for(;;){
+        long offset = ftell(file);
+        if(fread(block, 1, sizeof(block), file) != sizeof(block)){
+            break;
+        }
+        if(loadLittleEndian(block + 8, 8) <= cycle){
+            chosen = offset;
+        }
+        if(fseek(file, (long)loadLittleEndian(block + 4, 4), SEEK_CUR)){
+            break;
+        }
+    }
+    if(chosen < 0){
+        printf("%s starts after clock cycle %llu\n", filename, (unsigned long long)cycle);
+        fclose(file);
+        return 1;
+    }
+
+    // carry on into the next blocks: the first keyframe past cycle stops the replay
+    fseek(file, chosen, SEEK_SET);
+    int result = 0;
+    int started = 0;
+    while(result == 0 && fread(block, 1, sizeof(block), file) == sizeof(block)){
+        size_t rawLength = loadLittleEndian(block, 4);
+        size_t storedLength = loadLittleEndian(block + 4, 4);
+        uint8_t *stored = rawLength <= TRACE_BUFFER_SIZE && storedLength <= rawLength ? malloc(storedLength + 1) : NULL;
+        uint8_t *raw = stored ? malloc(rawLength + 1) : NULL;
+        int ok = raw && fread(stored, 1, storedLength, file) == storedLength;
+        if(ok && storedLength == rawLength){
+            memcpy(raw, stored, rawLength);
+        }
+        else if(ok){
+            ok = lzDecompress(stored, storedLength, raw, rawLength);
+        }
+        if(ok){
+            TraceReader reader = {raw, rawLength, 0, 0};
+            result = replayBlock(&reader, cpu, cycle, &started);
+        }
+        free(stored);
+        free(raw);
+        if(!ok){
+            result = -1;
+        }
+    }
+    fclose(file);
+    if(result < 0 || !started){
+        printf("%s is damaged\n", filename);
+        return 1;
+    }
+    memoClear(cpu);
+    return 0;
+}
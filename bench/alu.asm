@@ -0,0 +1,23 @@
+load r0 $0
+load r1 $1
+load r2 $2
+add r2 r3
+xor r2 r3
+lshiftb r3
+add r0 r3
+shiftb r3
+or r2 r3
+sub r0 r2
+jmpz r2 #3
+jmp #2
+sub r0 r1
+jmpz r1 #4
+jmp #1
+halt
+$0 1
+$1 200
+$2 255
+#1 2
+#2 3
+#3 12
+#4 15
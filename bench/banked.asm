@@ -0,0 +1,97 @@
+load r0 $0
+load r1 $1
+sub r0 r1
+load r2 $2
+wrtl r2 r1
+load r2 $3
+loadl r2 r3
+add r1 r3
+wrtl r2 r3
+sub r0 r2
+load r3 $2
+sub r2 r3
+jmpz r3 #4
+jmp #3
+jmpz r1 #5
+jmp #2
+load r3 $4
+sub r0 r3
+wrt r3 $4
+jmpz r3 #6
+jmp #1
+halt
+$0 1
+$1 32
+$2 191
+$3 255
+$4 4
+#1 1
+#2 2
+#3 6
+#4 14
+#5 16
+#6 21
+.bank 0
+.fill 64 0
+.bank 1
+.fill 64 7
+.bank 2
+.fill 64 14
+.bank 3
+.fill 64 21
+.bank 4
+.fill 64 28
+.bank 5
+.fill 64 35
+.bank 6
+.fill 64 42
+.bank 7
+.fill 64 49
+.bank 8
+.fill 64 56
+.bank 9
+.fill 64 63
+.bank 10
+.fill 64 70
+.bank 11
+.fill 64 77
+.bank 12
+.fill 64 84
+.bank 13
+.fill 64 91
+.bank 14
+.fill 64 98
+.bank 15
+.fill 64 105
+.bank 16
+.fill 64 112
+.bank 17
+.fill 64 119
+.bank 18
+.fill 64 126
+.bank 19
+.fill 64 133
+.bank 20
+.fill 64 140
+.bank 21
+.fill 64 147
+.bank 22
+.fill 64 154
+.bank 23
+.fill 64 161
+.bank 24
+.fill 64 168
+.bank 25
+.fill 64 175
+.bank 26
+.fill 64 182
+.bank 27
+.fill 64 189
+.bank 28
+.fill 64 196
+.bank 29
+.fill 64 203
+.bank 30
+.fill 64 210
+.bank 31
+.fill 64 217
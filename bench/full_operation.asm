@@ -0,0 +1,21 @@
+and r0 r1
+and r0 r2
+load r1 $1
+load r2 $100
+add r1 r2
+or r1 r2
+xor r1 r2
+notb r2
+lshiftb r2
+shiftb r2
+sub r1 r2
+wrt r2 $100
+and r0 r2
+jmpz r2 #1
+jmp #2
+load r3 $1
+halt
+$1 2
+$100 1
+#1 15
+#2 0
@@ -0,0 +1,196 @@
+.print 6
+.display 150
+.grid 6 6
+load r0 $3
+wrt r0 $2
+load r0 $2
+load r1 $1
+sub r1 r0
+wrt r0 $2
+load r0 #13
+wrt r0 #12
+load r0 #16
+wrt r0 #15
+load r0 #12
+load r1 #15
+load r2 $1
+sub r2 r0
+sub r2 r1
+wrt r0 #12
+wrt r1 #15
+load r2 $91
+sub r2 r0
+load r1 $0
+add r0 r1
+bsum r1 $90
+load r2 $5
+add r2 r0
+loadl r0 r3
+add r3 r1
+add r2 r0
+load r3 $0
+add r0 r3
+bsum r3 $90
+add r3 r1
+load r2 $92
+sub r2 r0
+loadl r0 r3
+add r3 r1
+wrt r1 $4
+load r0 #12
+loadl r0 r2
+load r0 $0
+load r3 $1
+jmpz r1 #3
+sub r3 r1
+jmpz r1 #3
+sub r3 r1
+jmpz r2 #1
+jmpz r1 #4
+sub r3 r1
+jmpz r1 #4
+jmp #3
+jmpz r1 #3
+sub r3 r1
+jmpz r1 #4
+jmp #3
+load r1 #15
+wrtl r1 r3
+jmp #5
+load r1 #15
+wrtl r1 r0
+load r0 #14
+sub r0 r1
+jmpz r1 #6
+jmp #0
+load r0 #13
+wrt r0 #12
+load r0 #16
+wrt r0 #15
+load r0 #12
+load r1 #15
+load r2 $1
+sub r2 r0
+sub r2 r1
+loadl r1 r2
+wrtl r0 r2
+wrt r0 #12
+wrt r1 #15
+load r2 #11
+sub r2 r0
+jmpz r0 #8
+jmp #7
+load r0 $2
+jmpz r0 #10
+jmp #9
+halt
+$0 0
+$1 1
+$2 0
+$3 5
+$4 0
+$5 6
+$6 0 
+$7 0
+$8 0
+$9 0
+$10 0
+$11 0
+$12 0
+$13 0
+$14 0
+$15 0
+$16 0
+$17 0
+$18 0
+$19 0
+$20 1
+$21 0
+$22 0
+$23 0
+$24 0
+$25 0
+$26 0
+$27 1
+$28 0
+$29 0
+$30 0
+$31 1
+$32 1
+$33 1
+$34 0
+$35 0
+$36 0
+$37 0
+$38 0
+$39 0
+$40 0
+$41 0
+$42 0
+$43 0
+$44 0
+$45 0
+$46 0
+$47 0
+$48 0
+$49 0
+$50 0
+$51 0
+$52 0
+$53 0
+$54 0
+$55 0
+$56 0
+$57 0
+$58 0
+$59 0
+$60 0
+$61 0
+$62 0
+$63 0
+$64 0
+$65 0
+$66 0
+$67 0
+$68 0
+$69 0
+$70 0
+$71 0
+$72 0
+$73 0
+$74 0
+$75 0
+$76 0
+$77 0
+$78 0
+$79 0
+$80 0
+$81 0
+$82 0
+$83 0
+$84 0
+$85 0
+$86 0
+$87 0
+$88 0
+$89 0
+#0 10
+#1 49
+#2 45
+#3 56
+#4 53
+#5 58
+#6 62
+#7 66
+#8 79
+#9 2
+#10 82
+#11 95
+#12 0
+#13 131
+#14 138
+#15 0
+#16 173
+$90 3
+$91 7
+$92 4
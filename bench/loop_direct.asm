@@ -0,0 +1,24 @@
+load r0 $0
+and r0 r1
+and r0 r2
+and r0 r3
+load r0 $1
+load r1 $2
+sub r1 r0
+jmp #1
+sub r1 r0
+wrt r0 $1
+load r2 #4
+loadl r2 r3
+add r1 r3
+wrtl r2 r3
+jmpz r0 #2
+jmp #3
+halt
+$0 0
+$1 3
+$2 1
+#1 8
+#2 16
+#3 0
+#4 20
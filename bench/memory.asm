@@ -0,0 +1,25 @@
+load r0 $0
+load r1 $1
+load r2 $2
+loadl r2 r3
+add r0 r3
+wrtl r2 r3
+sub r0 r2
+wrt r2 $3
+load r3 $4
+sub r2 r3
+jmpz r3 #3
+jmp #2
+sub r0 r1
+jmpz r1 #4
+jmp #1
+halt
+$0 1
+$1 200
+$2 255
+$3 0
+$4 128
+#1 2
+#2 3
+#3 12
+#4 15
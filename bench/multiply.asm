@@ -0,0 +1,34 @@
+load r3 $2
+wrt r3 $3
+load r0 $3
+load r1 $4
+load r2 $0
+jmpz r1 #4
+load r3 $1
+and r1 r3
+jmpz r3 #3
+add r0 r2
+lshiftb r0
+shiftb r1
+jmp #2
+load r3 $5
+add r2 r3
+wrt r3 $5
+load r3 $3
+load r2 $1
+sub r2 r3
+wrt r3 $3
+jmpz r3 #5
+jmp #1
+halt
+$0 0
+$1 1
+$2 200
+$3 0
+$4 173
+$5 0
+#1 2
+#2 5
+#3 10
+#4 13
+#5 22
@@ -0,0 +1,22 @@
+load r3 $2
+wrt r3 $3
+load r2 $3
+mul r2 $4
+load r3 $5
+add r2 r3
+wrt r3 $5
+load r3 $3
+load r2 $1
+sub r2 r3
+wrt r3 $3
+jmpz r3 #2
+jmp #1
+halt
+$0 0
+$1 1
+$2 200
+$3 0
+$4 173
+$5 0
+#1 2
+#2 13
@@ -0,0 +1,20 @@
+load r0 $0
+load r1 $1
+tas r2 $2
+jmpz r2 #2
+jmp #1
+load r3 $3
+add r0 r3
+wrt r3 $3
+wrt r2 $2
+sub r0 r1
+jmpz r1 #3
+jmp #1
+halt
+$0 1
+$1 50
+$2 0
+$3 0
+#1 2
+#2 5
+#3 12